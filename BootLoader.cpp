@@ -4,6 +4,7 @@
 //#include "USB_HID.h"
 //#include "Hex.h"
 #include "BootLoader.h"
+#include "utils.h"
 //#include "PIC32UBL.h"
 //#include "PIC32UBLDlg.h"
 //#include ".\pic32ubldlg.h"
@@ -17,38 +18,17 @@
 #define DLE 16
 
 
-/**
- * Static table used for the table_driven implementation.
- *****************************************************************************/
-static const unsigned short crc_table[16] = 
-{
-    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
-    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
-};
-
 /****************************************************************************
- * Update the crc value with new data.
+ * Calculates the crc of a buffer. Kept for the code below, the engines live
+ * in Utils.
  *
- * \param crc      The current crc value.
  * \param data     Pointer to a buffer of \a data_len bytes.
  * \param len		Number of bytes in the \a data buffer.
- * \return         The updated crc value.
+ * \return         The crc value.
  *****************************************************************************/
 unsigned short CalculateCrc(char *data, unsigned int len)
 {
-    unsigned int i;
-    unsigned short crc = 0;
-    
-    while(len--)
-    {
-        i = (crc >> 12) ^ (*data >> 4);
-	    crc = crc_table[i & 0x0F] ^ (crc << 4);
-	    i = (crc >> 12) ^ (*data >> 0);
-	    crc = crc_table[i & 0x0F] ^ (crc << 4);
-	    data++;
-	} 
-
-    return (crc & 0xFFFF);
+    return Utils::CalculateCrc(data, len);
 }
 
 /****************************************************************************
@@ -0,0 +1,16 @@
+# Shared by the benchmarks. The sources measured are taken from the
+# application tree, SRC_DIR; the test data comes from benchdata.cpp.
+
+QT      += core
+QT      -= gui
+CONFIG  += console c++14 release
+CONFIG  -= app_bundle
+TEMPLATE = app
+
+SRC_DIR = $$PWD/..
+INCLUDEPATH += $$SRC_DIR $$PWD
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+SOURCES += $$PWD/benchdata.cpp
+HEADERS += $$PWD/benchdata.h
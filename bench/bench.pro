@@ -0,0 +1,12 @@
+# Benchmarks of the bootloader code. Console programs, built from the
+# application sources; run each one from a release build.
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    hexdecode \
+    hexparse \
+    crc \
+    escape \
+    framing \
+    window
@@ -0,0 +1,109 @@
+#include "benchdata.h"
+
+// Intel HEX record types written by BuildHexText().
+#define BENCH_DATA_RECORD       0
+#define BENCH_EOF_RECORD        1
+#define BENCH_EXT_LIN_RECORD    4
+
+GBenchRandom::GBenchRandom(unsigned int Seed)
+{
+    this->Seed = Seed;
+}
+
+/****************************************************************************
+ * Next byte of the sequence.
+ *****************************************************************************/
+unsigned char GBenchRandom::Next()
+{
+    Seed = Seed * 1103515245 + 12345;
+
+    return Seed >> 16;
+}
+
+/****************************************************************************
+ * Fills a buffer with the next bytes of the sequence.
+ *
+ * \param  Data: Buffer.
+ * \param  Len: Number of bytes.
+ * \param
+ * \return
+ *****************************************************************************/
+void GBenchRandom::Fill(char *Data, int Len)
+{
+    for(int i = 0; i < Len; i++)
+    {
+        Data[i] = Next();
+    }
+}
+
+/****************************************************************************
+ * Appends a record to hex file text, checksum and CRLF added.
+ *****************************************************************************/
+static void AppendRecord(QByteArray &Text, const unsigned char *Rec, int Len)
+{
+    static const char Digits[] = "0123456789ABCDEF";
+    unsigned char Sum = 0;
+
+    Text.append(':');
+    for(int i = 0; i < Len; i++)
+    {
+        Sum += Rec[i];
+        Text.append(Digits[Rec[i] >> 4]);
+        Text.append(Digits[Rec[i] & 0x0F]);
+    }
+    Sum = -Sum;
+    Text.append(Digits[Sum >> 4]);
+    Text.append(Digits[Sum & 0x0F]);
+    Text.append("\r\n");
+}
+
+/****************************************************************************
+ * Builds a hex file of contiguous data records of random data. An extended
+ * linear address record goes first and wherever the upper 16 bits of the
+ * address change, and the end of file record last.
+ *
+ * \param  Records: Number of data records.
+ * \param  DataLen: Data bytes per record, 1 to 255.
+ * \param  Address: Address of the first record.
+ * \return Hex file text, CRLF line endings.
+ *****************************************************************************/
+QByteArray BuildHexText(int Records, int DataLen, unsigned int Address)
+{
+    GBenchRandom Random;
+    QByteArray Text;
+    unsigned char Rec[4 + 255];
+    bool First = true;
+
+    Text.reserve(Records * (DataLen * 2 + 13) + (Records * DataLen / 0x10000 + 2) * 17);
+
+    for(int r = 0; r < Records; r++)
+    {
+        if(First || ((Address & 0xFFFF) < (unsigned int)DataLen))
+        {
+            Rec[0] = 2;
+            Rec[1] = 0;
+            Rec[2] = 0;
+            Rec[3] = BENCH_EXT_LIN_RECORD;
+            Rec[4] = Address >> 24;
+            Rec[5] = Address >> 16;
+            AppendRecord(Text, Rec, 6);
+            First = false;
+        }
+
+        Rec[0] = DataLen;
+        Rec[1] = Address >> 8;
+        Rec[2] = Address;
+        Rec[3] = BENCH_DATA_RECORD;
+        Random.Fill((char*)Rec + 4, DataLen);
+        AppendRecord(Text, Rec, DataLen + 4);
+        Address += DataLen;
+    }
+
+    Rec[0] = 0;
+    Rec[1] = 0;
+    Rec[2] = 0;
+    Rec[3] = BENCH_EOF_RECORD;
+    AppendRecord(Text, Rec, 4);
+
+    return Text;
+}
@@ -0,0 +1,24 @@
+#ifndef BENCHDATA_H
+#define BENCHDATA_H
+
+#include <QByteArray>
+
+// Test data of the benchmarks, the same on every run.
+
+// Pseudo random bytes, a linear congruential generator.
+class GBenchRandom
+{
+public:
+    //  Constructor
+    explicit GBenchRandom(unsigned int Seed = 12345);
+
+    unsigned char Next(void);
+    void Fill(char *Data, int Len);
+
+private:
+    unsigned int Seed;
+};
+
+QByteArray BuildHexText(int Records, int DataLen, unsigned int Address);
+
+#endif // BENCHDATA_H
@@ -0,0 +1,12 @@
+# GB/s of each CRC16 engine of Utils.
+
+include(../bench.pri)
+
+TARGET = bench_crc
+
+SOURCES += \
+    main.cpp \
+    $$SRC_DIR/utils.cpp
+
+HEADERS += \
+    $$SRC_DIR/utils.h
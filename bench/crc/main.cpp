@@ -0,0 +1,82 @@
+#include <QByteArray>
+#include <QElapsedTimer>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "benchdata.h"
+#include "utils.h"
+
+// Bytes run through the engines on each pass, at least.
+#define BENCH_BYTES (256 * 1024 * 1024)
+
+static const char *EngineNames[Utils::CRC_ENGINE_COUNT] =
+{
+    "NIBBLE",
+    "BYTE",
+    "SLICE4",
+    "SLICE8",
+    "CLMUL"
+};
+
+/****************************************************************************
+ * bench_crc [buffer size in bytes]
+ *
+ * Runs Utils::UpdateCrc() with each engine over a buffer of random data,
+ * 1 MB by default, and checks they all give the same CRC.
+ *****************************************************************************/
+int main(int argc, char *argv[])
+{
+    int Size = (argc > 1) ? atoi(argv[1]) : (1024 * 1024);
+    QByteArray Data;
+    QElapsedTimer Timer;
+    unsigned short Expected = 0;
+    unsigned short crc;
+    int Passes;
+
+    if(Size <= 0)
+    {
+        printf("usage: %s [buffer size in bytes]\n", argv[0]);
+        return 2;
+    }
+
+    Data.resize(Size);
+    GBenchRandom().Fill(Data.data(), Size);
+    Passes = qMax(1, BENCH_BYTES / Size);
+
+    printf("%d byte buffer, %d passes, fastest engine: %s\n", Size, Passes,
+           EngineNames[Utils::FastestCrcEngine()]);
+
+    for(int e = 0; e < Utils::CRC_ENGINE_COUNT; e++)
+    {
+        Utils::T_CRC_ENGINE Engine = static_cast<Utils::T_CRC_ENGINE>(e);
+
+        // The slow engines get fewer passes.
+        int Runs = (Engine == Utils::CRC_ENGINE_NIBBLE) ? qMax(1, Passes / 8) : Passes;
+
+        crc = 0;
+        Timer.start();
+        for(int i = 0; i < Runs; i++)
+        {
+            crc = Utils::UpdateCrc(Engine, crc, Data.constData(), Size);
+        }
+        qint64 Elapsed = qMax(Timer.nsecsElapsed(), (qint64)1);
+
+        // The CRC of one pass, checked against the first engine.
+        crc = Utils::UpdateCrc(Engine, 0, Data.constData(), Size);
+        if(e == 0)
+        {
+            Expected = crc;
+        }
+
+        printf("%-8s %7.2f GB/s  crc %04X%s%s\n", EngineNames[e], (double)Size * Runs / Elapsed, crc,
+               Utils::CrcEngineSupported(Engine) ? "" : "  (not supported, falls back)",
+               (crc == Expected) ? "" : "  MISMATCH");
+        if(crc != Expected)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
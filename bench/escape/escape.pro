@@ -0,0 +1,15 @@
+# MB/s of the DLE escaping: Utils::FindFrameByte(), Utils::EscapeFrame() and
+# GFrameDecoder.
+
+include(../bench.pri)
+
+TARGET = bench_escape
+
+SOURCES += \
+    main.cpp \
+    $$SRC_DIR/gframecodec.cpp \
+    $$SRC_DIR/utils.cpp
+
+HEADERS += \
+    $$SRC_DIR/gframecodec.h \
+    $$SRC_DIR/utils.h
@@ -0,0 +1,261 @@
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QVector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchdata.h"
+#include "gframecodec.h"
+#include "utils.h"
+
+// Bytes run through each case, at least.
+#define BENCH_BYTES (64 * 1024 * 1024)
+// Data bytes per frame in the decoder case.
+#define FRAME_DATA  1000
+
+typedef struct
+{
+    const char *Name;
+    QByteArray Data;
+}T_PAYLOAD_CASE;
+
+/****************************************************************************
+ * Escaping before Utils::EscapeFrame(): one byte at a time.
+ *****************************************************************************/
+static unsigned int EscapeBytes(const char *data, unsigned int len, char *out)
+{
+    unsigned int n = 0;
+
+    for(unsigned int i = 0; i < len; i++)
+    {
+        if((data[i] == SOH) || (data[i] == EOT) || (data[i] == DLE))
+        {
+            out[n++] = DLE;
+        }
+        out[n++] = data[i];
+    }
+
+    return n;
+}
+
+/****************************************************************************
+ * Decoded records of a hex file, the PROGRAM_FLASH payload of the image.
+ *
+ * \param  Path: Hex file.
+ * \param
+ * \param
+ * \return Records back to back, empty if the file cannot be read.
+ *****************************************************************************/
+static QByteArray ReadRecords(const char *Path)
+{
+    QFile File(Path);
+    QByteArray Text;
+    QByteArray Records;
+    const char *Line;
+    const char *End;
+    const char *Eol;
+    unsigned int LineLen;
+    int RecLen;
+    int Len = 0;
+
+    if(!File.open(QIODevice::ReadOnly))
+    {
+        return QByteArray();
+    }
+    Text = File.readAll();
+    Records.resize(Text.size() / 2);
+
+    Line = Text.constData();
+    End = Line + Text.size();
+    while(Line < End)
+    {
+        Eol = (const char*)memchr(Line, '\n', End - Line);
+        if(!Eol)
+        {
+            Eol = End;
+        }
+        LineLen = Eol - Line;
+        while(LineLen && ((Line[LineLen - 1] == '\r') || (Line[LineLen - 1] == ' ')))
+        {
+            LineLen--;
+        }
+        RecLen = LineLen ? Utils::DecodeHexRecord(Line, LineLen, (unsigned char*)Records.data() + Len, Records.size() - Len) : 0;
+        if(RecLen < 0)
+        {
+            return QByteArray();
+        }
+        Len += RecLen;
+        Line = Eol + 1;
+    }
+
+    Records.truncate(Len);
+
+    return Records;
+}
+
+/****************************************************************************
+ * Prints the rate of Bytes handled in Elapsed ns.
+ *****************************************************************************/
+static void Report(const char *What, qint64 Bytes, qint64 Elapsed)
+{
+    printf("  %-22s %9.1f MB/s\n", What, Bytes * 1e3 / qMax(Elapsed, (qint64)1));
+}
+
+/****************************************************************************
+ * Runs one payload through the escaping and the decoder.
+ *
+ * \param  Case: Payload.
+ * \param
+ * \param
+ * \return false if the decoder did not give the payload back.
+ *****************************************************************************/
+static bool RunCase(const T_PAYLOAD_CASE &Case)
+{
+    const char *Data = Case.Data.constData();
+    unsigned int Len = Case.Data.size();
+    int Passes = qMax(1, BENCH_BYTES / (int)Len);
+    QByteArray Escaped(2 * Len, 0);
+    QByteArray Wire;
+    QByteArray Decoded;
+    QByteArray Frame(FRAME_DATA + 16, 0);
+    GFrameDecoder Decoder(FRAME_DATA + 2);
+    QElapsedTimer Timer;
+    unsigned int Found = 0;
+    unsigned int EscapedLen = 0;
+    unsigned int Pos;
+    unsigned int DataLen;
+    unsigned short crc;
+    int Taken;
+    int FrameLen;
+
+    printf("%s: %u bytes, %u control bytes\n", Case.Name, Len, Utils::EscapedLength(Data, Len) - Len);
+
+    Timer.start();
+    for(int p = 0; p < Passes; p++)
+    {
+        for(Pos = 0; Pos < Len; Pos++)
+        {
+            Pos += Utils::FindFrameByte(Data + Pos, Len - Pos);
+            Found += (Pos < Len);
+        }
+    }
+    Report("FindFrameByte", (qint64)Len * Passes, Timer.nsecsElapsed());
+
+    if(Found != (Utils::EscapedLength(Data, Len) - Len) * Passes)
+    {
+        printf("  control bytes found differ\n");
+        return false;
+    }
+
+    Timer.start();
+    for(int p = 0; p < Passes; p++)
+    {
+        EscapedLen = Utils::EscapeFrame(Data, Len, Escaped.data());
+    }
+    Report("EscapeFrame", (qint64)Len * Passes, Timer.nsecsElapsed());
+
+    Timer.start();
+    for(int p = 0; p < Passes; p++)
+    {
+        if(EscapeBytes(Data, Len, Escaped.data()) != EscapedLen)
+        {
+            printf("  escaped lengths differ\n");
+            return false;
+        }
+    }
+    Report("byte at a time", (qint64)Len * Passes, Timer.nsecsElapsed());
+
+    // Frames as sent: SOH, data and CRC escaped, EOT. Then decoded as they
+    // would be received.
+    for(Pos = 0; Pos < Len; Pos += FRAME_DATA)
+    {
+        DataLen = qMin(Len - Pos, (unsigned int)FRAME_DATA);
+        Frame = QByteArray(Data + Pos, DataLen);
+        crc = Utils::CalculateCrc(Frame.data(), DataLen);
+        Frame.append((char)crc);
+        Frame.append((char)(crc >> 8));
+
+        Wire.append((char)SOH);
+        Wire.append(Escaped.data(), Utils::EscapeFrame(Frame.constData(), Frame.size(), Escaped.data()));
+        Wire.append((char)EOT);
+    }
+    Frame.resize(FRAME_DATA + 16);
+
+    Passes = qMax(1, BENCH_BYTES / Wire.size());
+    Timer.start();
+    for(int p = 0; p < Passes; p++)
+    {
+        Decoded.clear();
+        for(Pos = 0; Pos < (unsigned int)Wire.size(); Pos += Taken)
+        {
+            Taken = Decoder.Write(Wire.constData() + Pos, Wire.size() - Pos);
+            while((FrameLen = Decoder.NextFrame(Frame.data(), Frame.size())) >= 0)
+            {
+                Decoded.append(Frame.constData(), FrameLen);
+            }
+        }
+    }
+    Report("GFrameDecoder (wire)", (qint64)Wire.size() * Passes, Timer.nsecsElapsed());
+
+    if((Decoded != Case.Data) || Decoder.DroppedFrames)
+    {
+        printf("  decoded data differs\n");
+        return false;
+    }
+
+    return true;
+}
+
+/****************************************************************************
+ * bench_escape [file.hex]
+ *
+ * Escapes and decodes 1 MB of erased flash, random data and the worst case
+ * (control bytes only), and the records of the hex file if one is given.
+ *****************************************************************************/
+int main(int argc, char *argv[])
+{
+    QVector<T_PAYLOAD_CASE> Cases;
+    T_PAYLOAD_CASE Case;
+    static const char Control[] = { SOH, EOT, DLE };
+
+    Case.Name = "erased (0xFF)";
+    Case.Data = QByteArray(1024 * 1024, (char)0xFF);
+    Cases.append(Case);
+
+    Case.Name = "random";
+    Case.Data.resize(1024 * 1024);
+    GBenchRandom().Fill(Case.Data.data(), Case.Data.size());
+    Cases.append(Case);
+
+    Case.Name = "worst (0x01, 0x04, 0x10)";
+    for(int i = 0; i < Case.Data.size(); i++)
+    {
+        Case.Data[i] = Control[i % 3];
+    }
+    Cases.append(Case);
+
+    if(argc > 1)
+    {
+        Case.Name = argv[1];
+        Case.Data = ReadRecords(argv[1]);
+        if(Case.Data.isEmpty())
+        {
+            printf("cannot read %s\n", argv[1]);
+            return 2;
+        }
+        Cases.append(Case);
+    }
+
+    for(int i = 0; i < Cases.size(); i++)
+    {
+        if(!RunCase(Cases[i]))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,223 @@
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gbootloader.h"
+#include "gframecodec.h"
+#include "ghexmanager.h"
+#include "grecordpacker.h"
+
+// Bytes of frames encoded and decoded per measure, at least.
+#define BENCH_BYTES (32 * 1024 * 1024)
+
+typedef struct
+{
+    unsigned int Frames;
+    unsigned int Data;              // Bytes in the frames, decoded.
+    unsigned int Wire;              // Bytes sent.
+    double EncodeMBs;               // Packed and encoded, MB/s of wire bytes.
+    double DecodeMBs;
+}T_FRAMING_RESULT;
+
+/****************************************************************************
+ * Packs the records into program frames, as GBootLoader sends them.
+ *
+ * \param  Records, Offsets: Records of the image, as GHexManager sends them.
+ * \param  RowSize: Flash row of the device.
+ * \param  Payload: Program data format.
+ * \param  Encoder: Encoder, packet length and framing set.
+ * \param  Wire: Receives the packets, if not NULL.
+ * \param  Result: Frames and wire bytes, added to it.
+ * \return
+ *****************************************************************************/
+static void EncodeImage(const QByteArray &Records, const QVector<unsigned int> &Offsets,
+                        unsigned int RowSize, T_PAYLOAD Payload, GFrameEncoder *Encoder,
+                        QByteArray *Wire, T_FRAMING_RESULT *Result)
+{
+    GRecordPacker Packer(RowSize, Payload);
+    char Cmd = (Payload == PAYLOAD_RUNS) ? PROGRAM_RUNS : PROGRAM_FLASH;
+
+    for(int i = 0;;)
+    {
+        for(; Packer.NeedsRecords() && ((i + 1) < Offsets.size()); i++)
+        {
+            Packer.AddRecord((const unsigned char*)Records.constData() + Offsets[i]);
+        }
+        if(Packer.IsEmpty())
+        {
+            break;
+        }
+
+        Encoder->Begin();
+        Encoder->Append(&Cmd, 1);
+        if(!Packer.Pack(Encoder))
+        {
+            break;
+        }
+        Result->Wire += Encoder->Finish();
+        Result->Frames++;
+        if(Wire)
+        {
+            Wire->append(Encoder->Data(), Encoder->Length());
+        }
+    }
+}
+
+/****************************************************************************
+ * Encodes and decodes an image with one framing and payload.
+ *
+ * \param  Records, Offsets: Records of the image.
+ * \param  RowSize: Flash row of the device.
+ * \param  PacketLen: Longest packet.
+ * \param  Framing, Payload: Link.
+ * \return Frames, bytes and speeds; no frames if the decoder failed.
+ *****************************************************************************/
+static T_FRAMING_RESULT Measure(const QByteArray &Records, const QVector<unsigned int> &Offsets,
+                                unsigned int RowSize, int PacketLen, T_FRAMING Framing, T_PAYLOAD Payload)
+{
+    T_FRAMING_RESULT Result = { 0, 0, 0, 0, 0 };
+    T_FRAMING_RESULT Scratch;
+    GFrameEncoder Encoder(PacketLen, Framing);
+    GFrameDecoder Decoder(PacketLen, Framing);
+    QByteArray Wire;
+    QByteArray Frame(PacketLen, 0);
+    QElapsedTimer Timer;
+    unsigned int Decoded;
+    unsigned int DataLen;
+    int FrameLen;
+    int Passes;
+    int Pos;
+    int Taken;
+
+    EncodeImage(Records, Offsets, RowSize, Payload, &Encoder, &Wire, &Result);
+    if(Result.Wire == 0)
+    {
+        return Result;
+    }
+    Passes = qMax(1, BENCH_BYTES / (int)Result.Wire);
+
+    Timer.start();
+    for(int p = 0; p < Passes; p++)
+    {
+        Scratch = Result;
+        EncodeImage(Records, Offsets, RowSize, Payload, &Encoder, NULL, &Scratch);
+    }
+    Result.EncodeMBs = (double)Result.Wire * Passes * 1e3 / qMax(Timer.nsecsElapsed(), (qint64)1);
+
+    Timer.start();
+    for(int p = 0; p < Passes; p++)
+    {
+        Decoded = 0;
+        DataLen = 0;
+        for(Pos = 0; Pos < Wire.size(); Pos += Taken)
+        {
+            Taken = Decoder.Write(Wire.constData() + Pos, Wire.size() - Pos);
+            while((FrameLen = Decoder.NextFrame(Frame.data(), Frame.size())) >= 0)
+            {
+                Decoded++;
+                DataLen += FrameLen;
+            }
+        }
+        if((Decoded != Result.Frames) || Decoder.DroppedFrames)
+        {
+            Result.Frames = 0;
+            return Result;
+        }
+    }
+    Result.DecodeMBs = (double)Result.Wire * Passes * 1e3 / qMax(Timer.nsecsElapsed(), (qint64)1);
+    Result.Data = DataLen;
+
+    return Result;
+}
+
+/****************************************************************************
+ * bench_framing [-p packet length] [-d device profile] image...
+ *
+ * Sends each image (Intel HEX, ELF, raw binary or S-records) through the
+ * record packer and both framings, with hex records and with runs, and
+ * prints the wire bytes and the encode and decode speeds.
+ *****************************************************************************/
+int main(int argc, char *argv[])
+{
+    static const T_FRAMING Framings[] = { FRAMING_DLE, FRAMING_COBS };
+    static const char *FramingNames[] = { "DLE", "COBS" };
+    static const T_PAYLOAD Payloads[] = { PAYLOAD_HEX_RECORDS, PAYLOAD_RUNS };
+    static const char *PayloadNames[] = { "records", "runs" };
+    GDeviceProfile Profile;
+    QByteArray Records;
+    QVector<unsigned int> Offsets;
+    T_FRAMING_RESULT Result;
+    const char *Rec;
+    unsigned int RecLen;
+    int PacketLen = TX_PACKET_LEN;
+    int Images = 0;
+
+    for(int a = 1; a < argc; a++)
+    {
+        if((QByteArray(argv[a]) == "-p") && ((a + 1) < argc))
+        {
+            PacketLen = qBound(TX_PACKET_LEN, atoi(argv[++a]), TX_PACKET_MAX);
+            continue;
+        }
+        if((QByteArray(argv[a]) == "-d") && ((a + 1) < argc))
+        {
+            Profile = GDeviceProfile(atoi(argv[++a]));
+            continue;
+        }
+
+        GHexManager Manager;
+
+        Manager.BackgroundAnalysis = false;
+        Manager.SetDeviceProfile(Profile);
+        if(!Manager.LoadHexFile(QString(argv[a])))
+        {
+            printf("%s: cannot load\n", argv[a]);
+            return 2;
+        }
+
+        // The records, as programmed.
+        Records.clear();
+        Offsets.clear();
+        Manager.ResetHexFilePointer();
+        while((Rec = Manager.PeekHexRecord(&RecLen)) != NULL)
+        {
+            Offsets.append(Records.size());
+            Records.append(Rec, RecLen);
+            Manager.ConsumeHexRecord();
+        }
+        Offsets.append(Records.size());
+
+        printf("%s: %d records, %d byte packets, row %u\n", argv[a], Offsets.size() - 1, PacketLen, Profile.RowSize);
+        printf("  %-5s %-8s %7s %10s %10s %9s %12s %12s\n", "", "", "frames", "data", "wire", "overhead",
+               "encode MB/s", "decode MB/s");
+
+        for(int p = 0; p < 2; p++)
+        {
+            for(int f = 0; f < 2; f++)
+            {
+                Result = Measure(Records, Offsets, Profile.RowSize, PacketLen, Framings[f], Payloads[p]);
+                if((Result.Frames == 0) && (Result.Wire != 0))
+                {
+                    printf("  %s %s: decoded frames differ\n", FramingNames[f], PayloadNames[p]);
+                    return 1;
+                }
+                printf("  %-5s %-8s %7u %10u %10u %8.2f%% %12.1f %12.1f\n", FramingNames[f], PayloadNames[p],
+                       Result.Frames, Result.Data, Result.Wire,
+                       Result.Data ? 100.0 * (Result.Wire - Result.Data) / Result.Data : 0.0,
+                       Result.EncodeMBs, Result.DecodeMBs);
+            }
+        }
+        Images++;
+    }
+
+    if(Images == 0)
+    {
+        printf("usage: %s [-p packet length] [-d device profile] image...\n", argv[0]);
+        return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,13 @@
+# Records/s of Utils::DecodeHexRecord() against the per line
+# QByteArray::fromHex() decoding it replaced.
+
+include(../bench.pri)
+
+TARGET = bench_hexdecode
+
+SOURCES += \
+    main.cpp \
+    $$SRC_DIR/utils.cpp
+
+HEADERS += \
+    $$SRC_DIR/utils.h
@@ -0,0 +1,189 @@
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchdata.h"
+#include "utils.h"
+
+// Times each decoder is run; the best one counts.
+#define RUNS 5
+
+/****************************************************************************
+ * Decoding before Utils::DecodeHexRecord(): one QByteArray per line.
+ *
+ * \param  Text: Hex file text.
+ * \param  Out: Receives the records.
+ * \param
+ * \return Number of records, -1 on a bad record.
+ *****************************************************************************/
+static int DecodeFromHex(const QByteArray &Text, QByteArray &Out)
+{
+    const char *Line = Text.constData();
+    const char *End = Line + Text.size();
+    const char *Eol;
+    unsigned int LineLen;
+    QByteArray Hex;
+    int Records = 0;
+
+    Out.clear();
+
+    while(Line < End)
+    {
+        Eol = (const char*)memchr(Line, '\n', End - Line);
+        if(!Eol)
+        {
+            Eol = End;
+        }
+        LineLen = Eol - Line;
+        if(LineLen && (Line[LineLen - 1] == '\r'))
+        {
+            LineLen--;
+        }
+
+        if(LineLen)
+        {
+            if(Line[0] != ':')
+            {
+                return -1;
+            }
+            Hex = QByteArray::fromHex(QByteArray::fromRawData(Line + 1, LineLen - 1));
+            if((Hex.size() < 5) || (Hex.size() != ((unsigned char)Hex.at(0) + 5)))
+            {
+                return -1;
+            }
+            Out.append(Hex);
+            Records++;
+        }
+
+        Line = Eol + 1;
+    }
+
+    return Records;
+}
+
+/****************************************************************************
+ * Decoding with Utils::DecodeHexRecord(), in place.
+ *
+ * \param  Text: Hex file text.
+ * \param  Out: Receives the records.
+ * \param
+ * \return Number of records, -1 on a bad record.
+ *****************************************************************************/
+static int DecodeInPlace(const QByteArray &Text, QByteArray &Out)
+{
+    const char *Line = Text.constData();
+    const char *End = Line + Text.size();
+    const char *Eol;
+    unsigned int LineLen;
+    unsigned int OutLen = 0;
+    int RecLen;
+    int Records = 0;
+
+    Out.resize(Text.size() / 2);
+
+    while(Line < End)
+    {
+        Eol = (const char*)memchr(Line, '\n', End - Line);
+        if(!Eol)
+        {
+            Eol = End;
+        }
+        LineLen = Eol - Line;
+        if(LineLen && (Line[LineLen - 1] == '\r'))
+        {
+            LineLen--;
+        }
+
+        if(LineLen)
+        {
+            RecLen = Utils::DecodeHexRecord(Line, LineLen, (unsigned char*)Out.data() + OutLen, Out.size() - OutLen);
+            if(RecLen < 0)
+            {
+                return -1;
+            }
+            OutLen += RecLen;
+            Records++;
+        }
+
+        Line = Eol + 1;
+    }
+
+    Out.truncate(OutLen);
+
+    return Records;
+}
+
+/****************************************************************************
+ * Runs a decoder RUNS times and prints its best rate.
+ *
+ * \param  Name: Printed name.
+ * \param  Decode: Decoder.
+ * \param  Text: Hex file text; Out receives the records.
+ * \return Records decoded, -1 on error.
+ *****************************************************************************/
+static int Measure(const char *Name, int (*Decode)(const QByteArray&, QByteArray&), const QByteArray &Text, QByteArray &Out)
+{
+    QElapsedTimer Timer;
+    qint64 Best = 0;
+    int Records = 0;
+
+    for(int i = 0; i < RUNS; i++)
+    {
+        Timer.start();
+        Records = Decode(Text, Out);
+        qint64 Elapsed = Timer.nsecsElapsed();
+        if(Records < 0)
+        {
+            printf("%-16s error\n", Name);
+            return -1;
+        }
+        if((Best == 0) || (Elapsed < Best))
+        {
+            Best = Elapsed;
+        }
+    }
+
+    printf("%-16s %8.2f M records/s %8.1f MB/s of text\n", Name,
+           Records * 1e3 / Best, Text.size() * 1e3 / Best);
+
+    return Records;
+}
+
+/****************************************************************************
+ * bench_hexdecode [records] [data bytes per record]
+ *****************************************************************************/
+int main(int argc, char *argv[])
+{
+    int Records = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int DataLen = (argc > 2) ? atoi(argv[2]) : 16;
+    QByteArray Text;
+    QByteArray Old;
+    QByteArray New;
+
+    if((Records <= 0) || (DataLen <= 0) || (DataLen > 255))
+    {
+        printf("usage: %s [records] [data bytes per record, 1-255]\n", argv[0]);
+        return 2;
+    }
+
+    Text = BuildHexText(Records, DataLen, 0);
+    printf("%d records of %d data bytes, %d bytes of text\n", Records, DataLen, Text.size());
+
+    if((Measure("fromHex", DecodeFromHex, Text, Old) < 0) ||
+       (Measure("DecodeHexRecord", DecodeInPlace, Text, New) < 0))
+    {
+        return 1;
+    }
+
+    if(Old != New)
+    {
+        printf("decoders disagree\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,28 @@
+# Hex file parse time against GHexManager::ParseThreads.
+
+include(../bench.pri)
+
+QT += gui widgets serialport concurrent
+
+TARGET = bench_hexparse
+
+SOURCES += \
+    main.cpp \
+    $$SRC_DIR/ghexmanager.cpp \
+    $$SRC_DIR/ghexstream.cpp \
+    $$SRC_DIR/gdeviceprofile.cpp \
+    $$SRC_DIR/gflashimage.cpp \
+    $$SRC_DIR/gframecodec.cpp \
+    $$SRC_DIR/gimageloader.cpp \
+    $$SRC_DIR/grecordpacker.cpp \
+    $$SRC_DIR/utils.cpp
+
+HEADERS += \
+    $$SRC_DIR/ghexmanager.h \
+    $$SRC_DIR/ghexstream.h \
+    $$SRC_DIR/gdeviceprofile.h \
+    $$SRC_DIR/gflashimage.h \
+    $$SRC_DIR/gframecodec.h \
+    $$SRC_DIR/gimageloader.h \
+    $$SRC_DIR/grecordpacker.h \
+    $$SRC_DIR/utils.h
@@ -0,0 +1,106 @@
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QThread>
+#include <QVector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "benchdata.h"
+#include "ghexmanager.h"
+
+// Times each thread count is run; the best one counts.
+#define RUNS 5
+
+/****************************************************************************
+ * bench_hexparse [file.hex | data records]
+ *
+ * Parses the file, or a generated one, with 1, 2, 4... threads up to one
+ * per core, and checks every thread count decodes the same records.
+ *****************************************************************************/
+int main(int argc, char *argv[])
+{
+    QVector<T_HEX_SEGMENT> Runs;
+    QVector<T_HEX_SEGMENT> FirstRuns;
+    QByteArray Records;
+    QByteArray FirstRecords;
+    QVector<unsigned int> Offsets;
+    QVector<unsigned int> FirstOffsets;
+    QByteArray Text;
+    QElapsedTimer Timer;
+    qint64 Best;
+    qint64 Single = 0;
+    int Cores = QThread::idealThreadCount();
+    int DataRecords = 1000000;
+
+    if((argc > 1) && (atoi(argv[1]) > 0))
+    {
+        DataRecords = atoi(argv[1]);
+    }
+    else if(argc > 1)
+    {
+        QFile File(argv[1]);
+        if(!File.open(QIODevice::ReadOnly))
+        {
+            printf("cannot read %s\n", argv[1]);
+            return 2;
+        }
+        Text = File.readAll();
+    }
+
+    if(Text.isEmpty())
+    {
+        Text = BuildHexText(DataRecords, 16, 0x1D000000);
+    }
+    printf("%d bytes of hex text, %d cores\n", Text.size(), Cores);
+
+    for(int Threads = 1; ; Threads *= 2)
+    {
+        Threads = qMin(Threads, qMax(Cores, 1));
+
+        Best = 0;
+        for(int i = 0; i < RUNS; i++)
+        {
+            Runs.clear();
+            Timer.start();
+            if(!GHexManager::ParseHexText(Text, Threads, &Records, &Offsets, &Runs))
+            {
+                printf("not a valid hex file\n");
+                return 1;
+            }
+            qint64 Elapsed = Timer.nsecsElapsed();
+            if((Best == 0) || (Elapsed < Best))
+            {
+                Best = Elapsed;
+            }
+        }
+
+        if(Threads == 1)
+        {
+            Single = Best;
+            FirstRecords = Records;
+            FirstOffsets = Offsets;
+            FirstRuns = Runs;
+        }
+        else if((Records != FirstRecords) ||
+                (Offsets != FirstOffsets) ||
+                (Runs.size() != FirstRuns.size()) ||
+                memcmp(Runs.constData(), FirstRuns.constData(), Runs.size() * sizeof(T_HEX_SEGMENT)))
+        {
+            printf("%d threads: records differ from 1 thread\n", Threads);
+            return 1;
+        }
+
+        printf("%3d threads %8.2f ms %8.1f MB/s  x%.2f\n", Threads, Best / 1e6,
+               Text.size() * 1e3 / Best, (double)Single / Best);
+
+        if(Threads >= Cores)
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QVector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gbootloader.h"
+
+// Retry delay of the program frames, as the application sends them.
+#define PROGRAM_RETRY_DELAY 500
+// Longest wait for an answer, in ms.
+#define STEP_TIMEOUT        600000
+
+// Answer of the last command sent.
+typedef struct
+{
+    bool Done;
+    bool Failed;
+    unsigned char Cmd;
+    unsigned short Crc;
+}T_STEP_STATE;
+
+/****************************************************************************
+ * Sends a command and runs the boot loader every ms, as the timer of the
+ * application does, until it is answered.
+ *
+ * \param  Boot: Boot loader, on the simulator.
+ * \param  State: Receives the answer.
+ * \param  Cmd, DelayInMs: Command and retry delay.
+ * \return false if the command failed or was not answered.
+ *****************************************************************************/
+static bool RunStep(GBootLoader &Boot, T_STEP_STATE &State, char Cmd, unsigned short DelayInMs)
+{
+    QElapsedTimer Clock;
+    qint64 Ahead;
+
+    State.Done = false;
+    State.Failed = false;
+    Boot.SendCommand(Cmd, 3, DelayInMs);
+
+    Clock.start();
+    for(qint64 Tick = 1; !State.Done; Tick++)
+    {
+        Boot.RxTxThread();
+        if(Tick > STEP_TIMEOUT)
+        {
+            return false;
+        }
+        Ahead = Tick * 1000 - Clock.nsecsElapsed() / 1000;
+        if(Ahead > 0)
+        {
+            QThread::usleep(Ahead);
+        }
+    }
+
+    return !State.Failed && (State.Cmd == Cmd);
+}
+
+/****************************************************************************
+ * Connects to the simulator, erases, programs the image and checks the CRC
+ * of the flash.
+ *
+ * \param  Path, Profile: Image and device profile.
+ * \param  Baud, Latency, Window: Line speed, flash write latency in ms and
+ *                                program frames in flight.
+ * \return false if a step failed or the CRC differs.
+ *****************************************************************************/
+static bool RunImage(const char *Path, int Profile, qint32 Baud, unsigned int Latency, int Window)
+{
+    GBootLoader Boot;
+    T_STEP_STATE State;
+    QElapsedTimer Timer;
+    T_TX_STATS Stats;
+    qint64 Elapsed;
+    bool Programmed;
+    bool Verified;
+
+    QObject::connect(&Boot, &GBootLoader::PostMessage, [&State](unsigned char Cmd, char *Data) {
+        State.Done = true;
+        State.Cmd = Cmd;
+        if(Cmd == READ_CRC)
+        {
+            State.Crc = (unsigned char)Data[0] | ((unsigned char)Data[1] << 8);
+        }
+    });
+    QObject::connect(&Boot, &GBootLoader::PostErrorMessage, [&State](unsigned char Cmd, char *) {
+        State.Done = true;
+        State.Failed = true;
+        State.Cmd = Cmd;
+    });
+
+    Boot.PreferredWindow = Window;
+    Boot.SetSimulatorLatency(Latency);
+    if(!Boot.SetDeviceProfile(Profile) || !Boot.LoadHexFile(QString(Path)))
+    {
+        printf("%s: cannot load\n", Path);
+        return false;
+    }
+    Boot.OpenPort(SIM, QString(), Baud, 0, 0, 0, 0);
+
+    if(!RunStep(Boot, State, READ_BOOT_INFO, 1000) || !RunStep(Boot, State, ERASE_FLASH, 5000))
+    {
+        printf("%8d %4u ms %3d: no connection\n", Baud, Latency, Window);
+        return false;
+    }
+
+    Timer.start();
+    Programmed = RunStep(Boot, State, PROGRAM_FLASH, PROGRAM_RETRY_DELAY);
+    Elapsed = Timer.elapsed();
+    Stats = Boot.GetTxStats();
+
+    Verified = Programmed && RunStep(Boot, State, READ_CRC, 5000) && (State.Crc == Boot.CalculateFlashCRC());
+    Boot.ClosePort(SIM);
+
+    printf("%8d %4u ms %3d %9lld ms %6u %8u  %s\n", Baud, Latency, Window, Elapsed,
+           Stats.Nacks, Stats.TimeoutsAvoided, !Programmed ? "program failed" : (Verified ? "crc ok" : "crc BAD"));
+
+    return Verified;
+}
+
+/****************************************************************************
+ * bench_window image [device profile] [baud] [latency ms] [window]
+ *
+ * Programs the image on the simulator for each line speed, flash write
+ * latency and send window, or only the ones given, and prints the time
+ * taken. Every run is verified with the CRC of the flash.
+ *****************************************************************************/
+int main(int argc, char *argv[])
+{
+    QCoreApplication App(argc, argv);
+    QVector<qint32> Bauds;
+    QVector<unsigned int> Latencies;
+    QVector<int> Windows;
+    int Profile = (argc > 2) ? atoi(argv[2]) : 0;
+    bool Ok = true;
+
+    if(argc < 2)
+    {
+        printf("usage: %s image [device profile] [baud] [latency ms] [window]\n", argv[0]);
+        return 2;
+    }
+
+    if(argc > 3)
+    {
+        Bauds.append(atoi(argv[3]));
+    }
+    else
+    {
+        Bauds << 115200 << 921600;
+    }
+    if(argc > 4)
+    {
+        Latencies.append(atoi(argv[4]));
+    }
+    else
+    {
+        Latencies << 0 << 5 << 20;
+    }
+    if(argc > 5)
+    {
+        Windows.append(atoi(argv[5]));
+    }
+    else
+    {
+        Windows << 1 << 4 << 8;
+    }
+
+    printf("%s, profile %d, retry delay %d ms\n", argv[1], Profile, PROGRAM_RETRY_DELAY);
+    printf("%8s %7s %3s %12s %6s %8s\n", "baud", "latency", "win", "program", "nacks", "avoided");
+
+    for(int b = 0; b < Bauds.size(); b++)
+    {
+        for(int l = 0; l < Latencies.size(); l++)
+        {
+            for(int w = 0; w < Windows.size(); w++)
+            {
+                Ok &= RunImage(argv[1], Profile, Bauds[b], Latencies[l], Windows[w]);
+            }
+        }
+    }
+
+    return Ok ? 0 : 1;
+}
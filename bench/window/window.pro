@@ -0,0 +1,35 @@
+# Programming time of an image on the simulator, by line speed, flash write
+# latency and send window.
+
+include(../bench.pri)
+
+QT += gui widgets serialport concurrent
+
+TARGET = bench_window
+
+SOURCES += \
+    main.cpp \
+    $$SRC_DIR/gbootloader.cpp \
+    $$SRC_DIR/gbootsimulator.cpp \
+    $$SRC_DIR/ghexmanager.cpp \
+    $$SRC_DIR/ghexstream.cpp \
+    $$SRC_DIR/gdeviceprofile.cpp \
+    $$SRC_DIR/gflashimage.cpp \
+    $$SRC_DIR/gframecodec.cpp \
+    $$SRC_DIR/gimageloader.cpp \
+    $$SRC_DIR/grecordpacker.cpp \
+    $$SRC_DIR/gsendwindow.cpp \
+    $$SRC_DIR/utils.cpp
+
+HEADERS += \
+    $$SRC_DIR/gbootloader.h \
+    $$SRC_DIR/gbootsimulator.h \
+    $$SRC_DIR/ghexmanager.h \
+    $$SRC_DIR/ghexstream.h \
+    $$SRC_DIR/gdeviceprofile.h \
+    $$SRC_DIR/gflashimage.h \
+    $$SRC_DIR/gframecodec.h \
+    $$SRC_DIR/gimageloader.h \
+    $$SRC_DIR/grecordpacker.h \
+    $$SRC_DIR/gsendwindow.h \
+    $$SRC_DIR/utils.h
@@ -2,45 +2,83 @@
 
 #include <QDebug>
 
-#include "utils.h"
+#include <string.h>
 
-#define SOH 01
-#define EOT 04
-#define DLE 16
+#include "gbootsimulator.h"
+#include "utils.h"
 
 static GBootLoader *lpParam;
 
 static uint64_t tickCount;
 
 GBootLoader::GBootLoader(QObject *parent)
-    : QObject(parent)
+    : QObject(parent), TxEncoder(TX_PACKET_LEN), RxDecoder(sizeof(RxData) + 2)
 {
     // Initialization of some flags and variables
-    RxFrameValid = false;
     NoResponseFromDevice = false;
     TxState = FIRST_TRY;
     RxDataLen = 0;
     ResetHexFilePtr = true;
+    BaudRate = 0;
+    DigestAlgorithm = DIGEST_CRC32;
+    PreferredFraming = FRAMING_COBS;
+    PreferredPayload = PAYLOAD_RUNS;
+    PreferredWindow = WINDOW_MAX;
+    PreferredOptions = BOOT_OPT_NACK;
+    Payload = PAYLOAD_HEX_RECORDS;
+    WindowSize = 1;
+    Windowed = false;
+    LinkCaps = 0;
+    RetryNow = false;
+    NackRetries = 0;
+    TxStats.Nacks = 0;
+    TxStats.TimeoutsAvoided = 0;
+    PortType = COM;
+    Simulator = nullptr;
+    SimulatorLatency = 0;
 
     lpParam = this;
     timer.setInterval(1);
     connect(&timer, SIGNAL(timeout()), this, SLOT(RxTxThread()));
+    connect(&HexManager, SIGNAL(HexFileReloaded(bool,QVector<unsigned int>,unsigned int)),
+            this, SIGNAL(HexFileReloaded(bool,QVector<unsigned int>,unsigned int)));
+    connect(&HexManager, SIGNAL(ImageAnalysisReady(unsigned int,unsigned int)),
+            this, SIGNAL(ImageAnalysisReady(unsigned int,unsigned int)));
 
     ComPort = new QSerialPort();
 }
 
-GBootLoader::~GBootLoader() {}
+GBootLoader::~GBootLoader()
+{
+    delete Simulator;
+}
 
 void GBootLoader::TransmitTask()
 {
     static uint64_t NextRetryTimeInMs;
+    const QByteArray *Packet;
+
+    if (Windowed) {
+        // Program frames in flight, each one with its own retries.
+        while ((Packet = TxWindow.NextToSend(tickCount)) != NULL) {
+            WritePort(Packet->constData(), Packet->size());
+        }
+        if (TxWindow.Expired(tickCount)) {
+            // Retries Exceeded
+            Windowed = false;
+            NoResponseFromDevice = true;
+        }
+        return;
+    }
 
     switch (TxState) {
     case FIRST_TRY:
         if (RetryCount) {
             // There is something to send.
-            WritePort(TxPacket, TxPacketLen);
+            WritePort(TxEncoder.Data(), TxEncoder.Length());
             RetryCount--;
+            RetryNow = false;
+            NackRetries = 0;
             // If there is no response to "first try", the command will be retried.
             TxState = RE_TRY;
             // Next retry should be attempted only after a delay.
@@ -50,12 +88,18 @@ void GBootLoader::TransmitTask()
 
     case RE_TRY:
         if (RetryCount) {
-            if (NextRetryTimeInMs < tickCount) {
-                // Delay elapsed. Its time to retry.
+            if (RetryNow || (NextRetryTimeInMs < tickCount)) {
+                // Delay elapsed, or the device refused the frame. Its time
+                // to retry.
                 NextRetryTimeInMs = tickCount + TxRetryDelay;
-                WritePort(TxPacket, TxPacketLen);
-                // Decrement retry count.
-                RetryCount--;
+                WritePort(TxEncoder.Data(), TxEncoder.Length());
+                if (RetryNow) {
+                    // On top of the retries, a NACK may be late.
+                    RetryNow = false;
+                } else {
+                    // Decrement retry count.
+                    RetryCount--;
+                }
             }
         } else {
             // Retries Exceeded
@@ -77,24 +121,44 @@ void GBootLoader::TransmitTask()
  *****************************************************************************/
 void GBootLoader::ReceiveTask()
 {
-    unsigned short BuffLen;
-    char Buff[255];
+    char *Buff;
+    int Space;
+    qint64 BuffLen;
+    int FrameLen;
+    bool FrameReceived = false;
+
+    // Read straight into the ring buffer of the decoder, twice if it wraps.
+    Buff = RxDecoder.WriteBuffer(&Space);
+    while ((Space > 0) && ((BuffLen = ReadPort(Buff, Space)) > 0)) {
+        RxDecoder.Written(BuffLen);
+        if (BuffLen < Space) {
+            break;
+        }
+        Buff = RxDecoder.WriteBuffer(&Space);
+    }
 
-    BuffLen = ReadPort((char *) Buff, (sizeof(Buff) - 10));
-    BuildRxFrame((unsigned char *) Buff, BuffLen);
-    if (RxFrameValid) {
+    // Every frame of the read is handled. A frame still incomplete is
+    // finished by the next read.
+    while ((FrameLen = RxDecoder.NextFrame(RxData, sizeof(RxData))) > 0) {
+        RxDataLen = FrameLen;
+        FrameReceived = true;
+        if (static_cast<unsigned char>(RxData[0]) == NACK) {
+            // Not an answer, the retries go on.
+            HandleNack();
+            continue;
+        }
         // Valid frame is received.
         // Disable further retries.
         StopTxRetries();
-        RxFrameValid = false;
         // Handle Response
         HandleResponse();
-    } else {
+    }
+
+    if (!FrameReceived) {
         // Retries exceeded. There is no reponse from the device.
         if (NoResponseFromDevice) {
             // Reset flags
             NoResponseFromDevice = false;
-            RxFrameValid = false;
             // Handle no response situation.
             HandleNoResponse();
         }
@@ -116,11 +180,11 @@ bool GBootLoader::SendCommand(char cmd, unsigned short Retries, unsigned short D
     unsigned short crc;
 
     unsigned int StartAddress, Len;
-    char Buff[1000];
+    char Buff[3 + (DIGEST_MAX_RANGES * 8)];
     unsigned short BuffLen = 0;
-    unsigned short HexRecLen;
-    unsigned int totalRecords = 10;
-    TxPacketLen = 0;
+    const char *HexRec;
+    unsigned int HexRecLen;
+    TxEncoder.Begin();
 
     // Store for later use.
     LastSentCommand = static_cast<T_COMMANDS>(cmd);
@@ -148,18 +212,40 @@ bool GBootLoader::SendCommand(char cmd, unsigned short Retries, unsigned short D
                 // Error in resetting the file pointer
                 return false;
             }
+            RecordPacker.Reset(HexManager.GetDeviceProfile().RowSize, Payload);
+            TxStats.Nacks = 0;
+            TxStats.TimeoutsAvoided = 0;
+        }
+        if (RecordPacker.GetPayload() == PAYLOAD_RUNS) {
+            // Same operation, the data goes as runs.
+            Buff[0] = PROGRAM_RUNS;
+        }
+        // Enough records to fill the frame.
+        while (RecordPacker.NeedsRecords() && ((HexRec = HexManager.PeekHexRecord(&HexRecLen)) != NULL)) {
+            RecordPacker.AddRecord(reinterpret_cast<const unsigned char *>(HexRec));
+            HexManager.ConsumeHexRecord();
+        }
+        if (ResetHexFilePtr && (WindowSize > 1) && !RecordPacker.IsEmpty()) {
+            // The device takes frames in flight: the window sends them and
+            // the answers fill it.
+            StopTxRetries();
+            MaxRetry = Retries;
+            TxRetryDelay = DelayInMs; // in ms
+            TxWindow.Reset(WindowSize, Retries, DelayInMs);
+            Windowed = FillWindow();
+            return Windowed;
         }
-        HexRecLen = HexManager.GetNextHexRecord(&Buff[BuffLen], (sizeof(Buff) - 5));
-        if (HexRecLen == 0) {
-            //Not a valid hex file.
+        if (RecordPacker.IsEmpty() && !ResetHexFilePtr) {
+            // No more data.
             return false;
         }
 
-        BuffLen = BuffLen + HexRecLen;
-        while (totalRecords) {
-            HexRecLen = HexManager.GetNextHexRecord(&Buff[BuffLen], (sizeof(Buff) - 5));
-            BuffLen = BuffLen + HexRecLen;
-            totalRecords--;
+        // Contiguous data as long records, filling the packet up to a row.
+        // An image with nothing to write still gets a frame, without data.
+        TxEncoder.Append(Buff, BuffLen);
+        BuffLen = 0;
+        if (!RecordPacker.IsEmpty() && !RecordPacker.Pack(&TxEncoder)) {
+            return false;
         }
         MaxRetry = RetryCount = Retries;
         TxRetryDelay = DelayInMs; // in ms
@@ -182,100 +268,49 @@ bool GBootLoader::SendCommand(char cmd, unsigned short Retries, unsigned short D
         MaxRetry = RetryCount = Retries;
         TxRetryDelay = DelayInMs; // in ms
         break;
+    case SET_FRAMING:
+        Buff[BuffLen++] = cmd;
+        Buff[BuffLen++] = static_cast<char>(PreferredFraming);
+        MaxRetry = RetryCount = Retries;
+        TxRetryDelay = DelayInMs; // in ms
+        break;
+    case SET_OPTIONS:
+        Buff[BuffLen++] = cmd;
+        Buff[BuffLen++] = static_cast<char>(PreferredOptions);
+        MaxRetry = RetryCount = Retries;
+        TxRetryDelay = DelayInMs; // in ms
+        break;
+    case READ_DIGEST:
+        Buff[BuffLen++] = cmd;
+        Buff[BuffLen++] = static_cast<char>(DigestAlgorithm);
+        Buff[BuffLen++] = static_cast<char>(DigestRanges.size());
+        for (int i = 0; i < DigestRanges.size(); i++) {
+            Buff[BuffLen++] = (DigestRanges[i].Begin);
+            Buff[BuffLen++] = (DigestRanges[i].Begin >> 8);
+            Buff[BuffLen++] = (DigestRanges[i].Begin >> 16);
+            Buff[BuffLen++] = (DigestRanges[i].Begin >> 24);
+            Buff[BuffLen++] = (DigestRanges[i].End);
+            Buff[BuffLen++] = (DigestRanges[i].End >> 8);
+            Buff[BuffLen++] = (DigestRanges[i].End >> 16);
+            Buff[BuffLen++] = (DigestRanges[i].End >> 24);
+        }
+        MaxRetry = RetryCount = Retries;
+        TxRetryDelay = DelayInMs; // in ms
+        break;
     default:
         return false;
     }
 
-    // Calculate CRC for the frame.
-    crc = Utils::CalculateCrc(Buff, BuffLen);
-    Buff[BuffLen++] = static_cast<char>(crc);
-    Buff[BuffLen++] = static_cast<char>(crc >> 8);
-
-    // SOH: Start of header
-    TxPacket[TxPacketLen++] = SOH;
-
-    // Form TxPacket. Insert DLE in the data field whereever SOH and EOT are present.
-    for (int i = 0; i < BuffLen; i++) {
-        if ((Buff[i] == EOT) || (Buff[i] == SOH) || (Buff[i] == DLE)) {
-            TxPacket[TxPacketLen++] = DLE;
-        }
-        TxPacket[TxPacketLen++] = Buff[i];
+    // Form TxPacket. The encoder inserts DLE wherever SOH, EOT and DLE are
+    // present, and adds the CRC and EOT.
+    if (!TxEncoder.Append(Buff, BuffLen)) {
+        return false;
     }
-
-    // EOT: End of transmission
-    TxPacket[TxPacketLen++] = EOT;
+    TxEncoder.Finish();
 
     return true;
 }
 
-void GBootLoader::BuildRxFrame(unsigned char *buff, unsigned short buffLen)
-{
-    static bool Escape = false;
-    unsigned short crc;
-
-    while ((buffLen > 0) && (RxFrameValid == false)) {
-        buffLen--;
-
-        if (RxDataLen >= (sizeof(RxData) - 2)) {
-            RxDataLen = 0;
-        }
-
-        switch (*buff) {
-        case SOH: //Start of header
-            if (Escape) {
-                // Received byte is not SOH, but data.
-                RxData[RxDataLen++] = static_cast<char>(*buff);
-                // Reset Escape Flag.
-                Escape = false;
-            } else {
-                // Received byte is indeed a SOH which indicates start of new frame.
-                RxDataLen = 0;
-            }
-            break;
-
-        case EOT: // End of transmission
-            if (Escape) {
-                // Received byte is not EOT, but data.
-                RxData[RxDataLen++] = static_cast<char>(*buff);
-                // Reset Escape Flag.
-                Escape = false;
-            } else {
-                // Received byte is indeed a EOT which indicates end of frame.
-                // Calculate CRC to check the validity of the frame.
-                if (RxDataLen > 1) {
-                    crc = (RxData[RxDataLen - 2]) & 0x00ff;
-                    crc = crc | ((RxData[RxDataLen - 1] << 8) & 0xFF00);
-                    if ((Utils::CalculateCrc(RxData, (RxDataLen - 2)) == crc) && (RxDataLen > 2)) {
-                        // CRC matches and frame received is valid.
-                        RxFrameValid = true;
-                    }
-                }
-            }
-            break;
-
-        case DLE: // Escape character received.
-            if (Escape) {
-                // Received byte is not ESC but data.
-                RxData[RxDataLen++] = static_cast<char>(*buff);
-                // Reset Escape Flag.
-                Escape = false;
-            } else {
-                // Received byte is an escape character. Set Escape flag to escape next byte.
-                Escape = true;
-            }
-            break;
-
-        default: // Data field.
-            RxData[RxDataLen++] = static_cast<char>(*buff);
-            // Reset Escape Flag.
-            Escape = false;
-            break;
-        }
-        // Increment the pointer.
-        buff++;
-    }
-}
-
 /****************************************************************************
  *  Handle Response situation
  *
@@ -289,29 +324,234 @@ void GBootLoader::HandleResponse()
     unsigned char cmd = static_cast<unsigned char>(RxData[0]);
     char majorVer = RxData[3];
     char minorVer = RxData[4];
+    int PacketLen;
+    int WindowAt;
     QString string;
+    unsigned int Received;
 
     switch (cmd) {
     case READ_BOOT_INFO:
+        // Devices that take longer packets say how long, every device takes
+        // TX_PACKET_LEN.
+        if ((RxDataLen > 5) && (RxData[3] & BOOT_CAP_PACKET_LEN)) {
+            PacketLen = static_cast<unsigned char>(RxData[4]) | (static_cast<unsigned char>(RxData[5]) << 8);
+            TxEncoder.SetSize(qBound(TX_PACKET_LEN, PacketLen, TX_PACKET_MAX));
+        }
+        // Program data as runs, where the device takes them.
+        Payload = ((RxDataLen > 3) && (RxData[3] & BOOT_CAP_RUNS) && (PreferredPayload == PAYLOAD_RUNS))
+                  ? PAYLOAD_RUNS : PAYLOAD_HEX_RECORDS;
+        // Program frames in flight, as many as both sides take. The count
+        // follows the packet length, if there is one.
+        WindowAt = (RxData[3] & BOOT_CAP_PACKET_LEN) ? 6 : 4;
+        WindowSize = ((RxDataLen > WindowAt) && (RxData[3] & BOOT_CAP_WINDOW))
+                     ? qBound(1, qMin(PreferredWindow, static_cast<int>(static_cast<unsigned char>(RxData[WindowAt]))), WINDOW_MAX)
+                     : 1;
+        // Settings the device takes (COBS frames, NACKs) are asked for
+        // before reporting the connection, so that no other command is sent
+        // while the link changes.
+        LinkCaps = (RxDataLen > 3) ? RxData[3] : 0;
+        memcpy(BootInfo, &RxData[1], sizeof(BootInfo));
+        if (!NegotiateLink()) {
+            emit PostMessage(cmd, BootInfo);
+        }
+        break;
+
+    case SET_FRAMING:
+        // The device answers in the old framing and switches after it.
+        if ((RxData[1] == FRAMING_DLE) || (RxData[1] == FRAMING_COBS)) {
+            TxEncoder.SetFraming(static_cast<T_FRAMING>(RxData[1]));
+            RxDecoder.SetFraming(static_cast<T_FRAMING>(RxData[1]));
+        }
+        if (!NegotiateLink()) {
+            emit PostMessage(READ_BOOT_INFO, BootInfo);
+        }
+        break;
+
+    case SET_OPTIONS:
+        // NACKs, if taken, just start arriving.
+        if (!NegotiateLink()) {
+            emit PostMessage(READ_BOOT_INFO, BootInfo);
+        }
+        break;
+
     case ERASE_FLASH:
     case READ_CRC:
+    case READ_DIGEST:
         // Notify main window that command received successfully.
         emit PostMessage(cmd, &RxData[1]);
         //        ::PostMessage(m_hWnd, WM_USER_BOOTLOADER_RESP_OK, (WPARAM)cmd, (LPARAM)&RxData[1] );
         break;
 
     case PROGRAM_FLASH:
+    case PROGRAM_RUNS:
 
         // If there is a hex record, send next hex record.
         ResetHexFilePtr = false; // No need to reset hex file pointer.
         if (!SendCommand(PROGRAM_FLASH, MaxRetry, TxRetryDelay)) {
             // Notify main window that programming operation completed.
-            emit PostMessage(cmd, &RxData[1]);
+            emit PostMessage(PROGRAM_FLASH, &RxData[1]);
             //            ::PostMessage(m_hWnd, WM_USER_BOOTLOADER_RESP_OK, (WPARAM)cmd, (LPARAM)&RxData[1] );
         }
         ResetHexFilePtr = true;
         break;
+
+    case PROGRAM_SEQ:
+        if (!Windowed || (RxDataLen < 4)) {
+            // Late answer to a pass given up.
+            break;
+        }
+        Received = static_cast<unsigned char>(RxData[2]) | (static_cast<unsigned char>(RxData[3]) << 8);
+        TxWindow.Acknowledge(static_cast<unsigned char>(RxData[1]), Received);
+        if (!FillWindow()) {
+            Windowed = false;
+            emit PostErrorMessage(PROGRAM_FLASH, nullptr);
+        } else if (TxWindow.IsEmpty()) {
+            // Every frame programmed, and no more data.
+            Windowed = false;
+            emit PostMessage(PROGRAM_FLASH, &RxData[1]);
+        }
+        break;
+    }
+}
+
+/****************************************************************************
+ *  Tells the hex manager the link set up with the device, so that the image
+ *  analysis counts the frames as they go on it.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GBootLoader::UpdateLinkFormat()
+{
+    T_LINK_FORMAT Link;
+
+    Link.Framing = TxEncoder.GetFraming();
+    Link.PacketLen = TxEncoder.GetSize();
+    Link.Payload = Payload;
+    Link.Sequenced = (WindowSize > 1);
+    HexManager.SetLinkFormat(Link);
+}
+
+/****************************************************************************
+ *  Asks for the next link setting the device takes, after READ_BOOT_INFO
+ *
+ * \param
+ * \param
+ * \param
+ * \return false if there is nothing left to ask for
+ *****************************************************************************/
+bool GBootLoader::NegotiateLink()
+{
+    if ((LinkCaps & BOOT_CAP_COBS) && (PreferredFraming == FRAMING_COBS)
+            && (TxEncoder.GetFraming() != FRAMING_COBS)) {
+        LinkCaps &= ~BOOT_CAP_COBS;
+        return SendCommand(SET_FRAMING, MaxRetry, TxRetryDelay);
+    }
+    if ((LinkCaps & BOOT_CAP_NACK) && (PreferredOptions & BOOT_OPT_NACK)) {
+        LinkCaps &= ~BOOT_CAP_NACK;
+        return SendCommand(SET_OPTIONS, MaxRetry, TxRetryDelay);
+    }
+
+    // Done. The image analysis counts the frames as they go on this link.
+    UpdateLinkFormat();
+
+    return false;
+}
+
+/****************************************************************************
+ *  Handles a NACK: the frame refused is sent again at once, instead of
+    after the retry delay
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GBootLoader::HandleNack()
+{
+    unsigned char Next;
+    unsigned char Refused;
+    bool Avoided = false;
+
+    if (RxDataLen < 4) {
+        return;
+    }
+    Next = static_cast<unsigned char>(RxData[2]);
+    Refused = static_cast<unsigned char>(RxData[3]);
+    TxStats.Nacks++;
+
+    if (Windowed) {
+        switch (RxData[1]) {
+        case NACK_SEQUENCE:
+            // The frame expected went before the one held, and was lost.
+            TxWindow.Hold(Refused);
+            Avoided = TxWindow.SentBefore(Next, Refused) && TxWindow.Resend(Next, tickCount);
+            break;
+        case NACK_BUSY:
+            TxWindow.DropHeld(Refused);
+            Avoided = TxWindow.Resend(Refused, tickCount);
+            break;
+        case NACK_BAD_CRC:
+        default:
+            // The frame cannot be told, the device waits for the next one.
+            Avoided = TxWindow.Resend(Next, tickCount);
+            break;
+        }
+    } else if ((RxData[1] == NACK_BAD_CRC) && (TxState == RE_TRY) && RetryCount && (NackRetries < MaxRetry)) {
+        // Only one frame in flight. The other reasons are about PROGRAM_SEQ
+        // frames, late ones from a pass given up.
+        NackRetries++;
+        RetryNow = Avoided = true;
+    }
+
+    if (Avoided) {
+        TxStats.TimeoutsAvoided++;
+    }
+}
+
+/****************************************************************************
+ *  Builds PROGRAM_SEQ frames into the send window, until it is full or
+    there is no more data
+ *
+ * \param
+ * \param
+ * \param
+ * \return false if a frame could not be built
+ *****************************************************************************/
+bool GBootLoader::FillWindow()
+{
+    char Header[3];
+    const char *HexRec;
+    unsigned int HexRecLen;
+
+    while (!TxWindow.IsFull()) {
+        while (RecordPacker.NeedsRecords() && ((HexRec = HexManager.PeekHexRecord(&HexRecLen)) != NULL)) {
+            RecordPacker.AddRecord(reinterpret_cast<const unsigned char *>(HexRec));
+            HexManager.ConsumeHexRecord();
+        }
+        if (RecordPacker.IsEmpty()) {
+            break;
+        }
+
+        Header[0] = PROGRAM_SEQ;
+        Header[1] = static_cast<char>(TxWindow.NextSequence());
+        Header[2] = (RecordPacker.GetPayload() == PAYLOAD_RUNS) ? PROGRAM_RUNS : PROGRAM_FLASH;
+        if (TxWindow.IsFirst()) {
+            Header[2] |= PROGRAM_SEQ_START;
+        }
+
+        TxEncoder.Begin();
+        TxEncoder.Append(Header, sizeof(Header));
+        if (!RecordPacker.Pack(&TxEncoder)) {
+            return false;
+        }
+        TxEncoder.Finish();
+        TxWindow.Push(TxEncoder.Data(), TxEncoder.Length(), HexManager.HexCurrLineNo);
     }
+
+    return true;
 }
 
 /****************************************************************************
@@ -327,6 +567,7 @@ void GBootLoader::StopTxRetries()
     // Reset state.
     TxState = FIRST_TRY;
     RetryCount = 0;
+    RetryNow = false;
 }
 
 /****************************************************************************
@@ -344,15 +585,22 @@ void GBootLoader::GetProgress(int *Lower, int *Upper)
     case READ_BOOT_INFO:
     case ERASE_FLASH:
     case READ_CRC:
+    case READ_DIGEST:
+    case SET_FRAMING:
+    case SET_OPTIONS:
     case JMP_TO_APP:
+    case NACK:
         // Progress with respect to retry count.
         *Lower = (MaxRetry - RetryCount);
         *Upper = MaxRetry;
         break;
 
     case PROGRAM_FLASH:
-        // Progress with respect to line counts in hex file.
-        *Lower = HexManager.HexCurrLineNo;
+    case PROGRAM_RUNS:
+    case PROGRAM_SEQ:
+        // Progress with respect to line counts in hex file. Frames in
+        // flight are read ahead, count those programmed.
+        *Lower = Windowed ? TxWindow.RecordsReleased : HexManager.HexCurrLineNo;
         *Upper = HexManager.HexTotalLines;
         break;
     }
@@ -375,13 +623,42 @@ void GBootLoader::HandleNoResponse()
     case PROGRAM_FLASH:
     case JMP_TO_APP:
     case READ_CRC:
+    case READ_DIGEST:
         // Notify main window that there was no reponse.
         emit PostErrorMessage(LastSentCommand, nullptr);
         //        ::PostMessage(m_hWnd, WM_USER_BOOTLOADER_NO_RESP, (WPARAM)LastSentCommand, 0 );
         break;
+    case PROGRAM_RUNS:
+    case PROGRAM_SEQ:
+        // Sent for PROGRAM_FLASH.
+        emit PostErrorMessage(PROGRAM_FLASH, nullptr);
+        break;
+    case SET_FRAMING:
+    case SET_OPTIONS:
+        // Not taken, the link stays as it was.
+        if (!NegotiateLink()) {
+            emit PostMessage(READ_BOOT_INFO, BootInfo);
+        }
+        break;
+    case NACK:
+        // Sent by the device only.
+        break;
     }
 }
 
+/****************************************************************************
+ *  Gets the retransmission counters of the last programming pass
+ *
+ * \param
+ * \param
+ * \param
+ * \return Counters
+ *****************************************************************************/
+T_TX_STATS GBootLoader::GetTxStats()
+{
+    return TxStats;
+}
+
 /****************************************************************************
  *  Gets locally calculated CRC
  *
@@ -401,6 +678,84 @@ unsigned short GBootLoader::CalculateFlashCRC()
     return crc;
 }
 
+/****************************************************************************
+ *  Splits the loaded image in ranges for READ_DIGEST, as many as fit in the
+    response frame
+ *
+ * \param Algorithm: Digest
+ * \param
+ * \param
+ * \return Ranges, empty if no image is loaded
+ *****************************************************************************/
+QVector<T_MEMORY_RANGE> GBootLoader::GetDigestRanges(T_DIGEST_ALGORITHM Algorithm)
+{
+    int Size = GFlashImage::DigestSize(Algorithm);
+
+    if (Size == 0) {
+        return QVector<T_MEMORY_RANGE>();
+    }
+
+    // Command, algorithm, count and the frame CRC.
+    return HexManager.VerifyRanges(qMin(DIGEST_MAX_RANGES, static_cast<int>((sizeof(RxData) - 2 - 5) / Size)));
+}
+
+/****************************************************************************
+ *  Asks the device for the digest of address ranges
+ *
+ * \param Algorithm: Digest
+ * \param Ranges: Device address ranges, at most DIGEST_MAX_RANGES
+ * \param Retries, DelayInMs: As SendCommand()
+ * \return false if the command could not be built
+ *****************************************************************************/
+bool GBootLoader::ReadDigest(T_DIGEST_ALGORITHM Algorithm, const QVector<T_MEMORY_RANGE> &Ranges,
+                             unsigned short Retries, unsigned short DelayInMs)
+{
+    if (Ranges.isEmpty() || (Ranges.size() > DIGEST_MAX_RANGES)
+            || ((3 + Ranges.size() * GFlashImage::DigestSize(Algorithm) + 2) > static_cast<int>(sizeof(RxData) - 2))) {
+        return false;
+    }
+
+    DigestAlgorithm = Algorithm;
+    DigestRanges = Ranges;
+
+    return SendCommand(READ_DIGEST, Retries, DelayInMs);
+}
+
+/****************************************************************************
+ *  Compares a READ_DIGEST response with the loaded image
+ *
+ * \param Response: Response data, after the command byte
+ * \param Failed: Receives the ranges that do not match
+ * \param
+ * \return Number of ranges that do not match, -1 if the response or the
+ *         image cannot be checked
+ *****************************************************************************/
+int GBootLoader::CheckDigests(const char *Response, QVector<T_MEMORY_RANGE> *Failed)
+{
+    int Size = GFlashImage::DigestSize(DigestAlgorithm);
+    QByteArray Expected;
+
+    Failed->clear();
+
+    if ((static_cast<unsigned char>(Response[0]) != DigestAlgorithm)
+            || (static_cast<unsigned char>(Response[1]) != DigestRanges.size())) {
+        // The device does not know the algorithm.
+        return -1;
+    }
+
+    for (int i = 0; i < DigestRanges.size(); i++) {
+        Expected = HexManager.CalculateDigest(DigestAlgorithm, DigestRanges[i]);
+        if (Expected.size() != Size) {
+            return -1;
+        }
+        if (memcmp(Expected.constData(), Response + 2 + i * Size, Size) != 0) {
+            Failed->append(DigestRanges[i]);
+        }
+    }
+
+    return Failed->size();
+}
+
 /****************************************************************************
  *  Loads hex file
  *
@@ -415,11 +770,80 @@ bool GBootLoader::LoadHexFile()
 }
 
 /****************************************************************************
- *  Open communication port (USB/COM/Eth)
+ *  Loads a hex file without asking for it
  *
- * \param Port Type	(USB/COM)
+ * \param Path: Hex, ELF or S-record file
+ * \param
+ * \param
+ * \return true if hex file loads successfully
+ *****************************************************************************/
+bool GBootLoader::LoadHexFile(const QString &Path)
+{
+    return HexManager.LoadHexFile(Path);
+}
+
+/****************************************************************************
+ *  Watches the loaded hex file and reloads it when it changes
+ *
+ * \param Enable: true to watch the file
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GBootLoader::SetHexWatchMode(bool Enable)
+{
+    HexManager.SetWatchMode(Enable);
+}
+
+/****************************************************************************
+ *  Selects the target device memory map
+ *
+ * \param Index: Built-in device profile
+ * \param
+ * \param
+ * \return false if the loaded hex file could not be rebuilt for the device
+ *****************************************************************************/
+bool GBootLoader::SetDeviceProfile(int Index)
+{
+    return HexManager.SetDeviceProfile(GDeviceProfile(Index));
+}
+
+/****************************************************************************
+ *  Target device memory map, as used by the hex manager
+ *
+ * \param
+ * \param
+ * \param
+ * \return Selected device profile
+ *****************************************************************************/
+const GDeviceProfile &GBootLoader::GetDeviceProfile(void) const
+{
+    return HexManager.GetDeviceProfile();
+}
+
+/****************************************************************************
+ *  Sets the flash write latency of the simulator, for the one open and the
+    next ones
+ *
+ * \param Ms: Time to write the data of a program frame
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GBootLoader::SetSimulatorLatency(unsigned int Ms)
+{
+    SimulatorLatency = Ms;
+    if (Simulator) {
+        Simulator->SetWriteLatency(Ms);
+    }
+}
+
+/****************************************************************************
+ *  Open communication port (USB/COM/Eth/SIM)
+ *
+ * \param Port Type	(USB/COM/SIM)
  * \param	com port
- * \param 	baud rate
+ * \param 	baud rate, also the line speed of the simulator
  * \param   vid
  * \param   pid
  * \return
@@ -432,14 +856,36 @@ void GBootLoader::OpenPort(T_PORTTYPE portType,
                            unsigned short skt,
                            unsigned long ip)
 {
+    PortType = portType;
+    // Nothing received so far belongs to the new session, which starts with
+    // DLE framing.
+    RxDecoder.Reset();
+    RxDecoder.SetFraming(FRAMING_DLE);
+    TxEncoder.SetFraming(FRAMING_DLE);
+    TxEncoder.SetSize(TX_PACKET_LEN);
+    Payload = PAYLOAD_HEX_RECORDS;
+    WindowSize = 1;
+    Windowed = false;
+    // Program frames wait for the line on a serial port.
+    TxWindow.SetBaudRate(((portType == COM) || (portType == SIM)) ? baud : 0);
+
     switch (portType) {
     case USB:
         (void) vid;
         (void) pid;
         break;
+    case SIM:
+        delete Simulator;
+        Simulator = new GBootSimulator(HexManager.GetDeviceProfile());
+        Simulator->SetBaudRate(baud);
+        Simulator->SetWriteLatency(SimulatorLatency);
+        BaudRate = baud;
+        timer.start();
+        break;
     case COM:
         ComPort->setPortName(comport);
         ComPort->setBaudRate(baud);
+        BaudRate = baud;
 
         ComPort->open(QIODevice::ReadWrite);
 
@@ -453,6 +899,20 @@ void GBootLoader::OpenPort(T_PORTTYPE portType,
     }
 }
 
+/****************************************************************************
+ *  Baud rate of the COM port, or line speed of the simulator
+ *
+ * \param
+ * \param
+ * \param
+ * \return Baud rate given to OpenPort(), 0 if no COM port or simulator was
+    opened
+ *****************************************************************************/
+qint32 GBootLoader::GetBaudRate(void) const
+{
+    return BaudRate;
+}
+
 bool GBootLoader::GetPortOpenStatus(T_PORTTYPE portType)
 {
     bool result = false;
@@ -461,6 +921,9 @@ bool GBootLoader::GetPortOpenStatus(T_PORTTYPE portType)
     case COM:
         result = ComPort->isOpen();
         break;
+    case SIM:
+        result = (Simulator != nullptr);
+        break;
     case USB:
     case ETH:
         break;
@@ -483,6 +946,10 @@ void GBootLoader::ClosePort(T_PORTTYPE portType)
     case COM:
         ComPort->close();
         break;
+    case SIM:
+        delete Simulator;
+        Simulator = nullptr;
+        break;
     case ETH:
         break;
     }
@@ -514,6 +981,11 @@ void GBootLoader::RxTxThread()
  *****************************************************************************/
 void GBootLoader::WritePort(const char *buffer, qint64 bufflen)
 {
+    if ((PortType == SIM) && Simulator) {
+        Simulator->Write(buffer, bufflen);
+        return;
+    }
+
     ComPort->write(buffer, bufflen);
 }
 
@@ -527,6 +999,10 @@ qint64 GBootLoader::ReadPort(char *buffer, qint64 bufflen)
 {
     qint64 bytesRead;
 
+    if (PortType == SIM) {
+        return Simulator ? Simulator->Read(buffer, bufflen) : 0;
+    }
+
     bytesRead = ComPort->read(buffer, bufflen);
 
     return bytesRead;
@@ -4,11 +4,22 @@
 #include <QObject>
 #include <QThread>
 
+#include "gframecodec.h"
 #include "ghexmanager.h"
+#include "grecordpacker.h"
+#include "gsendwindow.h"
 #include <QSerialPort>
 
 #include <QTimer>
 
+// Longest packet sent to the device, SOH to EOT. Devices reporting a longer
+// one on connect get packets up to TX_PACKET_MAX.
+#define TX_PACKET_LEN 1000
+#define TX_PACKET_MAX 4096
+
+// Ranges asked in one READ_DIGEST frame
+#define DIGEST_MAX_RANGES 32
+
 // Trasnmission states
 #define FIRST_TRY 0
 #define RE_TRY 1
@@ -20,17 +31,65 @@ typedef enum
     ERASE_FLASH,
     PROGRAM_FLASH,
     READ_CRC,
-    JMP_TO_APP
+    JMP_TO_APP,
+    READ_DIGEST,
+    SET_FRAMING,
+    PROGRAM_RUNS,
+    PROGRAM_SEQ,
+    SET_OPTIONS,
+    NACK
 
 }T_COMMANDS;
 
+// PROGRAM_SEQ frames carry a sequence number and PROGRAM_FLASH or
+// PROGRAM_RUNS, with this bit set on the first frame of a programming pass.
+// They are answered with the next sequence expected and a bitmap of the
+// frames received after it (16 bits, little endian).
+#define PROGRAM_SEQ_START 0x80
+
+// A NACK frame carries the reason, the next PROGRAM_SEQ frame the device
+// expects and the frame it refused (the next one expected, if it cannot
+// tell). It is sent at once, in place of the answer.
+typedef enum
+{
+    NACK_BAD_CRC = 1,           // Frame dropped: bad CRC, or too long.
+    NACK_SEQUENCE,              // Held, a frame before it is missing.
+    NACK_BUSY                   // Not taken, no room for it.
+}T_NACK_REASON;
+
+// Options asked for with SET_OPTIONS, answered with the ones taken.
+#define BOOT_OPT_NACK       0x01
+
+// Capabilities reported by READ_BOOT_INFO after the version. With
+// BOOT_CAP_PACKET_LEN, the longest packet taken follows (16 bits, little
+// endian).
+#define BOOT_CAP_COBS       0x01
+#define BOOT_CAP_PACKET_LEN 0x02
+#define BOOT_CAP_RUNS       0x04
+// PROGRAM_SEQ frames taken; how many the device holds follows (8 bits), after
+// the packet length if BOOT_CAP_PACKET_LEN is set too, else right after the
+// capabilities.
+#define BOOT_CAP_WINDOW     0x08
+// NACK frames sent, once asked for with BOOT_OPT_NACK.
+#define BOOT_CAP_NACK       0x10
+
+// Retransmission counters, since the last programming pass started.
+typedef struct
+{
+    unsigned int Nacks;             // NACK frames received.
+    unsigned int TimeoutsAvoided;   // Sent again on a NACK, before the retry delay ran out.
+}T_TX_STATS;
+
 typedef enum
 {
     USB,
     COM,
-    ETH
+    ETH,
+    SIM         // GBootSimulator, no device needed
 }T_PORTTYPE;
 
+class GBootSimulator;
+
 class GBootLoader : public QObject
 {
     Q_OBJECT
@@ -43,43 +102,95 @@ public:
     bool ExitThread;
     bool ThreadKilled;
     QSerialPort *ComPort;
+    // Framing asked for on connect, if the device can take it.
+    T_FRAMING PreferredFraming;
+    // Program data format used if the device can take it.
+    T_PAYLOAD PreferredPayload;
+    // Program frames in flight, at most. 1 for stop-and-wait.
+    int PreferredWindow;
+    // BOOT_OPT_* asked for on connect, if the device can take them.
+    unsigned char PreferredOptions;
 
     void TransmitTask(void);
     bool SendCommand(char cmd, unsigned short Retries, unsigned short DelayInMs);
-    void BuildRxFrame(unsigned char*buff, unsigned short buffLen);
     void StopTxRetries(void);
     void HandleResponse(void);
     void HandleNoResponse(void);
     void GetProgress(int *Lower, int *Upper);
+    T_TX_STATS GetTxStats(void);
     unsigned short CalculateFlashCRC(void);
+    QVector<T_MEMORY_RANGE> GetDigestRanges(T_DIGEST_ALGORITHM Algorithm);
+    bool ReadDigest(T_DIGEST_ALGORITHM Algorithm, const QVector<T_MEMORY_RANGE> &Ranges, unsigned short Retries, unsigned short DelayInMs);
+    int CheckDigests(const char *Response, QVector<T_MEMORY_RANGE> *Failed);
     bool LoadHexFile(void);
+    bool LoadHexFile(const QString &Path);
+    void SetHexWatchMode(bool Enable);
+    bool SetDeviceProfile(int Index);
+    const GDeviceProfile &GetDeviceProfile(void) const;
+    void SetSimulatorLatency(unsigned int Ms);
     void OpenPort(T_PORTTYPE portType, QString comport, qint32 baud, unsigned int vid, unsigned int pid, unsigned short skt, unsigned long ip);
+    qint32 GetBaudRate(void) const;
     bool GetPortOpenStatus(T_PORTTYPE portType);
     void ClosePort(T_PORTTYPE portType);
 
 signals:
     void PostMessage(unsigned char, char*);
     void PostErrorMessage(unsigned char, char*);
+    void HexFileReloaded(bool Ok, const QVector<unsigned int> &ChangedPages, unsigned int ChangedBytes);
+    void ImageAnalysisReady(unsigned int Pages, unsigned int WireBytes);
 
 public slots:
     void RxTxThread();
     void ReceiveTask(void);
 
 private:
-    char TxPacket[1000];
-    unsigned short TxPacketLen;
+    // Packet being sent, escaped.
+    GFrameEncoder TxEncoder;
     char RxData[255];
     unsigned short RxDataLen;
+    // Frames received, decoded as the bytes arrive.
+    GFrameDecoder RxDecoder;
+    // READ_BOOT_INFO answer, held while the link is negotiated, and the
+    // capabilities in it not negotiated yet.
+    char BootInfo[6];
+    unsigned char LinkCaps;
     unsigned short RetryCount;
+    // Retry at once, without waiting for the retry delay, and the times it
+    // was done for the frame in flight.
+    bool RetryNow;
+    unsigned short NackRetries;
+    T_TX_STATS TxStats;
 
-    bool RxFrameValid;
     T_COMMANDS LastSentCommand;
     bool NoResponseFromDevice;
     unsigned int TxState;
     unsigned short MaxRetry;
     unsigned short TxRetryDelay;
     GHexManager HexManager;
+    // Data of the records read for PROGRAM_FLASH, not sent yet.
+    GRecordPacker RecordPacker;
+    // Program data format of the device connected.
+    T_PAYLOAD Payload;
+    // Program frames in flight, as taken by the device connected, and
+    // whether they are being sent.
+    int WindowSize;
+    bool Windowed;
+    GSendWindow TxWindow;
+    bool FillWindow(void);
+    bool NegotiateLink(void);
+    void HandleNack(void);
     bool ResetHexFilePtr;
+    // Baud rate of the open COM port or simulator, 0 if none was opened.
+    qint32 BaudRate;
+    // Ranges of the last READ_DIGEST.
+    T_DIGEST_ALGORITHM DigestAlgorithm;
+    QVector<T_MEMORY_RANGE> DigestRanges;
+    // Open port.
+    T_PORTTYPE PortType;
+    GBootSimulator *Simulator;
+    // Flash write latency of the simulator, in ms.
+    unsigned int SimulatorLatency;
+    void UpdateLinkFormat(void);
     void WritePort(const char *buffer, qint64 bufflen);
     qint64 ReadPort(char *buffer, qint64 bufflen);
 
@@ -0,0 +1,571 @@
+#include "gbootsimulator.h"
+
+#include "utils.h"
+
+#include <string.h>
+
+/****************************************************************************
+ * Reads a little endian 32 bit value.
+ *****************************************************************************/
+static unsigned int ReadLe32(const unsigned char *Src)
+{
+    return Src[0] | (Src[1] << 8) | (Src[2] << 16) | ((unsigned int)Src[3] << 24);
+}
+
+GBootSimulator::GBootSimulator(const GDeviceProfile &DeviceProfile)
+    : Profile(DeviceProfile), RxDecoder(SIMULATOR_FRAME_LEN)
+{
+    Writable = Profile.WritableRanges();
+    HexRecordSt.ExtSegAddress = 0;
+    HexRecordSt.ExtLinAddress = 0;
+    WriteLatency = 0;
+    BaudRate = 0;
+    Clock.start();
+    ArriveAt = 0;
+    BusyUntil = 0;
+    RxLineFree = 0;
+    TxLineFree = 0;
+    RxSequence = 0;
+    SequenceValid = false;
+    Options = 0;
+    RxDropped = 0;
+}
+
+/****************************************************************************
+ * Time the device takes to write the data of each program frame. Frames
+ * are answered once their data is written.
+ *
+ * \param  Ms: Latency in ms, zero to write at once.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GBootSimulator::SetWriteLatency(unsigned int Ms)
+{
+    WriteLatency = Ms;
+}
+
+/****************************************************************************
+ * Speed of the line to the host. Bytes take their wire time each way.
+ *
+ * \param  Baud: Bits per second, zero for no wire time.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GBootSimulator::SetBaudRate(unsigned int Baud)
+{
+    BaudRate = Baud;
+}
+
+/****************************************************************************
+ * Bytes sent by the host. Complete frames are handled at once.
+ *
+ * \param  Data: Bytes, as on the wire.
+ * \param  Len: Number of bytes.
+ * \param
+ * \return
+ *****************************************************************************/
+void GBootSimulator::Write(const char *Data, qint64 Len)
+{
+    char Frame[SIMULATOR_FRAME_LEN];
+    int Taken;
+    int FrameLen;
+
+    // The frames in the bytes are complete once the last byte is in.
+    RxLineFree = qMax(Clock.nsecsElapsed() / 1000, RxLineFree) + WireTime(Len);
+    ArriveAt = RxLineFree;
+
+    while(Len > 0)
+    {
+        Taken = RxDecoder.Write(Data, qMin<qint64>(Len, FRAME_RING_SIZE));
+        Data += Taken;
+        Len -= Taken;
+
+        // Frames with a bad CRC are dropped, the host retries them.
+        while((FrameLen = RxDecoder.NextFrame(Frame, sizeof(Frame))) > 0)
+        {
+            NackDropped();
+            HandleFrame((const unsigned char*)Frame, FrameLen);
+        }
+        NackDropped();
+    }
+}
+
+/****************************************************************************
+ * Bytes sent by the device, up to now.
+ *
+ * \param  Data: Buffer.
+ * \param  Len: Buffer size.
+ * \param
+ * \return Number of bytes read.
+ *****************************************************************************/
+qint64 GBootSimulator::Read(char *Data, qint64 Len)
+{
+    qint64 Now = Clock.nsecsElapsed() / 1000;
+
+    while(!TxPending.isEmpty() && (TxPending[0].ReadyAt <= Now))
+    {
+        TxBytes.append(TxPending[0].Bytes);
+        TxPending.remove(0);
+    }
+
+    if(Len > TxBytes.size())
+    {
+        Len = TxBytes.size();
+    }
+
+    memcpy(Data, TxBytes.constData(), Len);
+    TxBytes.remove(0, Len);
+
+    return Len;
+}
+
+/****************************************************************************
+ * Executes a command, as the bootloader firmware does.
+ *
+ * \param  Frame: Command and its data, without the frame CRC.
+ * \param  Len: Number of bytes.
+ * \param
+ * \return
+ *****************************************************************************/
+void GBootSimulator::HandleFrame(const unsigned char *Frame, unsigned int Len)
+{
+    QByteArray Response;
+    T_DIGEST_ALGORITHM Algorithm;
+    T_FRAMING Framing;
+    unsigned int Address;
+    unsigned int End;
+    unsigned int Count;
+    unsigned short crc;
+
+    Response.append((char)Frame[0]);
+
+    switch(Frame[0])
+    {
+    case READ_BOOT_INFO:
+        Response.append((char)SIMULATOR_MAJOR_VER);
+        Response.append((char)SIMULATOR_MINOR_VER);
+        Response.append((char)SIMULATOR_CAPS);
+        Response.append((char)SIMULATOR_FRAME_LEN);
+        Response.append((char)(SIMULATOR_FRAME_LEN >> 8));
+        Response.append((char)SIMULATOR_WINDOW);
+        // A new session, the next PROGRAM_SEQ frame must start a pass and
+        // NACKs must be asked for again.
+        SequenceValid = false;
+        Options = 0;
+        break;
+
+    case SET_FRAMING:
+        if(Len < 2)
+        {
+            return;
+        }
+        Framing = (Frame[1] == FRAMING_COBS) ? FRAMING_COBS : FRAMING_DLE;
+        Response.append((char)Framing);
+        // Answered in the old framing, the next frames use the new one.
+        SendResponse(Response, qMax(ArriveAt, BusyUntil));
+        RxDecoder.SetFraming(Framing);
+        return;
+
+    case SET_OPTIONS:
+        if(Len < 2)
+        {
+            return;
+        }
+        Options = Frame[1] & SIMULATOR_OPTIONS;
+        Response.append((char)Options);
+        break;
+
+    case ERASE_FLASH:
+        Flash.Clear();
+        break;
+
+    case PROGRAM_FLASH:
+    case PROGRAM_RUNS:
+        if(!Program(Frame[0], Frame + 1, Len - 1))
+        {
+            // No answer, the host retries.
+            return;
+        }
+        break;
+
+    case PROGRAM_SEQ:
+        ProgramSequenced(Frame + 1, Len - 1);
+        return;
+
+    case READ_CRC:
+        if(Len < 9)
+        {
+            return;
+        }
+        crc = Flash.CalculateCrc(ReadLe32(Frame + 1), ReadLe32(Frame + 5));
+        Response.append((char)crc);
+        Response.append((char)(crc >> 8));
+        break;
+
+    case READ_DIGEST:
+        if(Len < 3)
+        {
+            return;
+        }
+        Algorithm = (T_DIGEST_ALGORITHM)Frame[1];
+        Count = Frame[2];
+        if((GFlashImage::DigestSize(Algorithm) == 0) || (Len < 3 + Count * 8))
+        {
+            // Not supported: no ranges in the answer.
+            Count = 0;
+        }
+        Response.append((char)Algorithm);
+        Response.append((char)Count);
+        for(unsigned int i = 0; i < Count; i++)
+        {
+            Address = ReadLe32(Frame + 3 + i * 8);
+            End = ReadLe32(Frame + 3 + i * 8 + 4);
+            Response.append(Flash.CalculateDigest(Algorithm, Address, (End > Address) ? (End - Address) : 0));
+        }
+        break;
+
+    case JMP_TO_APP:
+    default:
+        // No answer.
+        return;
+    }
+
+    // Answered once the flash writes before it are done.
+    SendResponse(Response, qMax(ArriveAt, BusyUntil));
+}
+
+/****************************************************************************
+ * Takes a PROGRAM_SEQ frame: sequence, command (PROGRAM_FLASH or
+ * PROGRAM_RUNS, PROGRAM_SEQ_START on the first frame of a pass) and its
+ * data. Frames are programmed in sequence; the ones received after a missing
+ * frame are held, SIMULATOR_WINDOW at most. Every frame is answered with the
+ * next sequence expected and a bitmap of the frames held after it.
+ *
+ * \param  Frame: Sequence, command and data.
+ * \param  Len: Number of bytes.
+ * \param
+ * \return
+ *****************************************************************************/
+void GBootSimulator::ProgramSequenced(const unsigned char *Frame, unsigned int Len)
+{
+    QByteArray Response;
+    unsigned char Sequence;
+    unsigned char Cmd;
+    unsigned char Offset;
+    unsigned int Received = 0;
+
+    if(Len < 2)
+    {
+        return;
+    }
+    Sequence = Frame[0];
+    Cmd = Frame[1] & ~PROGRAM_SEQ_START;
+
+    if(Frame[1] & PROGRAM_SEQ_START)
+    {
+        // The host sends it alone, so it is the one programmed last if this
+        // is a retry.
+        if(!SequenceValid || (Sequence != static_cast<unsigned char>(RxSequence - 1)))
+        {
+            if(!CheckProgram(Cmd, Frame + 2, Len - 2))
+            {
+                return;
+            }
+            for(int i = 0; i < SIMULATOR_WINDOW; i++)
+            {
+                Held[i].clear();
+            }
+            RxSequence = Sequence;
+            SequenceValid = true;
+        }
+    }
+    else if(!SequenceValid)
+    {
+        // From a pass this device did not see start.
+        return;
+    }
+
+    // Frames programmed already, or past the window, are only answered.
+    Offset = Sequence - RxSequence;
+    if((Offset >= SIMULATOR_WINDOW) && (Offset < 128) && (Options & BOOT_OPT_NACK))
+    {
+        // Past the frames it can hold.
+        SendNack(NACK_BUSY, Sequence);
+        return;
+    }
+    if((Offset < SIMULATOR_WINDOW) && Held[Sequence % SIMULATOR_WINDOW].isEmpty())
+    {
+        if(!CheckProgram(Cmd, Frame + 2, Len - 2))
+        {
+            // No answer, the host sends it again.
+            return;
+        }
+        Held[Sequence % SIMULATOR_WINDOW] = QByteArray((const char*)Frame + 1, Len - 1);
+        if((Offset != 0) && (Options & BOOT_OPT_NACK))
+        {
+            // Held, the one expected is missing.
+            SendNack(NACK_SEQUENCE, Sequence);
+            return;
+        }
+
+        while(!Held[RxSequence % SIMULATOR_WINDOW].isEmpty())
+        {
+            const QByteArray &Next = Held[RxSequence % SIMULATOR_WINDOW];
+            Program(Next[0] & ~PROGRAM_SEQ_START, (const unsigned char*)Next.constData() + 1, Next.size() - 1);
+            Held[RxSequence % SIMULATOR_WINDOW].clear();
+            RxSequence++;
+        }
+    }
+
+    for(int i = 0; i < SIMULATOR_WINDOW; i++)
+    {
+        if(!Held[(RxSequence + i) % SIMULATOR_WINDOW].isEmpty())
+        {
+            Received |= 1u << i;
+        }
+    }
+
+    Response.append((char)PROGRAM_SEQ);
+    Response.append((char)RxSequence);
+    Response.append((char)Received);
+    Response.append((char)(Received >> 8));
+    SendResponse(Response, qMax(ArriveAt, BusyUntil));
+}
+
+/****************************************************************************
+ * Answers the frames the decoder dropped since the last call with a
+ * NACK_BAD_CRC, if NACKs were asked for.
+ *****************************************************************************/
+void GBootSimulator::NackDropped()
+{
+    for(; RxDropped != RxDecoder.DroppedFrames; RxDropped++)
+    {
+        if(Options & BOOT_OPT_NACK)
+        {
+            SendNack(NACK_BAD_CRC, RxSequence);
+        }
+    }
+}
+
+/****************************************************************************
+ * Sends a NACK at once, after the responses already sent.
+ *
+ * \param  Reason: Why the frame was not taken.
+ * \param  Refused: PROGRAM_SEQ frame not taken, the next one expected if it
+ *                  cannot be told.
+ * \param
+ * \return
+ *****************************************************************************/
+void GBootSimulator::SendNack(T_NACK_REASON Reason, unsigned char Refused)
+{
+    QByteArray Response;
+
+    Response.append((char)NACK);
+    Response.append((char)Reason);
+    Response.append((char)RxSequence);
+    Response.append((char)Refused);
+    SendResponse(Response, ArriveAt);
+}
+
+/****************************************************************************
+ * Checks the data of a program frame, before anything is written.
+ *
+ * \param  Cmd: PROGRAM_FLASH or PROGRAM_RUNS.
+ * \param  Data: Records or runs, back to back.
+ * \param  Len: Number of bytes.
+ * \return false if the frame cannot be programmed.
+ *****************************************************************************/
+bool GBootSimulator::CheckProgram(unsigned char Cmd, const unsigned char *Data, unsigned int Len)
+{
+    unsigned int ItemLen;
+    unsigned char Sum;
+
+    for(; Len; Data += ItemLen, Len -= ItemLen)
+    {
+        if(Cmd == PROGRAM_RUNS)
+        {
+            if(Len < PACKER_RUN_HEADER)
+            {
+                return false;
+            }
+            ItemLen = PACKER_RUN_HEADER + (Data[4] | (Data[5] << 8));
+        }
+        else if(Cmd == PROGRAM_FLASH)
+        {
+            ItemLen = Data[0] + 5;
+        }
+        else
+        {
+            return false;
+        }
+
+        if(ItemLen > Len)
+        {
+            return false;
+        }
+
+        if(Cmd == PROGRAM_FLASH)
+        {
+            Sum = 0;
+            for(unsigned int i = 0; i < ItemLen; i++)
+            {
+                Sum += Data[i];
+            }
+            if(Sum != 0)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/****************************************************************************
+ * Programs the data of a program frame. The device stays busy for
+ * WriteLatency after the frame arrives, or after the write before it.
+ *
+ * \param  Cmd: PROGRAM_FLASH or PROGRAM_RUNS.
+ * \param  Data: Records or runs, back to back.
+ * \param  Len: Number of bytes.
+ * \return false if the data is not valid.
+ *****************************************************************************/
+bool GBootSimulator::Program(unsigned char Cmd, const unsigned char *Data, unsigned int Len)
+{
+    bool Ok = (Cmd == PROGRAM_RUNS) ? ProgramRuns(Data, Len) : ProgramRecords(Data, Len);
+
+    if(Ok)
+    {
+        BusyUntil = qMax(ArriveAt, BusyUntil) + WriteLatency * 1000;
+    }
+
+    return Ok;
+}
+
+/****************************************************************************
+ * Programs the hex records of a PROGRAM_FLASH frame. The boot flash and
+ * anything outside the flash of the profile are skipped.
+ *
+ * \param  Records: Records, back to back.
+ * \param  Len: Number of bytes.
+ * \param
+ * \return false if a record is not valid.
+ *****************************************************************************/
+bool GBootSimulator::ProgramRecords(const unsigned char *Records, unsigned int Len)
+{
+    unsigned int RecLen;
+    unsigned char Sum;
+
+    while(Len)
+    {
+        RecLen = Records[0] + 5;
+        if(RecLen > Len)
+        {
+            return false;
+        }
+
+        Sum = 0;
+        for(unsigned int i = 0; i < RecLen; i++)
+        {
+            Sum += Records[i];
+        }
+        if(Sum != 0)
+        {
+            return false;
+        }
+
+        GHexManager::DecodeRecordAddress(&HexRecordSt, Records);
+        if(HexRecordSt.RecType == DATA_RECORD)
+        {
+            ProgramData(Profile.Translate(HexRecordSt.Address), HexRecordSt.Data, HexRecordSt.RecDataLen);
+        }
+
+        Records += RecLen;
+        Len -= RecLen;
+    }
+
+    return true;
+}
+
+/****************************************************************************
+ * Programs the runs of a PROGRAM_RUNS frame: address (32 bits) and length
+ * (16 bits), little endian, then the data.
+ *
+ * \param  Runs: Runs, back to back.
+ * \param  Len: Number of bytes.
+ * \param
+ * \return false if a run is cut short. Nothing is written then.
+ *****************************************************************************/
+bool GBootSimulator::ProgramRuns(const unsigned char *Runs, unsigned int Len)
+{
+    const unsigned char *Run;
+    unsigned int Left;
+    unsigned int RunLen;
+
+    // The whole frame is checked first.
+    if(!CheckProgram(PROGRAM_RUNS, Runs, Len))
+    {
+        return false;
+    }
+
+    for(Run = Runs, Left = Len; Left; Run += RunLen, Left -= RunLen)
+    {
+        RunLen = Run[4] | (Run[5] << 8);
+        ProgramData(Profile.Translate(ReadLe32(Run)), Run + PACKER_RUN_HEADER, RunLen);
+        RunLen += PACKER_RUN_HEADER;
+    }
+
+    return true;
+}
+
+/****************************************************************************
+ * Writes data to the flash. The boot flash and anything outside the flash
+ * of the profile are skipped.
+ *
+ * \param  Address: Device address of the first byte.
+ * \param  Data: Data.
+ * \param  Len: Number of bytes.
+ * \return
+ *****************************************************************************/
+void GBootSimulator::ProgramData(quint64 Address, const unsigned char *Data, unsigned int Len)
+{
+    quint64 Begin = Address;
+    unsigned int Piece;
+
+    while((Piece = GDeviceProfile::NextWritable(Writable, &Address, Begin + Len)) != 0)
+    {
+        Flash.Write(Address, Data + (Address - Begin), Piece);
+        Address += Piece;
+    }
+}
+
+/****************************************************************************
+ * Time to send bytes on the line, in us: a start and a stop bit each.
+ *****************************************************************************/
+qint64 GBootSimulator::WireTime(qint64 Len) const
+{
+    return BaudRate ? ((Len * 10 * 1000000) / BaudRate) : 0;
+}
+
+/****************************************************************************
+ * Frames a response: CRC, escapes, SOH and EOT. It can be read once it is
+ * sent, after the responses before it.
+ *
+ * \param  Response: Command and its data.
+ * \param  At: Time the device sends it, in us.
+ * \param
+ * \return
+ *****************************************************************************/
+void GBootSimulator::SendResponse(const QByteArray &Response, qint64 At)
+{
+    GFrameEncoder Encoder(1 + 2 * Response.size() + FRAME_TRAILER_LEN, RxDecoder.GetFraming());
+    T_SIM_RESPONSE Pending;
+
+    Encoder.Append(Response.constData(), Response.size());
+    Pending.Bytes = QByteArray(Encoder.Data(), Encoder.Finish());
+    TxLineFree = qMax(At, TxLineFree) + WireTime(Pending.Bytes.size());
+    Pending.ReadyAt = TxLineFree;
+    TxPending.append(Pending);
+}
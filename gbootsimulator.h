@@ -0,0 +1,96 @@
+#ifndef GBOOTSIMULATOR_H
+#define GBOOTSIMULATOR_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+
+#include "gbootloader.h"
+#include "gflashimage.h"
+#include "gframecodec.h"
+
+// Bootloader version reported by the simulator.
+#define SIMULATOR_MAJOR_VER 1
+#define SIMULATOR_MINOR_VER 6
+#define SIMULATOR_CAPS      (BOOT_CAP_COBS | BOOT_CAP_PACKET_LEN | BOOT_CAP_RUNS | BOOT_CAP_WINDOW | BOOT_CAP_NACK)
+#define SIMULATOR_OPTIONS   BOOT_OPT_NACK
+
+// Longest frame the simulator accepts, unescaped. Reported as the longest
+// packet, which is never shorter.
+#define SIMULATOR_FRAME_LEN 2048
+
+// PROGRAM_SEQ frames the simulator holds, out of order. Divides 256, the
+// frames are held by sequence.
+#define SIMULATOR_WINDOW    8
+
+typedef struct
+{
+    qint64 ReadyAt;             // Time the last byte is sent, in us.
+    QByteArray Bytes;
+}T_SIM_RESPONSE;
+
+// Device side of the bootloader protocol, in memory. Frames written to it are
+// handled at once and the responses wait to be read, as from the serial port
+// of a real device. The flash is a GFlashImage with the memory map of a
+// device profile. With a baud rate and a flash write latency set, the
+// responses are not read before a device on such a line would send them.
+class GBootSimulator
+{
+public:
+    //  Constructor
+    explicit GBootSimulator(const GDeviceProfile &DeviceProfile);
+
+    // Device flash.
+    GFlashImage Flash;
+
+    void SetWriteLatency(unsigned int Ms);
+    void SetBaudRate(unsigned int Baud);
+    void Write(const char *Data, qint64 Len);
+    qint64 Read(char *Data, qint64 Len);
+
+private:
+    GDeviceProfile Profile;
+    // Time to write the data of a program frame, in ms.
+    unsigned int WriteLatency;
+    // Line speed in bits per second, zero for no wire time.
+    unsigned int BaudRate;
+    QVector<T_MEMORY_RANGE> Writable;
+    // Address state of the records programmed.
+    T_HEX_RECORD HexRecordSt;
+
+    // Frames received, and the ones dropped so far.
+    GFrameDecoder RxDecoder;
+    unsigned int RxDropped;
+    // BOOT_OPT_* taken.
+    unsigned char Options;
+    // Bytes waiting to be read.
+    QByteArray TxBytes;
+    // Responses not sent yet.
+    QVector<T_SIM_RESPONSE> TxPending;
+
+    // Times in us: arrival of the frame handled, end of the flash write in
+    // progress and of the bytes written to each side of the line.
+    QElapsedTimer Clock;
+    qint64 ArriveAt;
+    qint64 BusyUntil;
+    qint64 RxLineFree;
+    qint64 TxLineFree;
+
+    // Next PROGRAM_SEQ frame to program, and the ones received after it.
+    unsigned char RxSequence;
+    bool SequenceValid;
+    QByteArray Held[SIMULATOR_WINDOW];
+
+    void HandleFrame(const unsigned char *Frame, unsigned int Len);
+    void ProgramSequenced(const unsigned char *Frame, unsigned int Len);
+    void NackDropped(void);
+    void SendNack(T_NACK_REASON Reason, unsigned char Refused);
+    bool CheckProgram(unsigned char Cmd, const unsigned char *Data, unsigned int Len);
+    bool Program(unsigned char Cmd, const unsigned char *Data, unsigned int Len);
+    bool ProgramRecords(const unsigned char *Records, unsigned int Len);
+    bool ProgramRuns(const unsigned char *Runs, unsigned int Len);
+    void ProgramData(quint64 Address, const unsigned char *Data, unsigned int Len);
+    qint64 WireTime(qint64 Len) const;
+    void SendResponse(const QByteArray &Response, qint64 At);
+};
+
+#endif // GBOOTSIMULATOR_H
@@ -0,0 +1,190 @@
+#include "gdeviceprofile.h"
+
+#include <QCryptographicHash>
+
+#include <algorithm>
+
+// KSEG0 address of a physical address.
+#define KVA0_MASK           0x1FFFFFFF
+#define KVA0_SET            0x80000000
+
+// Program and boot flash, KSEG0.
+#define PROGRAM_FLASH_BASE  0x9D000000
+#define BOOT_FLASH          0x9FC00000
+#define BOOT_FLASH_END      0xA0000000
+
+typedef struct
+{
+    const char *Name;
+    unsigned int AddressMask;
+    unsigned int AddressSet;
+    unsigned int RowSize;
+    unsigned int PageSize;
+    T_MEMORY_RANGE Flash;
+    T_MEMORY_RANGE Protected;       // Empty if Begin == End
+}T_PROFILE_ENTRY;
+
+static const T_PROFILE_ENTRY Profiles[] =
+{
+    // The bootloader (boot flash) is never written. Image addresses are only
+    // forced into KSEG0, as the tool has always done.
+    { "PIC32MX (genérico)", 0xFFFFFFFF, KVA0_SET, 512, 4096,
+      { 0x80000000, BOOT_FLASH_END }, { BOOT_FLASH, BOOT_FLASH_END } },
+    { "PIC32MX1xx/2xx 128 KB", KVA0_MASK, KVA0_SET, 128, 1024,
+      { PROGRAM_FLASH_BASE, PROGRAM_FLASH_BASE + 0x20000 }, { 0, 0 } },
+    { "PIC32MX1xx/2xx 256 KB", KVA0_MASK, KVA0_SET, 128, 1024,
+      { PROGRAM_FLASH_BASE, PROGRAM_FLASH_BASE + 0x40000 }, { 0, 0 } },
+    { "PIC32MX3xx/4xx 512 KB", KVA0_MASK, KVA0_SET, 512, 4096,
+      { PROGRAM_FLASH_BASE, PROGRAM_FLASH_BASE + 0x80000 }, { 0, 0 } },
+    { "PIC32MX5xx/6xx/7xx 512 KB", KVA0_MASK, KVA0_SET, 512, 4096,
+      { PROGRAM_FLASH_BASE, PROGRAM_FLASH_BASE + 0x80000 }, { 0, 0 } },
+    { "PIC32MZ EF 2048 KB", KVA0_MASK, KVA0_SET, 2048, 16384,
+      { PROGRAM_FLASH_BASE, PROGRAM_FLASH_BASE + 0x200000 }, { 0, 0 } },
+};
+
+GDeviceProfile::GDeviceProfile(int Index)
+{
+    const T_PROFILE_ENTRY &Entry = Profiles[((Index >= 0) && (Index < ProfileCount())) ? Index : 0];
+
+    Name = QString::fromUtf8(Entry.Name);
+    AddressMask = Entry.AddressMask;
+    AddressSet = Entry.AddressSet;
+    RowSize = Entry.RowSize;
+    PageSize = Entry.PageSize;
+    FlashRegions.append(Entry.Flash);
+    if(Entry.Protected.Begin < Entry.Protected.End)
+    {
+        ProtectedRanges.append(Entry.Protected);
+    }
+}
+
+/****************************************************************************
+ * Translates an image address to a device address.
+ *
+ * \param  Address: Address found in the image.
+ * \param
+ * \param
+ * \return Device address.
+ *****************************************************************************/
+unsigned int GDeviceProfile::Translate(unsigned int Address) const
+{
+    return (Address & AddressMask) | AddressSet;
+}
+
+/****************************************************************************
+ * Gets the device addresses that can be written: the flash regions minus the
+ * protected ranges.
+ *
+ * \param
+ * \param
+ * \param
+ * \return Sorted, non overlapping ranges.
+ *****************************************************************************/
+QVector<T_MEMORY_RANGE> GDeviceProfile::WritableRanges() const
+{
+    QVector<T_MEMORY_RANGE> Ranges = FlashRegions;
+    QVector<T_MEMORY_RANGE> Clipped;
+    T_MEMORY_RANGE Piece;
+
+    std::sort(Ranges.begin(), Ranges.end(),
+              [](const T_MEMORY_RANGE &a, const T_MEMORY_RANGE &b) { return a.Begin < b.Begin; });
+
+    for(int p = 0; p < ProtectedRanges.size(); p++)
+    {
+        const T_MEMORY_RANGE &Protected = ProtectedRanges[p];
+
+        if(Protected.Begin >= Protected.End)
+        {
+            continue;
+        }
+
+        Clipped.clear();
+        for(int i = 0; i < Ranges.size(); i++)
+        {
+            if((Ranges[i].End <= Protected.Begin) || (Ranges[i].Begin >= Protected.End))
+            {
+                Clipped.append(Ranges[i]);
+                continue;
+            }
+            if(Ranges[i].Begin < Protected.Begin)
+            {
+                Piece.Begin = Ranges[i].Begin;
+                Piece.End = Protected.Begin;
+                Clipped.append(Piece);
+            }
+            if(Ranges[i].End > Protected.End)
+            {
+                Piece.Begin = Protected.End;
+                Piece.End = Ranges[i].End;
+                Clipped.append(Piece);
+            }
+        }
+        Ranges = Clipped;
+    }
+
+    return Ranges;
+}
+
+/****************************************************************************
+ * Finds the next writable piece of a device address range.
+ *
+ * \param  Ranges: Writable ranges, as returned by WritableRanges().
+ * \param  Address: Start of the range. Moved to the start of the piece.
+ * \param  End: One past the end of the range.
+ * \return Length of the piece, 0 if nothing else in the range is writable.
+ *****************************************************************************/
+unsigned int GDeviceProfile::NextWritable(const QVector<T_MEMORY_RANGE> &Ranges, quint64 *Address, quint64 End)
+{
+    for(int i = 0; i < Ranges.size(); i++)
+    {
+        if(Ranges[i].End <= *Address)
+        {
+            continue;
+        }
+        if(Ranges[i].Begin >= End)
+        {
+            break;
+        }
+        if(*Address < Ranges[i].Begin)
+        {
+            *Address = Ranges[i].Begin;
+        }
+        return qMin(End, (quint64)Ranges[i].End) - *Address;
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+ * Identifies the parts of the profile that shape the image, so that images
+ * built for another profile are not reused.
+ *
+ * \param
+ * \param
+ * \param
+ * \return SHA-1 of the translation and the writable ranges.
+ *****************************************************************************/
+QByteArray GDeviceProfile::Key() const
+{
+    QCryptographicHash Hash(QCryptographicHash::Sha1);
+    QVector<T_MEMORY_RANGE> Ranges = WritableRanges();
+
+    Hash.addData((const char*)&AddressMask, sizeof(AddressMask));
+    Hash.addData((const char*)&AddressSet, sizeof(AddressSet));
+    Hash.addData((const char*)Ranges.constData(), Ranges.size() * sizeof(T_MEMORY_RANGE));
+
+    return Hash.result();
+}
+
+/****************************************************************************
+ * Gets the number of built-in profiles.
+ *
+ * \param
+ * \param
+ * \param
+ * \return Number of profiles. Profile 0 is the generic PIC32MX map.
+ *****************************************************************************/
+int GDeviceProfile::ProfileCount()
+{
+    return sizeof(Profiles) / sizeof(Profiles[0]);
+}
@@ -0,0 +1,43 @@
+#ifndef GDEVICEPROFILE_H
+#define GDEVICEPROFILE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+typedef struct
+{
+    unsigned int Begin;         // First address.
+    unsigned int End;           // One past the last address.
+}T_MEMORY_RANGE;
+
+// Memory map of the target device, as seen by the bootloader. Image addresses
+// are translated to device addresses, and only the bytes inside a flash
+// region and outside every protected range are ever sent to the device.
+class GDeviceProfile
+{
+public:
+    //  Constructor. Built-in profile Index, 0 being the generic PIC32MX map
+    //  (everything below the boot sector).
+    explicit GDeviceProfile(int Index = 0);
+
+    QString Name;
+    // Device address = (Address & AddressMask) | AddressSet.
+    unsigned int AddressMask;
+    unsigned int AddressSet;
+    // Flash geometry, in bytes.
+    unsigned int RowSize;
+    unsigned int PageSize;
+    QVector<T_MEMORY_RANGE> FlashRegions;
+    QVector<T_MEMORY_RANGE> ProtectedRanges;
+
+    unsigned int Translate(unsigned int Address) const;
+    QVector<T_MEMORY_RANGE> WritableRanges(void) const;
+    QByteArray Key(void) const;
+    static unsigned int NextWritable(const QVector<T_MEMORY_RANGE> &Ranges, quint64 *Address, quint64 End);
+
+    // Number of built-in profiles.
+    static int ProfileCount(void);
+};
+
+#endif // GDEVICEPROFILE_H
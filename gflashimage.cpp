@@ -0,0 +1,600 @@
+#include "gflashimage.h"
+
+#include "utils.h"
+
+#include <QCryptographicHash>
+#include <QThread>
+#include <QtConcurrentMap>
+
+#include <string.h>
+
+// Missing page CRCs are calculated on several threads from this many pages.
+#define PARALLEL_CRC_MIN_PAGES  64
+
+// Pages whose CRC is calculated by one task of CalculatePageCrcs().
+typedef struct
+{
+    const unsigned char **Data;     // Contents of each page
+    unsigned short *Crcs;           // Receives the CRC of each page
+    int Count;
+}T_PAGE_CRC_GROUP;
+
+/**
+ * Erased page, used for the pages that are not present.
+ *****************************************************************************/
+static const QByteArray &BlankPage()
+{
+    static const QByteArray Blank(FLASH_PAGE_SIZE, (char)0xFF);
+    return Blank;
+}
+
+GFlashImage::GFlashImage()
+{
+    MinAddress = 0xFFFFFFFF;
+    MaxAddress = 0;
+}
+
+/****************************************************************************
+ * Erases the image and releases all the pages.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GFlashImage::Clear()
+{
+    PageBitmap.clear();
+    PageOffsets.clear();
+    Pages.clear();
+    PageCrcs.clear();
+    MinAddress = 0xFFFFFFFF;
+    MaxAddress = 0;
+}
+
+/****************************************************************************
+ * Tells whether anything has been written to the image.
+ *
+ * \param
+ * \param
+ * \param
+ * \return  true if the image is blank.
+ *****************************************************************************/
+bool GFlashImage::IsEmpty() const
+{
+    return PageOffsets.size() == 0;
+}
+
+/****************************************************************************
+ * Allocates an erased page and marks it as present.
+ *
+ * \param  Page: Page number.
+ * \param
+ * \param
+ * \return Pointer to the page data.
+ *****************************************************************************/
+unsigned char *GFlashImage::AllocatePage(unsigned int Page)
+{
+    unsigned int Offset = Pages.size();
+
+    if(PageBitmap.isEmpty())
+    {
+        PageBitmap.fill(0, FLASH_PAGE_COUNT / 64);
+    }
+
+    PageBitmap[Page / 64] |= (quint64)1 << (Page % 64);
+    PageOffsets.insert(Page, Offset);
+
+    Pages.resize(Offset + FLASH_PAGE_SIZE);
+    memset(Pages.data() + Offset, 0xFF, FLASH_PAGE_SIZE);
+
+    return (unsigned char*)Pages.data() + Offset;
+}
+
+/****************************************************************************
+ * Writes data into the image, allocating the pages it touches.
+ *
+ * \param  Address: Flash address of the first byte.
+ * \param  Data: Pointer to the data.
+ * \param  Len: Number of bytes.
+ * \return
+ *****************************************************************************/
+void GFlashImage::Write(unsigned int Address, const unsigned char *Data, unsigned int Len)
+{
+    unsigned int Page;
+    unsigned int Offset;
+    unsigned int Chunk;
+    unsigned char *Dest;
+
+    if(Len == 0)
+    {
+        return;
+    }
+
+    if(MinAddress > Address)
+    {
+        MinAddress = Address;
+    }
+
+    if(MaxAddress < (Address + Len))
+    {
+        MaxAddress = Address + Len;
+    }
+
+    while(Len)
+    {
+        Page = Address >> FLASH_PAGE_SHIFT;
+        Offset = Address & (FLASH_PAGE_SIZE - 1);
+        Chunk = FLASH_PAGE_SIZE - Offset;
+        if(Chunk > Len)
+        {
+            Chunk = Len;
+        }
+
+        if(IsPagePresent(Page))
+        {
+            Dest = (unsigned char*)Pages.data() + PageOffsets.value(Page);
+        }
+        else
+        {
+            Dest = AllocatePage(Page);
+        }
+
+        memcpy(Dest + Offset, Data, Chunk);
+        PageCrcs.remove(Page);
+
+        Address += Chunk;
+        Data += Chunk;
+        Len -= Chunk;
+    }
+}
+
+/****************************************************************************
+ * Reads data from the image. Bytes in pages that are not present read as 0xFF.
+ *
+ * \param  Address: Flash address of the first byte.
+ * \param  Data: Pointer to the output buffer.
+ * \param  Len: Number of bytes.
+ * \return
+ *****************************************************************************/
+void GFlashImage::Read(unsigned int Address, unsigned char *Data, unsigned int Len) const
+{
+    unsigned int Offset;
+    unsigned int Chunk;
+    const unsigned char *Src;
+
+    while(Len)
+    {
+        Offset = Address & (FLASH_PAGE_SIZE - 1);
+        Chunk = FLASH_PAGE_SIZE - Offset;
+        if(Chunk > Len)
+        {
+            Chunk = Len;
+        }
+
+        Src = PageData(Address >> FLASH_PAGE_SHIFT);
+        if(Src)
+        {
+            memcpy(Data, Src + Offset, Chunk);
+        }
+        else
+        {
+            memset(Data, 0xFF, Chunk);
+        }
+
+        Address += Chunk;
+        Data += Chunk;
+        Len -= Chunk;
+    }
+}
+
+/****************************************************************************
+ * Calculates the CRC of an address range of the image. Whole pages are not
+ * read again, their CRC is combined into the result.
+ *
+ * \param  Address: Flash address of the first byte.
+ * \param  Len: Number of bytes.
+ * \param
+ * \return 16 bit CRC, same as Utils::CalculateCrc() over the flat range.
+ *****************************************************************************/
+unsigned short GFlashImage::CalculateCrc(unsigned int Address, unsigned int Len) const
+{
+    unsigned short crc = 0;
+    unsigned int Offset;
+    unsigned int Chunk;
+    const unsigned char *Src;
+
+    if(Len == 0)
+    {
+        return 0;
+    }
+
+    CalculatePageCrcs(Address >> FLASH_PAGE_SHIFT, ((quint64)Address + Len - 1) >> FLASH_PAGE_SHIFT);
+
+    while(Len)
+    {
+        Offset = Address & (FLASH_PAGE_SIZE - 1);
+        Chunk = FLASH_PAGE_SIZE - Offset;
+        if(Chunk > Len)
+        {
+            Chunk = Len;
+        }
+
+        if(Chunk == FLASH_PAGE_SIZE)
+        {
+            crc = Utils::CombineCrc(crc, PageCrc(Address >> FLASH_PAGE_SHIFT), FLASH_PAGE_SIZE);
+        }
+        else
+        {
+            Src = PageData(Address >> FLASH_PAGE_SHIFT);
+            if(Src == NULL)
+            {
+                Src = (const unsigned char*)BlankPage().constData();
+            }
+
+            crc = Utils::UpdateCrc(crc, (const char*)Src + Offset, Chunk);
+        }
+
+        Address += Chunk;
+        Len -= Chunk;
+    }
+
+    return crc;
+}
+
+/****************************************************************************
+ * Calculates a digest of an address range of the image.
+ *
+ * \param  Algorithm: Digest.
+ * \param  Address: Flash address of the first byte.
+ * \param  Len: Number of bytes.
+ * \return DigestSize() bytes, empty if the algorithm is not known.
+ *****************************************************************************/
+QByteArray GFlashImage::CalculateDigest(T_DIGEST_ALGORITHM Algorithm, unsigned int Address, unsigned int Len) const
+{
+    QCryptographicHash Hash(QCryptographicHash::Sha256);
+    QByteArray Digest;
+    unsigned int crc = 0;
+    unsigned int Offset;
+    unsigned int Chunk;
+    const unsigned char *Src;
+
+    if(DigestSize(Algorithm) == 0)
+    {
+        return Digest;
+    }
+
+    while(Len)
+    {
+        Offset = Address & (FLASH_PAGE_SIZE - 1);
+        Chunk = FLASH_PAGE_SIZE - Offset;
+        if(Chunk > Len)
+        {
+            Chunk = Len;
+        }
+
+        Src = PageData(Address >> FLASH_PAGE_SHIFT);
+        if(Src == NULL)
+        {
+            Src = (const unsigned char*)BlankPage().constData();
+        }
+
+        if(Algorithm == DIGEST_CRC32)
+        {
+            crc = Utils::UpdateCrc32(crc, (const char*)Src + Offset, Chunk);
+        }
+        else
+        {
+            Hash.addData((const char*)Src + Offset, Chunk);
+        }
+
+        Address += Chunk;
+        Len -= Chunk;
+    }
+
+    if(Algorithm == DIGEST_CRC32)
+    {
+        Digest.append((char)crc);
+        Digest.append((char)(crc >> 8));
+        Digest.append((char)(crc >> 16));
+        Digest.append((char)(crc >> 24));
+    }
+    else
+    {
+        Digest = Hash.result();
+    }
+
+    return Digest;
+}
+
+/****************************************************************************
+ * Size of a digest.
+ *
+ * \param  Algorithm: Digest.
+ * \param
+ * \param
+ * \return Bytes, 0 if the algorithm is not known.
+ *****************************************************************************/
+int GFlashImage::DigestSize(T_DIGEST_ALGORITHM Algorithm)
+{
+    switch(Algorithm)
+    {
+    case DIGEST_CRC32:
+        return 4;
+    case DIGEST_SHA256:
+        return 32;
+    default:
+        return 0;
+    }
+}
+
+/****************************************************************************
+ * Calculates the CRC of the pages of a group.
+ *****************************************************************************/
+static void CalculatePageCrcGroup(T_PAGE_CRC_GROUP *Group)
+{
+    for(int i = 0; i < Group->Count; i++)
+    {
+        Group->Crcs[i] = Utils::UpdateCrc(0, (const char*)Group->Data[i], FLASH_PAGE_SIZE);
+    }
+}
+
+/****************************************************************************
+ * Calculates the CRC of the present pages of a range that have none yet, on
+ * all cores. Small ranges are left to PageCrc().
+ *
+ * \param  FirstPage: First page of the range.
+ * \param  LastPage: Last page of the range, included.
+ * \param
+ * \return
+ *****************************************************************************/
+void GFlashImage::CalculatePageCrcs(unsigned int FirstPage, unsigned int LastPage) const
+{
+    QVector<unsigned int> Missing;
+    QVector<const unsigned char*> Data;
+    QVector<unsigned short> Crcs;
+    QVector<T_PAGE_CRC_GROUP> Groups;
+    T_PAGE_CRC_GROUP Group;
+    unsigned int Page = FirstPage;
+    int Count;
+    int PerGroup;
+
+    while(NextPage(&Page) && (Page <= LastPage))
+    {
+        if(!PageCrcs.contains(Page))
+        {
+            Missing.append(Page);
+            Data.append(PageData(Page));
+        }
+        Page++;
+    }
+
+    if((Missing.size() < PARALLEL_CRC_MIN_PAGES) || (QThread::idealThreadCount() < 2))
+    {
+        return;
+    }
+
+    // A few groups per core, so that a slow core does not hold the rest.
+    Crcs.resize(Missing.size());
+    Count = qMin(QThread::idealThreadCount() * 4, Missing.size() / (PARALLEL_CRC_MIN_PAGES / 4));
+    PerGroup = (Missing.size() + Count - 1) / Count;
+    for(int i = 0; i < Missing.size(); i += PerGroup)
+    {
+        Group.Data = Data.data() + i;
+        Group.Crcs = Crcs.data() + i;
+        Group.Count = qMin(PerGroup, Missing.size() - i);
+        Groups.append(Group);
+    }
+
+    QtConcurrent::blockingMap(Groups, [](T_PAGE_CRC_GROUP &Group) {
+        CalculatePageCrcGroup(&Group);
+    });
+
+    for(int i = 0; i < Missing.size(); i++)
+    {
+        PageCrcs.insert(Missing[i], Crcs[i]);
+    }
+}
+
+/****************************************************************************
+ * Number of allocated pages.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+int GFlashImage::PageCount() const
+{
+    return PageOffsets.size();
+}
+
+/****************************************************************************
+ * Tells whether a page has been written.
+ *
+ * \param  Page: Page number (address >> FLASH_PAGE_SHIFT).
+ * \param
+ * \param
+ * \return true if the page is present.
+ *****************************************************************************/
+bool GFlashImage::IsPagePresent(unsigned int Page) const
+{
+    if(PageBitmap.isEmpty())
+    {
+        return false;
+    }
+
+    return (PageBitmap[Page / 64] >> (Page % 64)) & 1;
+}
+
+/****************************************************************************
+ * Finds the next present page, in address order.
+ *
+ * \param  Page: In: first page to look at. Out: the present page found.
+ * \param
+ * \param
+ * \return false if there are no more present pages.
+ *****************************************************************************/
+bool GFlashImage::NextPage(unsigned int *Page) const
+{
+    quint64 Word;
+    unsigned int Index = *Page / 64;
+
+    if(PageBitmap.isEmpty() || (*Page >= FLASH_PAGE_COUNT))
+    {
+        return false;
+    }
+
+    // Drop the pages below the starting one.
+    Word = PageBitmap[Index] & (~(quint64)0 << (*Page % 64));
+
+    while(Word == 0)
+    {
+        if(++Index >= (unsigned int)PageBitmap.size())
+        {
+            return false;
+        }
+        Word = PageBitmap[Index];
+    }
+
+    *Page = Index * 64;
+    while(!(Word & 1))
+    {
+        Word >>= 1;
+        (*Page)++;
+    }
+
+    return true;
+}
+
+/****************************************************************************
+ * Gets the contents of a page.
+ *
+ * \param  Page: Page number.
+ * \param
+ * \param
+ * \return Pointer to FLASH_PAGE_SIZE bytes, or NULL if the page is blank.
+ *****************************************************************************/
+const unsigned char *GFlashImage::PageData(unsigned int Page) const
+{
+    if(!IsPagePresent(Page))
+    {
+        return NULL;
+    }
+
+    return (const unsigned char*)Pages.constData() + PageOffsets.value(Page);
+}
+
+/****************************************************************************
+ * Gets the CRC of a whole page. The value is calculated once and kept until
+ * the page is written again.
+ *
+ * \param  Page: Page number.
+ * \param
+ * \param
+ * \return 16 bit CRC of the FLASH_PAGE_SIZE bytes of the page.
+ *****************************************************************************/
+unsigned short GFlashImage::PageCrc(unsigned int Page) const
+{
+    static const unsigned short BlankCrc = Utils::UpdateCrc(0, BlankPage().constData(), FLASH_PAGE_SIZE);
+    unsigned short crc;
+    const unsigned char *Data = PageData(Page);
+
+    if(Data == NULL)
+    {
+        return BlankCrc;
+    }
+
+    if(PageCrcs.contains(Page))
+    {
+        return PageCrcs.value(Page);
+    }
+
+    crc = Utils::UpdateCrc(0, (const char*)Data, FLASH_PAGE_SIZE);
+    PageCrcs.insert(Page, crc);
+
+    return crc;
+}
+
+/****************************************************************************
+ * Sets the CRC of a present page, previously obtained with PageCrc().
+ *
+ * \param  Page: Page number.
+ * \param  crc: CRC of the page.
+ * \param
+ * \return
+ *****************************************************************************/
+void GFlashImage::SetPageCrc(unsigned int Page, unsigned short crc)
+{
+    if(IsPagePresent(Page))
+    {
+        PageCrcs.insert(Page, crc);
+    }
+}
+
+/****************************************************************************
+ * Compares two images page by page.
+ *
+ * \param  Other: Image to compare with.
+ * \param  PageSize: Erase page of the device, a power of two.
+ * \param  ChangedPages: Receives the address of the device pages that
+ *                       differ, in address order.
+ * \return Number of bytes that differ.
+ *****************************************************************************/
+unsigned int GFlashImage::Compare(const GFlashImage &Other, unsigned int PageSize, QVector<unsigned int> *ChangedPages) const
+{
+    const unsigned char *Blank = (const unsigned char*)BlankPage().constData();
+    const unsigned char *Data;
+    const unsigned char *OtherData;
+    unsigned int Page = 0;
+    unsigned int OtherPage = 0;
+    unsigned int ChangedBytes = 0;
+    unsigned int Step = qMin(PageSize, (unsigned int)FLASH_PAGE_SIZE);
+    unsigned int Address;
+    bool More = NextPage(&Page);
+    bool OtherMore = Other.NextPage(&OtherPage);
+
+    ChangedPages->clear();
+
+    // Walk the pages present in either image.
+    while(More || OtherMore)
+    {
+        unsigned int Current = (!OtherMore || (More && (Page < OtherPage))) ? Page : OtherPage;
+
+        Data = PageData(Current);
+        OtherData = Other.PageData(Current);
+
+        if(memcmp(Data ? Data : Blank, OtherData ? OtherData : Blank, FLASH_PAGE_SIZE) != 0)
+        {
+            for(unsigned int i = 0; i < FLASH_PAGE_SIZE; i++)
+            {
+                ChangedBytes += ((Data ? Data[i] : 0xFF) != (OtherData ? OtherData[i] : 0xFF));
+            }
+
+            // Device pages smaller than ours are compared on their own,
+            // larger ones are listed once.
+            for(unsigned int i = 0; i < FLASH_PAGE_SIZE; i += Step)
+            {
+                Address = ((Current << FLASH_PAGE_SHIFT) + i) & ~(PageSize - 1);
+                if((ChangedPages->isEmpty() || (ChangedPages->last() != Address)) &&
+                   (memcmp((Data ? Data : Blank) + i, (OtherData ? OtherData : Blank) + i, Step) != 0))
+                {
+                    ChangedPages->append(Address);
+                }
+            }
+        }
+
+        if(More && (Page == Current))
+        {
+            Page++;
+            More = NextPage(&Page);
+        }
+        if(OtherMore && (OtherPage == Current))
+        {
+            OtherPage++;
+            OtherMore = Other.NextPage(&OtherPage);
+        }
+    }
+
+    return ChangedBytes;
+}
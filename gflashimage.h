@@ -0,0 +1,60 @@
+#ifndef GFLASHIMAGE_H
+#define GFLASHIMAGE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+
+// Host side flash pages. Only the pages written by the image are allocated,
+// every other byte reads back as erased flash (0xFF).
+#define FLASH_PAGE_SHIFT    12
+#define FLASH_PAGE_SIZE     (1 << FLASH_PAGE_SHIFT)
+#define FLASH_PAGE_COUNT    (0x100000000ULL >> FLASH_PAGE_SHIFT)
+
+// Digests of the extended verify.
+typedef enum
+{
+    DIGEST_CRC32 = 1,           // CRC-32 (zlib), 4 bytes, little endian
+    DIGEST_SHA256               // SHA-256, 32 bytes
+}T_DIGEST_ALGORITHM;
+
+class GFlashImage
+{
+public:
+    //  Constructor
+    GFlashImage();
+
+    // Lowest written address and one past the highest written address.
+    unsigned int MinAddress;
+    unsigned int MaxAddress;
+
+    void Clear(void);
+    bool IsEmpty(void) const;
+    void Write(unsigned int Address, const unsigned char *Data, unsigned int Len);
+    void Read(unsigned int Address, unsigned char *Data, unsigned int Len) const;
+    unsigned short CalculateCrc(unsigned int Address, unsigned int Len) const;
+    QByteArray CalculateDigest(T_DIGEST_ALGORITHM Algorithm, unsigned int Address, unsigned int Len) const;
+    static int DigestSize(T_DIGEST_ALGORITHM Algorithm);
+
+    // Page presence map.
+    int PageCount(void) const;
+    bool IsPagePresent(unsigned int Page) const;
+    bool NextPage(unsigned int *Page) const;
+    const unsigned char *PageData(unsigned int Page) const;
+    unsigned short PageCrc(unsigned int Page) const;
+    void SetPageCrc(unsigned int Page, unsigned short crc);
+
+    unsigned int Compare(const GFlashImage &Other, unsigned int PageSize, QVector<unsigned int> *ChangedPages) const;
+
+private:
+    QVector<quint64> PageBitmap;
+    QHash<unsigned int, unsigned int> PageOffsets;
+    QByteArray Pages;
+    // CRC of whole pages, calculated on demand.
+    mutable QHash<unsigned int, unsigned short> PageCrcs;
+
+    unsigned char *AllocatePage(unsigned int Page);
+    void CalculatePageCrcs(unsigned int FirstPage, unsigned int LastPage) const;
+};
+
+#endif // GFLASHIMAGE_H
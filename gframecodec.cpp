@@ -0,0 +1,555 @@
+#include "gframecodec.h"
+
+#include <string.h>
+
+#include "utils.h"
+
+// Longest COBS block: a code byte and 254 data bytes.
+#define COBS_BLOCK_CODE 0xFF
+
+GFrameDecoder::GFrameDecoder(int MaxFrameLen, T_FRAMING Framing)
+    : Ring(FRAME_RING_SIZE, 0), Framing(Framing), Decoded(MaxFrameLen, 0)
+{
+    DroppedFrames = 0;
+    Reset();
+}
+
+/****************************************************************************
+ * Selects the framing of the bytes received from now on. The frame being
+ * decoded is dropped, the bytes still in the buffer are kept.
+ *
+ * \param  Framing: New framing.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GFrameDecoder::SetFraming(T_FRAMING Framing)
+{
+    this->Framing = Framing;
+    StartFrame();
+}
+
+T_FRAMING GFrameDecoder::GetFraming() const
+{
+    return Framing;
+}
+
+/****************************************************************************
+ * Discards the received bytes and the frame being decoded.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GFrameDecoder::Reset()
+{
+    Head = 0;
+    Tail = 0;
+    StartFrame();
+}
+
+/****************************************************************************
+ * Waits for a new frame: after a SOH with DLE framing, right away with COBS.
+ *****************************************************************************/
+void GFrameDecoder::StartFrame()
+{
+    FrameLen = 0;
+    InFrame = (Framing == FRAMING_COBS);
+    FrameDone = false;
+    Broken = false;
+    Escape = false;
+    CobsLeft = 0;
+    CobsZero = false;
+}
+
+/****************************************************************************
+ * Free space of the ring buffer, to read into it without a copy. Written()
+ * must follow with the number of bytes stored.
+ *
+ * \param  Space: Receives the number of bytes that fit, without wrapping.
+ * \param
+ * \param
+ * \return Pointer to the first free byte.
+ *****************************************************************************/
+char *GFrameDecoder::WriteBuffer(int *Space)
+{
+    unsigned int Offset = Head & (FRAME_RING_SIZE - 1);
+    unsigned int Free = FRAME_RING_SIZE - (Head - Tail);
+
+    *Space = qMin(Free, FRAME_RING_SIZE - Offset);
+
+    return Ring.data() + Offset;
+}
+
+/****************************************************************************
+ * Commits the bytes stored at WriteBuffer().
+ *
+ * \param  Len: Number of bytes.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GFrameDecoder::Written(int Len)
+{
+    Head += Len;
+}
+
+/****************************************************************************
+ * Copies received bytes into the ring buffer.
+ *
+ * \param  Data: Bytes, as on the wire.
+ * \param  Len: Number of bytes.
+ * \param
+ * \return Number of bytes taken, less than Len if the buffer is full.
+ *****************************************************************************/
+int GFrameDecoder::Write(const char *Data, int Len)
+{
+    int Taken = 0;
+    int Space;
+    char *Buffer;
+
+    while(Taken < Len)
+    {
+        Buffer = WriteBuffer(&Space);
+        if(Space == 0)
+        {
+            break;
+        }
+        Space = qMin(Space, Len - Taken);
+        memcpy(Buffer, Data + Taken, Space);
+        Written(Space);
+        Taken += Space;
+    }
+
+    return Taken;
+}
+
+/****************************************************************************
+ * Decodes the received bytes up to the end of the next valid frame. The
+ * bytes after it stay in the buffer for the next call.
+ *
+ * \param  Frame: Receives the frame, without the CRC.
+ * \param  Size: Size of Frame. Longer frames are dropped.
+ * \param
+ * \return Frame length, or -1 if no complete frame is left.
+ *****************************************************************************/
+int GFrameDecoder::NextFrame(char *Frame, int Size)
+{
+    const char *Data;
+    unsigned int Len;
+    int Result;
+
+    while(Head != Tail)
+    {
+        // Bytes up to the end of the buffer, the rest on the next pass.
+        Data = Ring.constData() + (Tail & (FRAME_RING_SIZE - 1));
+        Len = qMin(Head - Tail, FRAME_RING_SIZE - (Tail & (FRAME_RING_SIZE - 1)));
+
+        // Stops right after the end of a frame.
+        Tail += (Framing == FRAMING_COBS) ? DecodeCobs(Data, Len) : DecodeDle(Data, Len);
+
+        if(FrameDone)
+        {
+            Result = EndFrame(Frame, Size);
+            StartFrame();
+            if(Result > 0)
+            {
+                return Result;
+            }
+        }
+    }
+
+    return -1;
+}
+
+/****************************************************************************
+ * Decodes DLE framed bytes up to the end of a frame.
+ *
+ * \param  Data: Bytes, as on the wire.
+ * \param  Len: Number of bytes.
+ * \param
+ * \return Number of bytes used.
+ *****************************************************************************/
+unsigned int GFrameDecoder::DecodeDle(const char *Data, unsigned int Len)
+{
+    unsigned int i;
+    unsigned int Run;
+
+    for(i = 0; i < Len;)
+    {
+        if(Escape)
+        {
+            // Data, whatever its value.
+            AppendData(Data + i, 1);
+            Escape = false;
+            i++;
+            continue;
+        }
+
+        if((Data[i] != SOH) && (Data[i] != EOT) && (Data[i] != DLE))
+        {
+            // Data up to the next control byte, at once.
+            Run = Utils::FindFrameByte(Data + i, Len - i);
+            AppendData(Data + i, Run);
+            i += Run;
+            continue;
+        }
+
+        switch(Data[i++])
+        {
+        case SOH:
+            // Start of a frame, even in the middle of another one.
+            StartFrame();
+            InFrame = true;
+            break;
+
+        case DLE:
+            Escape = true;
+            break;
+
+        case EOT:
+            if(InFrame)
+            {
+                FrameDone = true;
+                return i;
+            }
+            break;
+        }
+    }
+
+    return i;
+}
+
+/****************************************************************************
+ * Decodes COBS framed bytes up to the end of a frame. Each block is a code
+ * byte followed by code - 1 data bytes, and stands for the data and a zero,
+ * but for the longest blocks and the last one.
+ *
+ * \param  Data: Bytes, as on the wire.
+ * \param  Len: Number of bytes.
+ * \param
+ * \return Number of bytes used.
+ *****************************************************************************/
+unsigned int GFrameDecoder::DecodeCobs(const char *Data, unsigned int Len)
+{
+    static const char Zero = 0;
+    const char *Next;
+    unsigned int i;
+    unsigned int Run;
+    unsigned char Code;
+
+    for(i = 0; i < Len;)
+    {
+        if(Data[i] == 0)
+        {
+            // End of the frame. A block cut short means lost bytes.
+            if(CobsLeft)
+            {
+                Broken = true;
+            }
+            FrameDone = true;
+            return i + 1;
+        }
+
+        if(CobsLeft == 0)
+        {
+            // Code byte. The zero of the previous block goes first.
+            if(CobsZero)
+            {
+                AppendData(&Zero, 1);
+            }
+            Code = Data[i++];
+            CobsLeft = Code - 1;
+            CobsZero = (Code != COBS_BLOCK_CODE);
+            continue;
+        }
+
+        // Data up to the end of the block, at once. A zero there is the end
+        // of a frame.
+        Run = qMin(CobsLeft, Len - i);
+        Next = (const char*)memchr(Data + i, 0, Run);
+        if(Next)
+        {
+            Run = Next - (Data + i);
+        }
+        AppendData(Data + i, Run);
+        CobsLeft -= Run;
+        i += Run;
+    }
+
+    return i;
+}
+
+/****************************************************************************
+ * Appends data to the frame being decoded. Data outside a frame is ignored.
+ *
+ * \param  Data: Unescaped bytes.
+ * \param  Len: Number of bytes.
+ * \param
+ * \return
+ *****************************************************************************/
+void GFrameDecoder::AppendData(const char *Data, int Len)
+{
+    if(!InFrame || Broken)
+    {
+        return;
+    }
+
+    if((FrameLen + Len) > Decoded.size())
+    {
+        // Too long, dropped at its end.
+        Broken = true;
+        return;
+    }
+
+    memcpy(Decoded.data() + FrameLen, Data, Len);
+    FrameLen += Len;
+}
+
+/****************************************************************************
+ * Checks the frame just decoded.
+ *
+ * \param  Frame: Receives the frame, without the CRC.
+ * \param  Size: Size of Frame.
+ * \param
+ * \return Frame length, or -1 if the frame is dropped.
+ *****************************************************************************/
+int GFrameDecoder::EndFrame(char *Frame, int Size)
+{
+    int Len = FrameLen - 2;
+    unsigned short crc;
+
+    if(!Broken && (Len > 0) && (Len <= Size))
+    {
+        crc = ((unsigned char)Decoded[FrameLen - 1] << 8) | (unsigned char)Decoded[FrameLen - 2];
+        if(Utils::CalculateCrc(Decoded.data(), Len) == crc)
+        {
+            memcpy(Frame, Decoded.constData(), Len);
+            return Len;
+        }
+    }
+
+    if(Broken || (FrameLen > 0))
+    {
+        // Back to back delimiters are not a frame, nothing is lost.
+        DroppedFrames++;
+    }
+    return -1;
+}
+
+GFrameEncoder::GFrameEncoder(int Size, T_FRAMING Framing)
+    : Packet(Size, 0), Framing(Framing)
+{
+    Begin();
+}
+
+/****************************************************************************
+ * Selects the framing of the next frames.
+ *
+ * \param  Framing: New framing.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GFrameEncoder::SetFraming(T_FRAMING Framing)
+{
+    this->Framing = Framing;
+    Begin();
+}
+
+T_FRAMING GFrameEncoder::GetFraming() const
+{
+    return Framing;
+}
+
+/****************************************************************************
+ * Changes the longest packet, SOH to EOT. The frame being built is dropped.
+ *
+ * \param  Size: Packet size.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GFrameEncoder::SetSize(int Size)
+{
+    Packet.resize(Size);
+    Begin();
+}
+
+int GFrameEncoder::GetSize() const
+{
+    return Packet.size();
+}
+
+/****************************************************************************
+ * Starts a new frame. The previous packet is discarded.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GFrameEncoder::Begin()
+{
+    // With COBS, room for the code of the first block.
+    CodePos = 0;
+    Code = 1;
+    if(Framing == FRAMING_DLE)
+    {
+        Packet.data()[0] = SOH;
+    }
+    PacketLen = 1;
+    crc = 0;
+}
+
+/****************************************************************************
+ * Appends frame data, escaped, and adds it to the CRC.
+ *
+ * \param  Data: Unescaped bytes.
+ * \param  Len: Number of bytes.
+ * \param
+ * \return false if the data does not fit. Nothing is appended then.
+ *****************************************************************************/
+bool GFrameEncoder::Append(const char *Data, int Len)
+{
+    int Room = Packet.size() - PacketLen - FRAME_TRAILER_LEN;
+
+    if(Framing == FRAMING_COBS)
+    {
+        // One code byte per block, at most.
+        if((Len + (Len / (COBS_BLOCK_CODE - 1)) + 1) > Room)
+        {
+            return false;
+        }
+        crc = Utils::UpdateCrc(crc, Data, Len);
+        AppendCobs(Data, Len);
+        return true;
+    }
+
+    // Exact size only when the worst case does not fit.
+    if(((2 * Len) > Room) && (static_cast<int>(Utils::EscapedLength(Data, Len)) > Room))
+    {
+        return false;
+    }
+
+    crc = Utils::UpdateCrc(crc, Data, Len);
+    PacketLen += Utils::EscapeFrame(Data, Len, Packet.data() + PacketLen);
+
+    return true;
+}
+
+/****************************************************************************
+ * Current end of the frame. Data appended after it can be taken back with
+ * Rewind(), as long as Finish() has not been called.
+ *****************************************************************************/
+T_FRAME_MARK GFrameEncoder::Mark() const
+{
+    T_FRAME_MARK Result;
+
+    Result.PacketLen = PacketLen;
+    Result.crc = crc;
+    Result.CodePos = CodePos;
+    Result.Code = Code;
+
+    return Result;
+}
+
+/****************************************************************************
+ * Drops the data appended after a Mark(). A COBS block closed since then is
+ * open again, its code is written when it closes.
+ *
+ * \param  Mark: Position returned by Mark() for this frame.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GFrameEncoder::Rewind(const T_FRAME_MARK &Mark)
+{
+    PacketLen = Mark.PacketLen;
+    crc = Mark.crc;
+    CodePos = Mark.CodePos;
+    Code = Mark.Code;
+}
+
+/****************************************************************************
+ * COBS encodes data. Runs without zeros are copied at once; a zero, or a
+ * block of 254 bytes, closes the block being written.
+ *****************************************************************************/
+void GFrameEncoder::AppendCobs(const char *Data, int Len)
+{
+    char *Out = Packet.data();
+    const char *Zero;
+    int Run;
+
+    while(Len > 0)
+    {
+        Run = qMin(Len, COBS_BLOCK_CODE - Code);
+        Zero = (const char*)memchr(Data, 0, Run);
+        if(Zero)
+        {
+            Run = Zero - Data;
+        }
+
+        memcpy(Out + PacketLen, Data, Run);
+        PacketLen += Run;
+        Code += Run;
+        Data += Run;
+        Len -= Run;
+
+        if(Zero || (Code == COBS_BLOCK_CODE))
+        {
+            // Close the block, its code stands for the zero.
+            Out[CodePos] = static_cast<char>(Code);
+            CodePos = PacketLen++;
+            Code = 1;
+            if(Zero)
+            {
+                Data++;
+                Len--;
+            }
+        }
+    }
+}
+
+/****************************************************************************
+ * Ends the frame: CRC and EOT, or CRC and zero with COBS.
+ *
+ * \param
+ * \param
+ * \param
+ * \return Packet length.
+ *****************************************************************************/
+int GFrameEncoder::Finish()
+{
+    char Crc[2];
+
+    Crc[0] = static_cast<char>(crc);
+    Crc[1] = static_cast<char>(crc >> 8);
+
+    if(Framing == FRAMING_COBS)
+    {
+        AppendCobs(Crc, 2);
+        Packet.data()[CodePos] = static_cast<char>(Code);
+        Packet.data()[PacketLen++] = 0;
+        return PacketLen;
+    }
+
+    PacketLen += Utils::EscapeFrame(Crc, 2, Packet.data() + PacketLen);
+    Packet.data()[PacketLen++] = EOT;
+
+    return PacketLen;
+}
+
+/****************************************************************************
+ * The packet, SOH to EOT once finished.
+ *****************************************************************************/
+const char *GFrameEncoder::Data() const
+{
+    return Packet.constData();
+}
+
+int GFrameEncoder::Length() const
+{
+    return PacketLen;
+}
@@ -0,0 +1,117 @@
+#ifndef GFRAMECODEC_H
+#define GFRAMECODEC_H
+
+#include <QByteArray>
+
+// Frame control characters
+#define SOH 01
+#define EOT 04
+#define DLE 16
+
+// Bytes of received data held by a decoder. Power of two.
+#define FRAME_RING_SIZE 4096
+
+// Bytes after the frame data: CRC, both bytes escaped, and EOT.
+#define FRAME_TRAILER_LEN 5
+
+// Framing of the frames on the wire.
+typedef enum
+{
+    FRAMING_DLE,        // SOH, data with a DLE before every control byte, EOT.
+    FRAMING_COBS        // Consistent overhead byte stuffing, ended by a zero.
+}T_FRAMING;
+
+// Position in a frame being encoded, to go back to.
+typedef struct
+{
+    int PacketLen;
+    unsigned short crc;
+    int CodePos;
+    int Code;
+}T_FRAME_MARK;
+
+// Encoder of the frames of the bootloader protocol. Data is escaped straight
+// into the packet as it is appended, and the CRC is updated with it; the
+// packet is sent from the encoder buffer as it is. Data that would not fit,
+// escaped, in the packet is refused, so a frame never overflows.
+class GFrameEncoder
+{
+public:
+    //  Constructor. Size is the longest packet, SOH to EOT.
+    explicit GFrameEncoder(int Size, T_FRAMING Framing = FRAMING_DLE);
+
+    void SetFraming(T_FRAMING Framing);
+    T_FRAMING GetFraming(void) const;
+    void SetSize(int Size);
+    int GetSize(void) const;
+    void Begin(void);
+    bool Append(const char *Data, int Len);
+    T_FRAME_MARK Mark(void) const;
+    void Rewind(const T_FRAME_MARK &Mark);
+    int Finish(void);
+    const char *Data(void) const;
+    int Length(void) const;
+
+private:
+    QByteArray Packet;
+    int PacketLen;
+    unsigned short crc;
+    T_FRAMING Framing;
+    // COBS block being written: position of its code byte, and the code.
+    int CodePos;
+    int Code;
+
+    void AppendCobs(const char *Data, int Len);
+};
+
+// Incremental decoder of the frames of the bootloader protocol. Received bytes
+// go into a ring buffer, and the frames are taken out one at a time as they
+// complete; a frame cut by the end of a read is finished by the next one.
+// With DLE framing, bytes outside a frame are ignored and a SOH always starts
+// a new frame; with COBS, every zero ends a frame. Either way the decoder gets
+// back in step after a corrupt or truncated frame.
+class GFrameDecoder
+{
+public:
+    //  Constructor. MaxFrameLen is the longest frame accepted, unescaped and
+    //  CRC included.
+    explicit GFrameDecoder(int MaxFrameLen, T_FRAMING Framing = FRAMING_DLE);
+
+    // Frames dropped for a bad CRC or for being too long.
+    unsigned int DroppedFrames;
+
+    void SetFraming(T_FRAMING Framing);
+    T_FRAMING GetFraming(void) const;
+    char *WriteBuffer(int *Space);
+    void Written(int Len);
+    int Write(const char *Data, int Len);
+    int NextFrame(char *Frame, int Size);
+    void Reset(void);
+
+private:
+    // Received bytes, from Tail up to Head. Both run freely and are taken
+    // modulo FRAME_RING_SIZE.
+    QByteArray Ring;
+    unsigned int Head;
+    unsigned int Tail;
+
+    T_FRAMING Framing;
+    // Frame being decoded, unescaped.
+    QByteArray Decoded;
+    int FrameLen;
+    bool InFrame;
+    bool FrameDone;
+    bool Broken;                // Too long or cut short, dropped at its end.
+    bool Escape;
+    // COBS block being read: data bytes left, and whether a zero follows.
+    unsigned int CobsLeft;
+    bool CobsZero;
+
+    void StartFrame(void);
+    unsigned int DecodeDle(const char *Data, unsigned int Len);
+    unsigned int DecodeCobs(const char *Data, unsigned int Len);
+    void AppendData(const char *Data, int Len);
+    int EndFrame(char *Frame, int Size);
+};
+
+#endif // GFRAMECODEC_H
@@ -1,41 +1,105 @@
 #include "ghexmanager.h"
 
+#include "gbootloader.h"
+#include "gimageloader.h"
+#include "ghexstream.h"
 #include "utils.h"
 
+#include <algorithm>
+
+#include <QCryptographicHash>
 #include <QDir>
+#include <QFileSystemWatcher>
 #include <QFileDialog>
+#include <QInputDialog>
+#include <QSaveFile>
+#include <QThread>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
 
 #include <QDebug>
 
-// Virtual Flash.
-#define KB (1024)
-#define MB (KB*KB)
+// Records synthesized for images that are not Intel HEX.
+#define HEX_RECORD_DATA_LEN 16
+// Default load address offered for raw binaries (PIC32MX program flash).
+#define BIN_DEFAULT_BASE    0x1D000000
+// Hex files larger than this are streamed rather than loaded.
+#define STREAM_THRESHOLD    (64 * 1024 * 1024)
+// Time a watched file must stay unchanged before it is reloaded.
+#define WATCH_SETTLE_MS     300
+// Smallest piece of hex file handed to a parser thread.
+#define PARSE_CHUNK_MIN     (1024 * 1024)
+// Piece of a watched hex file decoded again when a build changes it.
+#define REPARSE_CHUNK_LEN   (64 * 1024)
 
-// 5 MB flash
-static unsigned char VirtualFlash[5*MB];
+// Pre-parsed image cache, stored next to the hex file.
+#define IMAGE_CACHE_SUFFIX  ".gcache"
+#define IMAGE_CACHE_MAGIC   "GHXC"
+#define IMAGE_CACHE_VERSION 3
+#define ALIGN4(x)           (((x) + 3) & ~3ULL)
 
-#define BOOT_SECTOR_BEGIN 0x9FC00000
-#define APPLICATION_START 0x9D000000
-#define PA_TO_VFA(x)	(x-APPLICATION_START)
-#define PA_TO_KVA0(x)   (x|0x80000000)
+typedef struct
+{
+    char Magic[4];
+    unsigned int Version;
+    qint64 SourceSize;
+    qint64 SourceModified;          // ms since epoch
+    unsigned char SourceHash[20];   // SHA-1 of the source file
+    unsigned int RecordCount;
+    unsigned int RecordBytes;
+    unsigned int SegmentCount;
+    unsigned int ImageBytes;
+    unsigned int PageCount;
+    unsigned int BaseAddress;       // Load address of raw binaries
+    unsigned char ProfileKey[20];   // GDeviceProfile::Key() the image was built for
+    // Followed by, each section padded to 4 bytes:
+    //  (RecordCount + 1) record offsets
+    //  RecordBytes of decoded records
+    //  SegmentCount T_HEX_SEGMENT
+    //  ImageBytes of segment data
+    //  PageCount T_CACHE_PAGE
+}T_CACHE_HEADER;
 
-#define DATA_RECORD 		0
-#define END_OF_FILE_RECORD 	1
-#define EXT_SEG_ADRS_RECORD 2
-#define EXT_LIN_ADRS_RECORD 4
+typedef struct
+{
+    unsigned int Page;
+    unsigned int crc;
+}T_CACHE_PAGE;
 
 
 GHexManager::GHexManager(QObject *parent) : QObject(parent)
 {
-    HexFilePtr = NULL;
+    HexTotalLines = 0;
+    HexCurrLineNo = 0;
+    ImageGeneration = 0;
+    GenerationCounter = 0;
+    ImageBaseAddress = 0;
+    StreamMode = false;
+    ParseThreads = 0;
+    BackgroundAnalysis = true;
+    VerifyInfo.Generation = 0;
+    Analysis.Generation = 0;
+    LinkFormat.Framing = FRAMING_DLE;
+    LinkFormat.PacketLen = TX_PACKET_LEN;
+    LinkFormat.Payload = PAYLOAD_HEX_RECORDS;
+    LinkFormat.Sequenced = false;
+    ProgramCrc.Generation = 0;
+    ProgramCrc.Done = false;
+    CacheFile = NULL;
+    HexStream = NULL;
+    StreamRecordLen = 0;
+    Watcher = NULL;
+
+    WatchTimer.setSingleShot(true);
+    WatchTimer.setInterval(WATCH_SETTLE_MS);
+    connect(&WatchTimer, SIGNAL(timeout()), this, SLOT(ReloadWatchedFiles()));
+
+    connect(&AnalysisWatcher, SIGNAL(finished()), this, SLOT(OnAnalysisFinished()));
 }
 
 GHexManager::~GHexManager()
 {
-    if(HexFilePtr)
-    {
-        HexFilePtr->close();
-    }
+    ReleaseImage();
 }
 
 /****************************************************************************
@@ -48,17 +112,29 @@ GHexManager::~GHexManager()
  *****************************************************************************/
 bool GHexManager::ResetHexFilePointer()
 {
-    // Reset file pointer.
-    if(HexFilePtr == NULL)
+    // Reset record pointer.
+    StreamRecordLen = 0;
+    if(HexStream)
+    {
+        HexCurrLineNo = 0;
+        if(!HexStream->Rewind())
+        {
+            return false;
+        }
+    }
+    else if(HexRecordOffsets.isEmpty())
     {
         return false;
     }
     else
     {
-        HexFilePtr->seek(0);
         HexCurrLineNo = 0;
-        return true;
     }
+
+    // The records are about to be sent from the start.
+    StartProgramCrc();
+
+    return true;
 }
 
 /****************************************************************************
@@ -71,158 +147,2083 @@ bool GHexManager::ResetHexFilePointer()
  *****************************************************************************/
 bool GHexManager::LoadHexFile()
 {
-    QByteArray data;
+    QStringList Paths;
+    QVector<unsigned int> BaseAddresses;
 
-    HexFilePath = QFileDialog::getOpenFileName(NULL,"",QDir::homePath(),"Hex File (*.hex)");
+    QString Base;
+    unsigned int BaseAddress;
+    bool Ok = true;
 
-    if (HexFilePath.isEmpty()){
+    // Several files (application, configuration, calibration...) are merged
+    // into one image.
+    Paths = QFileDialog::getOpenFileNames(NULL,"",QDir::homePath(),
+                                          "Firmware (*.hex *.elf *.bin *.srec *.s19 *.s28 *.s37 *.mot);;"
+                                          "Hex File (*.hex);;ELF File (*.elf);;Binary File (*.bin);;"
+                                          "S-Record File (*.srec *.s19 *.s28 *.s37 *.mot)");
+
+    if (Paths.isEmpty()){
         return false;
     }
 
-    HexFilePtr = new QFile(HexFilePath);
+    foreach (const QString &Path, Paths){
+        BaseAddress = 0;
+        if (QFileInfo(Path).suffix().toLower() == "bin"){
+            // A raw binary carries no address.
+            Base = QInputDialog::getText(NULL, QFileInfo(Path).fileName(), "Dirección base", QLineEdit::Normal,
+                                         QString("0x%1").arg(BIN_DEFAULT_BASE, 8, 16, QChar('0')), &Ok);
+            BaseAddress = Base.toUInt(&Ok, 0);
+            if (!Ok){
+                return false;
+            }
+        }
+        BaseAddresses.append(BaseAddress);
+    }
+
+    if (Paths.size() == 1){
+        return LoadHexFile(Paths.first(), BaseAddresses.first());
+    }
+
+    return LoadHexFiles(Paths, BaseAddresses);
+}
+
+/****************************************************************************
+ * Loads an image file (Intel HEX, ELF, raw binary or S-records), from its
+ * image cache when the cache is still valid.
+ *
+ * \param  Path: Image file path.
+ * \param  BaseAddress: Load address, used by raw binaries only.
+ * \param
+ * \return  true if the image loads successfully
+ *****************************************************************************/
+bool GHexManager::LoadHexFile(const QString &Path, unsigned int BaseAddress)
+{
+    QFileInfo Info(Path);
+    QFile HexFile(Path);
+    QCryptographicHash Hash(QCryptographicHash::Sha1);
+    const unsigned char *Map = NULL;
+    qint64 Size;
 
-    if (HexFilePtr->open(QIODevice::ReadOnly | QIODevice::Text)){
-        HexTotalLines = 0;
+    ImageBaseAddress = BaseAddress;
 
-        while (!HexFilePtr->atEnd()) {
-            data = HexFilePtr->readLine();
-            // qInfo() << data;
-            HexTotalLines++;
+    if ((StreamMode || (Info.size() > STREAM_THRESHOLD)) &&
+            (Info.suffix().toLower() == "hex") && LoadHexStream(Path)){
+        // Streamed. Nothing is kept in memory but the verify result.
+    } else if (!LoadImageCache(Path, Info, QByteArray())){
+        // No cache written for this very file (same size and time stamp).
+        if (HexFile.open(QIODevice::ReadOnly)){
+            Size = HexFile.size();
+            if (Size > 0){
+                Map = HexFile.map(0, Size);
+            }
         }
 
-        HexCurrLineNo = 0;
-        //        qInfo() << "Hex" << HexTotalLines << "Lines";
-    } else {
-        return false;
+        if (Map == NULL){
+            ReleaseImage();
+            return false;
+        }
+
+        Hash.addData((const char*)Map, Size);
+
+        if (LoadImageCache(Path, Info, Hash.result())){
+            // Same contents under a new time stamp. Refresh the cache header.
+            SaveImageCache(Path, Info, Hash.result());
+        } else {
+            // The file is read exactly once. Programming and verification are
+            // served from the parsed image from now on.
+            ReleaseImage();
+            if (!ParseImage(Path, Map, Size)){
+                ReleaseImage();
+                return false;
+            }
+            // Written along with the page CRCs, once the analysis is done.
+            PendingCachePath = Path;
+            PendingCacheInfo = Info;
+            PendingCacheHash = Hash.result();
+        }
     }
 
+    CommitImage(QStringList() << Path, QVector<unsigned int>() << BaseAddress);
+    //        qInfo() << "Hex" << HexTotalLines << "Records";
+
     return true;
 }
 
 /****************************************************************************
- * Gets next hex record from the hex file
+ * Loads several image files and merges them into one image. Files may
+ * overlap as long as they agree on the overlapping bytes. The merged image
+ * is programmed as a single address ordered record stream.
  *
- * \param  HexRec: Pointer to HexRec.
- * \param  BuffLen: Buffer Length
+ * \param  Paths: Image file paths.
+ * \param  BaseAddresses: Load address of each file, used by raw binaries only.
  * \param
- * \return Length of the hex record in bytes.
+ * \return  true if every file loads and no two files conflict
  *****************************************************************************/
-int GHexManager::GetNextHexRecord(char *HexRec, unsigned int BuffLen)
+bool GHexManager::LoadHexFiles(const QStringList &Paths, const QVector<unsigned int> &BaseAddresses)
 {
-    int len = 0;
-    QByteArray Ascii;
-    QByteArray Hex;
+    QVector<T_HEX_SEGMENT> Runs;
+    QVector<int> Owners;
+    QVector<int> Order;
+    QByteArray Merged;
+    T_HEX_SEGMENT Run;
+    T_HEX_OVERLAP Overlap;
+    quint64 ReachEnd = 0;
+    quint64 End;
+    int Reach = -1;
+    bool Conflict = false;
 
-    if (!HexFilePtr->atEnd()){
-        Ascii = HexFilePtr->readLine(BuffLen);
+    HexOverlaps.clear();
 
-        if(Ascii.at(0) != ':')
-        {
-            // Not a valid hex record.
-            return 0;
+    for (int i = 0; i < Paths.size(); i++){
+        GHexManager Part;
+
+        Part.SetDeviceProfile(Profile);
+        // Short lived, nothing to gain from a worker.
+        Part.BackgroundAnalysis = false;
+        if (!Part.LoadHexFile(Paths[i], (i < BaseAddresses.size()) ? BaseAddresses[i] : 0)){
+            qWarning() << Paths[i] << "failed to load";
+            ReleaseImage();
+            return false;
+        }
+
+        if (Part.HexStream){
+            // Nothing kept in memory to merge.
+            qWarning() << Paths[i] << "is too large to merge";
+            ReleaseImage();
+            return false;
+        }
+
+        // Segments of one file are sorted and never overlap.
+        for (int j = 0; j < Part.HexSegments.size(); j++){
+            Run = Part.HexSegments[j];
+            Run.Offset += Merged.size();
+            Runs.append(Run);
+            Owners.append(i);
         }
+        Merged.append(Part.ImageData);
+    }
 
-        len = Ascii.length();
+    // Interval sweep in address order. Each segment is checked against the
+    // one reaching furthest so far. Every byte covered twice ends up in at
+    // least one reported overlap.
+    Order.resize(Runs.size());
+    for (int i = 0; i < Order.size(); i++){
+        Order[i] = i;
+    }
+    std::sort(Order.begin(), Order.end(),
+              [&Runs](int a, int b) { return Runs[a].Address < Runs[b].Address; });
+
+    foreach (int i, Order){
+        End = (quint64)Runs[i].Address + Runs[i].Length;
 
-        // Convert rest to hex.
-        Hex = QByteArray::fromHex(Ascii.mid(1,len - 2));
+        if ((Reach >= 0) && (Runs[i].Address < ReachEnd)){
+            Overlap.Address = Runs[i].Address;
+            Overlap.Length = qMin(End, ReachEnd) - Runs[i].Address;
+            Overlap.File = Owners[Reach];
+            Overlap.OtherFile = Owners[i];
+            Overlap.Conflict = memcmp(Merged.constData() + Runs[Reach].Offset + (Overlap.Address - Runs[Reach].Address),
+                                      Merged.constData() + Runs[i].Offset,
+                                      Overlap.Length) != 0;
+            HexOverlaps.append(Overlap);
+
+            if (Overlap.Conflict){
+                qWarning() << Paths[Overlap.File] << "and" << Paths[Overlap.OtherFile]
+                           << "conflict at" << QString::number(Overlap.Address, 16);
+                Conflict = true;
+            }
+        }
 
-        len = Hex.length();
-        for(int i=0; i < len; i++)
-            HexRec[i] = Hex.at(i);
+        if ((Reach < 0) || (End > ReachEnd)){
+            Reach = i;
+            ReachEnd = End;
+        }
+    }
 
-        HexCurrLineNo++;
+    ReleaseImage();
 
-        // qInfo() << Ascii << HexCurrLineNo;
+    if (Conflict){
+        return false;
     }
-    return len;
+
+    BuildSegments(Runs, Merged.constData());
+    BuildHexRecords();
+    BuildVirtualFlash();
+    PruneHexRecords();
+
+    CommitImage(Paths, BaseAddresses);
+
+    return true;
 }
 
 /****************************************************************************
- * Verifies flash
+ * Makes the image just built the current one.
  *
- * \param  StartAddress: Pointer to program start address
- * \param  ProgLen: Pointer to Program length in bytes
- * \param  crc : Pointer to CRC
+ * \param  Paths: Image file paths.
+ * \param  BaseAddresses: Load address of each file.
+ * \param
  * \return
  *****************************************************************************/
-void GHexManager::VerifyFlash(unsigned int *StartAdress, unsigned int *ProgLen, unsigned short *crc)
+void GHexManager::CommitImage(const QStringList &Paths, const QVector<unsigned int> &BaseAddresses)
 {
-    int HexRecLen;
-    char HexRec[255];
-    T_HEX_RECORD HexRecordSt;
-    unsigned int VirtualFlashAdrs;
-    unsigned int ProgAddress;
+    // New image. Anything derived from the previous one is stale.
+    GenerationCounter++;
+    if(GenerationCounter == 0)
+    {
+        GenerationCounter++;
+    }
+    ImageGeneration = GenerationCounter;
 
-    // Virtual Flash Erase (Set all bytes to 0xFF)
-    memset((void*)VirtualFlash, 0xFF, sizeof(VirtualFlash));
+    if (HexStream){
+        // The verify values were calculated by the stream scan.
+        VerifyInfo.Generation = ImageGeneration;
+    } else {
+        HexTotalLines = HexRecordOffsets.size() - 1;
+    }
 
+    if (Watcher && (Paths != HexFilePaths)){
+        if (!Watcher->files().isEmpty()){
+            Watcher->removePaths(Watcher->files());
+        }
+        Watcher->addPaths(Paths);
+    }
 
-    // Start decoding the hex file and write into virtual flash
-    // Reset file pointer.
-    HexFilePtr->seek(0);
+    HexFilePaths = Paths;
+    HexBaseAddresses = BaseAddresses;
+    HexCurrLineNo = 0;
 
-    // Reset max address and min address.
-    HexRecordSt.MaxAddress = 0;
-    HexRecordSt.MinAddress = 0xFFFFFFFF;
+    if (!HexStream){
+        StartAnalysis();
+    }
+}
 
-    while((HexRecLen = GetNextHexRecord(HexRec, 255)) != 0)
-    {
-        HexRecordSt.RecDataLen = HexRec[0];
-        HexRecordSt.RecType = HexRec[3];
-        HexRecordSt.Data = (unsigned char*)&HexRec[4];
+/****************************************************************************
+ * Whether two links send the same bytes for the same frames.
+ *****************************************************************************/
+static bool SameLinkFormat(const T_LINK_FORMAT &a, const T_LINK_FORMAT &b)
+{
+    return (a.Framing == b.Framing) && (a.PacketLen == b.PacketLen) && (a.Payload == b.Payload)
+           && (a.Sequenced == b.Sequenced);
+}
 
-        switch(HexRecordSt.RecType)
-        {
+/****************************************************************************
+ * Analyzes an image: verify range and CRC, page map and the size of the
+ * program frames. Runs on a worker thread, on copies of the image
+ * (they share the data, nothing is duplicated).
+ *
+ * \param  Generation: Image generation.
+ * \param  Image: Flash image.
+ * \param  Records: Records sent to the device, back to back.
+ * \param  Offsets: Offset of each record, plus one past the last record.
+ * \param  RowSize: Flash row of the device.
+ * \param  Link: Link the frames are sent on.
+ * \return Analysis.
+ *****************************************************************************/
+static T_IMAGE_ANALYSIS AnalyzeImage(unsigned int Generation, GFlashImage Image,
+                                     QByteArray Records, QVector<unsigned int> Offsets,
+                                     unsigned int RowSize, T_LINK_FORMAT Link)
+{
+    T_IMAGE_ANALYSIS Result;
+    GFrameEncoder Encoder(Link.PacketLen, Link.Framing);
+    GRecordPacker Packer(RowSize, Link.Payload);
+    char Cmd;
+    char Header[3];
+    int HeaderLen;
+    unsigned int MinAddress;
+    unsigned int MaxAddress;
+    unsigned int Page = 0;
 
-        case DATA_RECORD:  //Record Type 00, data record.
-            HexRecordSt.Address = (((HexRec[1] << 8) & 0x0000FF00) | (HexRec[2] & 0x000000FF)) & (0x0000FFFF);
-            HexRecordSt.Address = HexRecordSt.Address + HexRecordSt.ExtLinAddress + HexRecordSt.ExtSegAddress;
+    Result.Generation = Generation;
+    Result.Link = Link;
 
-            ProgAddress = PA_TO_KVA0(HexRecordSt.Address);
+    // Verify range and CRC, same as VerifyFlash().
+    if(Image.IsEmpty())
+    {
+        Result.StartAddress = 0;
+        Result.ProgLen = 0;
+        Result.crc = 0;
+    }
+    else
+    {
+        MinAddress = Image.MinAddress;
+        MaxAddress = Image.MaxAddress;
 
-            if(ProgAddress < BOOT_SECTOR_BEGIN) // Make sure we are not writing boot sector.
-            {
-                if(HexRecordSt.MaxAddress < (ProgAddress + HexRecordSt.RecDataLen))
-                {
-                    HexRecordSt.MaxAddress = ProgAddress + HexRecordSt.RecDataLen;
-                }
+        MinAddress -= MinAddress % 4;
+        MaxAddress += MaxAddress % 4;
 
-                if(HexRecordSt.MinAddress > ProgAddress)
-                {
-                    HexRecordSt.MinAddress = ProgAddress;
-                }
+        Result.ProgLen = MaxAddress - MinAddress;
+        Result.StartAddress = MinAddress;
+        Result.crc = Image.CalculateCrc(MinAddress, Result.ProgLen);
+    }
 
-                VirtualFlashAdrs = PA_TO_VFA(ProgAddress); // Program address to local virtual flash address
+    // Page map.
+    while(Image.NextPage(&Page))
+    {
+        Result.Pages.append(Page);
+        Result.PageCrcs.append(Image.PageCrc(Page));
+        Page++;
+    }
 
-                memcpy((void *)&VirtualFlash[VirtualFlashAdrs], HexRecordSt.Data, HexRecordSt.RecDataLen);
-            }
+    // Program frames, as GBootLoader::SendCommand() builds them, or
+    // GBootLoader::FillWindow() when they are sequenced.
+    Result.WireBytes = 0;
+    Cmd = (Link.Payload == PAYLOAD_RUNS) ? PROGRAM_RUNS : PROGRAM_FLASH;
+    if(Link.Sequenced)
+    {
+        Header[0] = PROGRAM_SEQ;
+        Header[1] = 0;
+        Header[2] = Cmd | PROGRAM_SEQ_START;
+        HeaderLen = 3;
+    }
+    else
+    {
+        Header[0] = Cmd;
+        HeaderLen = 1;
+    }
+    for(int i = 0;;)
+    {
+        for(; Packer.NeedsRecords() && ((i + 1) < Offsets.size()); i++)
+        {
+            Packer.AddRecord((const unsigned char*)Records.constData() + Offsets[i]);
+        }
+        if(Packer.IsEmpty() && (Result.WireBytes != 0))
+        {
             break;
+        }
 
-        case EXT_SEG_ADRS_RECORD:  // Record Type 02, defines 4 to 19 of the data address.
-            HexRecordSt.ExtSegAddress = ((HexRecordSt.Data[0] << 16) & 0x00FF0000) | ((HexRecordSt.Data[1] << 8) & 0x0000FF00);
-            HexRecordSt.ExtLinAddress = 0;
+        // The first frame is sent even without data.
+        Encoder.Begin();
+        Encoder.Append(Header, HeaderLen);
+        if(!Packer.IsEmpty() && !Packer.Pack(&Encoder))
+        {
             break;
+        }
+        Result.WireBytes += Encoder.Finish();
 
-        case EXT_LIN_ADRS_RECORD:
-            HexRecordSt.ExtLinAddress = ((HexRecordSt.Data[0] << 24) & 0xFF000000) | ((HexRecordSt.Data[1] << 16) & 0x00FF0000);
-            HexRecordSt.ExtSegAddress = 0;
-            break;
+        // Sequence numbers escape like data.
+        if(Link.Sequenced)
+        {
+            Header[1]++;
+            Header[2] &= ~PROGRAM_SEQ_START;
+        }
+    }
 
+    return Result;
+}
 
-        case END_OF_FILE_RECORD:  //Record Type 01
-        default:
-            HexRecordSt.ExtSegAddress = 0;
-            HexRecordSt.ExtLinAddress = 0;
-            break;
+/****************************************************************************
+ * Starts the analysis of the image just loaded.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::StartAnalysis()
+{
+    if (BackgroundAnalysis){
+        AnalysisWatcher.setFuture(QtConcurrent::run(AnalyzeImage, ImageGeneration, VirtualFlash,
+                                                    HexRecords, HexRecordOffsets, Profile.RowSize, LinkFormat));
+    } else {
+        ApplyAnalysis(AnalyzeImage(ImageGeneration, VirtualFlash, HexRecords, HexRecordOffsets, Profile.RowSize, LinkFormat));
+    }
+}
+
+/****************************************************************************
+ * The worker is done.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::OnAnalysisFinished()
+{
+    ApplyAnalysis(AnalysisWatcher.result());
+}
+
+/****************************************************************************
+ * Takes the result of an analysis, unless the image changed meanwhile.
+ *
+ * \param  Result: Analysis.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::ApplyAnalysis(const T_IMAGE_ANALYSIS &Result)
+{
+    if ((Result.Generation != ImageGeneration) || !SameLinkFormat(Result.Link, LinkFormat)){
+        // Stale.
+        return;
+    }
+    if ((Result.Generation == Analysis.Generation) && SameLinkFormat(Result.Link, Analysis.Link)){
+        // Taken already.
+        return;
+    }
+
+    Analysis = Result;
+
+    VerifyInfo.Generation = Result.Generation;
+    VerifyInfo.StartAddress = Result.StartAddress;
+    VerifyInfo.ProgLen = Result.ProgLen;
+    VerifyInfo.crc = Result.crc;
+
+    for (int i = 0; i < Result.Pages.size(); i++){
+        VirtualFlash.SetPageCrc(Result.Pages[i], Result.PageCrcs[i]);
+    }
+
+    if (!PendingCachePath.isEmpty()){
+        // Every page CRC is known now, saving is pure I/O.
+        SaveImageCache(PendingCachePath, PendingCacheInfo, PendingCacheHash);
+        PendingCachePath.clear();
+    }
+
+    emit ImageAnalysisReady(Result.Pages.size(), Result.WireBytes);
+}
+
+/****************************************************************************
+ * Loads the current files again.
+ *
+ * \param
+ * \param
+ * \param
+ * \return  true if the files load successfully
+ *****************************************************************************/
+bool GHexManager::ReloadImage()
+{
+    // Copies, the load replaces them.
+    QStringList Paths = HexFilePaths;
+    QVector<unsigned int> BaseAddresses = HexBaseAddresses;
+
+    if (Paths.size() == 1){
+        return LoadHexFile(Paths.first(), BaseAddresses.first());
+    }
+
+    return LoadHexFiles(Paths, BaseAddresses);
+}
+
+/****************************************************************************
+ * Selects the memory map of the target device. The loaded image, if any, is
+ * rebuilt for the new map.
+ *
+ * \param  DeviceProfile: Memory map of the device.
+ * \param
+ * \param
+ * \return  false if the image had to be rebuilt and could not be loaded
+ *****************************************************************************/
+bool GHexManager::SetDeviceProfile(const GDeviceProfile &DeviceProfile)
+{
+    Profile = DeviceProfile;
+
+    if (ImageGeneration == 0){
+        // Nothing loaded.
+        return true;
+    }
+
+    return ReloadImage();
+}
+
+/****************************************************************************
+ * Gets the memory map of the target device.
+ *
+ * \param
+ * \param
+ * \param
+ * \return  Device profile
+ *****************************************************************************/
+const GDeviceProfile &GHexManager::GetDeviceProfile() const
+{
+    return Profile;
+}
+
+/****************************************************************************
+ * Sets the link the program frames of the image analysis are counted
+ * for, the one negotiated with the device. The loaded image is analyzed
+ * again and ImageAnalysisReady() tells the new figure.
+ *
+ * \param  Format: Framing, packet length and payload of the link.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::SetLinkFormat(const T_LINK_FORMAT &Format)
+{
+    if (SameLinkFormat(Format, LinkFormat)){
+        return;
+    }
+
+    LinkFormat = Format;
+
+    if ((ImageGeneration != 0) && !HexStream){
+        StartAnalysis();
+    }
+}
+
+/****************************************************************************
+ * Watches the loaded files and reloads them whenever they change on disk.
+ * HexFileReloaded() tells which device pages the new build changed.
+ *
+ * \param  Enable: true to watch the files.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::SetWatchMode(bool Enable)
+{
+    if (Enable && !Watcher){
+        Watcher = new QFileSystemWatcher(this);
+        connect(Watcher, SIGNAL(fileChanged(QString)), this, SLOT(OnHexFileChanged(QString)));
+        if (!HexFilePaths.isEmpty()){
+            Watcher->addPaths(HexFilePaths);
+        }
+    } else if (!Enable && Watcher){
+        WatchTimer.stop();
+        delete Watcher;
+        Watcher = NULL;
+        ReleaseParsedText();
+    }
+}
+
+/****************************************************************************
+ * A watched file changed. Builds write the file in several steps, so the
+ * reload waits for the file to settle.
+ *
+ * \param  Path: Changed file.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::OnHexFileChanged(const QString &Path)
+{
+    Q_UNUSED(Path);
+
+    WatchTimer.start();
+}
+
+/****************************************************************************
+ * Reloads the watched files and compares the new image with the previous
+ * one. The files are parsed again only if their contents changed, the
+ * image cache catches a plain time stamp change, and a hex file only where
+ * they changed (see ParseHexFile()).
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::ReloadWatchedFiles()
+{
+    // Shares the pages with the current image, no copy is made.
+    GFlashImage Previous = VirtualFlash;
+    QVector<unsigned int> ChangedPages;
+    unsigned int ChangedBytes = 0;
+    bool Ok;
+
+    if (!Watcher || HexFilePaths.isEmpty()){
+        return;
+    }
+
+    // Replacing a file (as most editors and linkers do) drops it from
+    // the watcher.
+    foreach (const QString &Path, HexFilePaths){
+        if (!Watcher->files().contains(Path) && QFileInfo::exists(Path)){
+            Watcher->addPath(Path);
         }
     }
 
-    HexRecordSt.MinAddress -= HexRecordSt.MinAddress % 4;
-    HexRecordSt.MaxAddress += HexRecordSt.MaxAddress % 4;
+    Ok = ReloadImage();
+
+    // A failed load (probably a half written file) keeps the paths, the
+    // next write triggers another reload.
+    if (Ok){
+        ChangedBytes = VirtualFlash.Compare(Previous, Profile.PageSize, &ChangedPages);
+    }
+
+    emit HexFileReloaded(Ok, ChangedPages, ChangedBytes);
+}
+
+/****************************************************************************
+ * Opens a hex file in streaming mode. The file is scanned once to validate
+ * it, count its records and calculate the verify CRC, all in constant
+ * memory. Programming then reads the records straight from the file.
+ *
+ * \param  Path: Hex file path.
+ * \param
+ * \param
+ * \return false if the file is not valid or its data is too far out of
+ *         address order to be streamed.
+ *****************************************************************************/
+bool GHexManager::LoadHexStream(const QString &Path)
+{
+    GHexStream *Stream = new GHexStream();
+    unsigned int Records;
+    unsigned int StartAddress;
+    unsigned int ProgLen;
+    unsigned short crc;
+
+    if(!Stream->Open(Path, Profile) || !Stream->Scan(&Records, &StartAddress, &ProgLen, &crc))
+    {
+        delete Stream;
+        return false;
+    }
+
+    ReleaseImage();
+
+    HexStream = Stream;
+    HexTotalLines = Records;
+    VerifyInfo.StartAddress = StartAddress;
+    VerifyInfo.ProgLen = ProgLen;
+    VerifyInfo.crc = crc;
+
+    return true;
+}
+
+/****************************************************************************
+ * Parses a mapped image file into the image model.
+ *
+ * \param  Path: Image file path, used to tell the format.
+ * \param  Data: File contents.
+ * \param  Size: File size.
+ * \return true if the image is valid.
+ *****************************************************************************/
+bool GHexManager::ParseImage(const QString &Path, const unsigned char *Data, qint64 Size)
+{
+    QVector<T_HEX_SEGMENT> Runs;
+    QByteArray Decoded;
+    const char *Source = (const char*)Data;
+    bool Valid;
+
+    switch(GImageLoader::DetectFormat(Path, Data, Size))
+    {
+    case ELF_FORMAT:
+        Valid = GImageLoader::LoadElf(Data, Size, &Runs);
+        break;
+
+    case BIN_FORMAT:
+        Valid = GImageLoader::LoadBin(Data, Size, ImageBaseAddress, &Runs);
+        break;
+
+    case SREC_FORMAT:
+        Valid = GImageLoader::LoadSrec(Data, Size, &Decoded, &Runs);
+        Source = Decoded.constData();
+        break;
+
+    case HEX_FORMAT:
+    default:
+        Valid = ParseHexFile(QByteArray::fromRawData((const char*)Data, Size), &Runs);
+        Source = HexRecords.constData();
+        break;
+    }
+
+    if(!Valid)
+    {
+        return false;
+    }
+
+    BuildSegments(Runs, Source);
+
+    if(HexRecordOffsets.isEmpty())
+    {
+        // The device is programmed with hex records. Make them up.
+        BuildHexRecords();
+    }
+
+    BuildVirtualFlash();
+    PruneHexRecords();
+
+    return true;
+}
+
+/****************************************************************************
+ * Drops the loaded image and unmaps its cache.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::ReleaseImage()
+{
+    // The worker may still be reading the image.
+    AnalysisWatcher.waitForFinished();
+    PendingCachePath.clear();
+
+    HexRecords = QByteArray();
+    HexRecordOffsets.clear();
+    HexSegments.clear();
+    ImageData = QByteArray();
+    VirtualFlash.Clear();
+    HexTotalLines = 0;
+    HexCurrLineNo = 0;
+    ImageGeneration = 0;
+
+    if(HexStream)
+    {
+        delete HexStream;
+        HexStream = NULL;
+    }
+    StreamRecordLen = 0;
+
+    if(CacheFile)
+    {
+        delete CacheFile;
+        CacheFile = NULL;
+    }
+}
+
+/****************************************************************************
+ * Drops the hex file kept for the watch mode reparse.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::ReleaseParsedText()
+{
+    ParsedText = QByteArray();
+    ParsedRecords = QByteArray();
+    ParsedChunks.clear();
+}
+
+/****************************************************************************
+ * Maps the image cache of a hex file and loads the image from it.
+ *
+ * \param  Path: Hex file path.
+ * \param  Info: Hex file information.
+ * \param  Hash: SHA-1 of the hex file. When empty, the cache is accepted on
+ *               size and time stamp alone.
+ * \return true if the cache is valid and the image was loaded.
+ *****************************************************************************/
+bool GHexManager::LoadImageCache(const QString &Path, const QFileInfo &Info, const QByteArray &Hash)
+{
+    QFile *File = new QFile(Path + IMAGE_CACHE_SUFFIX);
+    const T_CACHE_HEADER *Header;
+    const uchar *Map = NULL;
+    const unsigned int *Offsets;
+    const uchar *Records;
+    const T_HEX_SEGMENT *Segments;
+    const uchar *Image;
+    const T_CACHE_PAGE *Pages;
+    quint64 Size;
+    quint64 Expected;
+    bool Valid = false;
+
+    if(File->open(QIODevice::ReadOnly) && (File->size() >= (qint64)sizeof(T_CACHE_HEADER)))
+    {
+        Size = File->size();
+        Map = File->map(0, Size);
+    }
+
+    if(Map)
+    {
+        Header = (const T_CACHE_HEADER*)Map;
+
+        Valid = (memcmp(Header->Magic, IMAGE_CACHE_MAGIC, 4) == 0) &&
+                (Header->Version == IMAGE_CACHE_VERSION) &&
+                (Header->SourceSize == Info.size()) &&
+                (Header->BaseAddress == ImageBaseAddress) &&
+                (memcmp(Header->ProfileKey, Profile.Key().constData(), sizeof(Header->ProfileKey)) == 0);
+
+        if(Valid && Hash.isEmpty())
+        {
+            Valid = (Header->SourceModified == Info.lastModified().toMSecsSinceEpoch());
+        }
+        else if(Valid)
+        {
+            Valid = (Hash.size() == sizeof(Header->SourceHash)) &&
+                    (memcmp(Header->SourceHash, Hash.constData(), sizeof(Header->SourceHash)) == 0);
+        }
+
+        if(Valid)
+        {
+            Expected = sizeof(T_CACHE_HEADER) +
+                    ALIGN4(((quint64)Header->RecordCount + 1) * sizeof(unsigned int)) +
+                    ALIGN4((quint64)Header->RecordBytes) +
+                    (quint64)Header->SegmentCount * sizeof(T_HEX_SEGMENT) +
+                    ALIGN4((quint64)Header->ImageBytes) +
+                    (quint64)Header->PageCount * sizeof(T_CACHE_PAGE);
+            Valid = (Expected == Size);
+        }
+    }
+
+    if(!Valid)
+    {
+        delete File;
+        return false;
+    }
+
+    Offsets = (const unsigned int*)(Map + sizeof(T_CACHE_HEADER));
+    Records = (const uchar*)Offsets + ALIGN4(((quint64)Header->RecordCount + 1) * sizeof(unsigned int));
+    Segments = (const T_HEX_SEGMENT*)(Records + ALIGN4((quint64)Header->RecordBytes));
+    Image = (const uchar*)(Segments + Header->SegmentCount);
+    Pages = (const T_CACHE_PAGE*)(Image + ALIGN4((quint64)Header->ImageBytes));
+
+    // The layout must be consistent before anything points into it.
+    if((Offsets[0] != 0) || (Offsets[Header->RecordCount] != Header->RecordBytes))
+    {
+        delete File;
+        return false;
+    }
+    for(unsigned int i = 0; i < Header->RecordCount; i++)
+    {
+        if(Offsets[i] > Offsets[i + 1])
+        {
+            delete File;
+            return false;
+        }
+    }
+    for(unsigned int i = 0; i < Header->SegmentCount; i++)
+    {
+        if(((quint64)Segments[i].Offset + Segments[i].Length) > Header->ImageBytes)
+        {
+            delete File;
+            return false;
+        }
+    }
+
+    ReleaseImage();
+
+    HexRecordOffsets.resize(Header->RecordCount + 1);
+    memcpy(HexRecordOffsets.data(), Offsets, (Header->RecordCount + 1) * sizeof(unsigned int));
+    HexRecords = QByteArray::fromRawData((const char*)Records, Header->RecordBytes);
+
+    HexSegments.resize(Header->SegmentCount);
+    memcpy(HexSegments.data(), Segments, Header->SegmentCount * sizeof(T_HEX_SEGMENT));
+    ImageData = QByteArray::fromRawData((const char*)Image, Header->ImageBytes);
+
+    BuildVirtualFlash();
+    for(unsigned int i = 0; i < Header->PageCount; i++)
+    {
+        VirtualFlash.SetPageCrc(Pages[i].Page, Pages[i].crc);
+    }
+
+    // Keep the mapping alive as long as the image uses it.
+    CacheFile = File;
+
+    return true;
+}
+
+/****************************************************************************
+ * Writes the image cache of a hex file. Failures are silently ignored, the
+ * cache is an optimisation only.
+ *
+ * \param  Path: Hex file path.
+ * \param  Info: Hex file information.
+ * \param  Hash: SHA-1 of the hex file.
+ * \return
+ *****************************************************************************/
+void GHexManager::SaveImageCache(const QString &Path, const QFileInfo &Info, const QByteArray &Hash)
+{
+    static const char Padding[4] = {0, 0, 0, 0};
+    QSaveFile File(Path + IMAGE_CACHE_SUFFIX);
+    T_CACHE_HEADER Header;
+    T_CACHE_PAGE CachePage;
+    unsigned int Page = 0;
+    unsigned int Len;
+
+    memset(&Header, 0, sizeof(Header));
+    memcpy(Header.Magic, IMAGE_CACHE_MAGIC, 4);
+    Header.Version = IMAGE_CACHE_VERSION;
+    Header.SourceSize = Info.size();
+    Header.SourceModified = Info.lastModified().toMSecsSinceEpoch();
+    if(Hash.size() == sizeof(Header.SourceHash))
+    {
+        memcpy(Header.SourceHash, Hash.constData(), sizeof(Header.SourceHash));
+    }
+    Header.RecordCount = HexRecordOffsets.size() - 1;
+    Header.RecordBytes = HexRecords.size();
+    Header.SegmentCount = HexSegments.size();
+    Header.ImageBytes = ImageData.size();
+    Header.PageCount = VirtualFlash.PageCount();
+    Header.BaseAddress = ImageBaseAddress;
+    memcpy(Header.ProfileKey, Profile.Key().constData(), sizeof(Header.ProfileKey));
+
+    if(HexRecordOffsets.isEmpty() || !File.open(QIODevice::WriteOnly))
+    {
+        return;
+    }
+
+    File.write((const char*)&Header, sizeof(Header));
+
+    Len = HexRecordOffsets.size() * sizeof(unsigned int);
+    File.write((const char*)HexRecordOffsets.constData(), Len);
+    File.write(Padding, ALIGN4(Len) - Len);
+
+    Len = HexRecords.size();
+    File.write(HexRecords.constData(), Len);
+    File.write(Padding, ALIGN4(Len) - Len);
+
+    File.write((const char*)HexSegments.constData(), HexSegments.size() * sizeof(T_HEX_SEGMENT));
+
+    Len = ImageData.size();
+    File.write(ImageData.constData(), Len);
+    File.write(Padding, ALIGN4(Len) - Len);
+
+    while(VirtualFlash.NextPage(&Page))
+    {
+        CachePage.Page = Page;
+        CachePage.crc = VirtualFlash.PageCrc(Page);
+        File.write((const char*)&CachePage, sizeof(CachePage));
+        Page++;
+    }
+
+    File.commit();
+}
+
+/****************************************************************************
+ * Decodes the records of one chunk of a hex file. The extended address is
+ * not known at the start of the chunk, so the runs ahead of the first
+ * address record are left relative and counted in Unresolved.
+ *
+ * \param  Chunk: Chunk to decode.
+ * \param  Out: Record buffer. The chunk is decoded at Out + OutOffset.
+ * \param
+ * \return
+ *****************************************************************************/
+static void ParseHexChunk(T_PARSE_CHUNK *Chunk, unsigned char *Out)
+{
+    T_HEX_RECORD HexRecordSt;
+    T_HEX_SEGMENT Run;
+    unsigned char *Rec;
+    const char *Line = Chunk->Begin;
+    const char *Eol;
+    unsigned int LineLen;
+    unsigned int RecOffset = 0;
+    int RecLen;
+
+    Chunk->OutLen = 0;
+    Chunk->Unresolved = 0;
+    Chunk->AddressChanged = false;
+    Chunk->EndOfFile = false;
+    Chunk->Error = false;
+
+    HexRecordSt.ExtSegAddress = 0;
+    HexRecordSt.ExtLinAddress = 0;
+    HexRecordSt.RecType = DATA_RECORD;
+
+    Out += Chunk->OutOffset;
+
+    while((Line < Chunk->End) && (HexRecordSt.RecType != END_OF_FILE_RECORD))
+    {
+        Eol = static_cast<const char*>(memchr(Line, '\n', Chunk->End - Line));
+        if(Eol == NULL)
+        {
+            Eol = Chunk->End;
+        }
+
+        LineLen = Eol - Line;
+        while((LineLen > 0) && ((Line[LineLen - 1] == '\r') || (Line[LineLen - 1] == ' ')))
+        {
+            LineLen--;
+        }
+
+        if(LineLen == 0)
+        {
+            // Blank line.
+            Line = Eol + 1;
+            continue;
+        }
+
+        // Decode straight into the record buffer, checksum included.
+        Rec = Out + RecOffset;
+        RecLen = Utils::DecodeHexRecord(Line, LineLen, Rec, Chunk->OutSize - RecOffset);
+        if(RecLen < 0)
+        {
+            // Not a valid hex record.
+            Chunk->Error = true;
+            return;
+        }
+
+        Chunk->Offsets.append(RecOffset);
+
+        GHexManager::DecodeRecordAddress(&HexRecordSt, Rec);
+
+        if((HexRecordSt.RecType == DATA_RECORD) && HexRecordSt.RecDataLen)
+        {
+            Run.Address = HexRecordSt.Address;
+            Run.Length = HexRecordSt.RecDataLen;
+            Run.Offset = RecOffset + 4;
+            Chunk->Runs.append(Run);
+
+            if(!Chunk->AddressChanged)
+            {
+                Chunk->Unresolved++;
+            }
+        }
+        else if(HexRecordSt.RecType != DATA_RECORD)
+        {
+            // Any other record type sets or clears the extended address.
+            Chunk->AddressChanged = true;
+        }
+
+        RecOffset += RecLen;
+        Line = Eol + 1;
+    }
+
+    Chunk->OutLen = RecOffset;
+    Chunk->ExtSegAddress = HexRecordSt.ExtSegAddress;
+    Chunk->ExtLinAddress = HexRecordSt.ExtLinAddress;
+    Chunk->EndOfFile = (HexRecordSt.RecType == END_OF_FILE_RECORD);
+}
+
+/****************************************************************************
+ * Splits a piece of a hex file at line boundaries into chunks to decode.
+ *
+ * \param  Text: Start of the hex file. Chunk records are decoded at half
+ *               their offset from it.
+ * \param  Begin, End: Piece to split, whole lines.
+ * \param  Count: Number of chunks, fewer if the lines do not allow it.
+ * \param  Chunks: The chunks are appended to it.
+ * \return
+ *****************************************************************************/
+static void SplitHexChunks(const char *Text, const char *Begin, const char *End, int Count, QVector<T_PARSE_CHUNK> *Chunks)
+{
+    T_PARSE_CHUNK Chunk;
+    const char *Split = Begin;
+
+    Chunk.Parsed = -1;
+
+    for(int i = 0; (i < Count) && (Split < End); i++)
+    {
+        Chunk.Begin = Split;
+        if(i == (Count - 1))
+        {
+            Split = End;
+        }
+        else
+        {
+            Split = qMax(Split, Begin + (qint64)(End - Begin) * (i + 1) / Count);
+            Split = static_cast<const char*>(memchr(Split, '\n', End - Split));
+            Split = (Split == NULL) ? End : (Split + 1);
+        }
+        Chunk.End = Split;
+        Chunk.OutOffset = (Chunk.Begin - Text) / 2;
+        Chunk.OutSize = (Chunk.End - Text) / 2 - Chunk.OutOffset;
+        Chunks->append(Chunk);
+    }
+}
+
+/****************************************************************************
+ * Number of bytes two buffers have in common at the start, or at the end.
+ *
+ * \param  a, b: Buffers; their ends for CommonSuffix().
+ * \param  Len: Bytes to compare, at most.
+ * \param
+ * \return Bytes in common.
+ *****************************************************************************/
+static qint64 CommonPrefix(const char *a, const char *b, qint64 Len)
+{
+    qint64 i = 0;
+
+    while(((i + 4096) <= Len) && (memcmp(a + i, b + i, 4096) == 0))
+    {
+        i += 4096;
+    }
+    while((i < Len) && (a[i] == b[i]))
+    {
+        i++;
+    }
+
+    return i;
+}
+
+static qint64 CommonSuffix(const char *a, const char *b, qint64 Len)
+{
+    qint64 i = 0;
+
+    while(((i + 4096) <= Len) && (memcmp(a - i - 4096, b - i - 4096, 4096) == 0))
+    {
+        i += 4096;
+    }
+    while((i < Len) && (a[-i - 1] == b[-i - 1]))
+    {
+        i++;
+    }
+
+    return i;
+}
+
+/****************************************************************************
+ * Decodes every record of the hex file into HexRecords. Large files are
+ * split at line boundaries and decoded by ParseThreads threads.
+ *
+ * In watch mode the file is kept along with its chunks. When it is parsed
+ * again, the chunks at its start and end the new build left untouched are
+ * copied from the previous parse, only the lines in between are decoded.
+ *
+ * \param  Ascii: Contents of the hex file.
+ * \param  Runs: Receives the data records. Offsets point into HexRecords.
+ * \param
+ * \return true if all the records are valid.
+ *****************************************************************************/
+bool GHexManager::ParseHexFile(const QByteArray &Ascii, QVector<T_HEX_SEGMENT> *Runs)
+{
+    QVector<T_PARSE_CHUNK> Chunks;
+    QVector<int> Pending;
+    QVector<int> Lanes;
+    T_PARSE_CHUNK *Chunk;
+    T_HEX_RECORD HexRecordSt;
+    T_HEX_SEGMENT Run;
+    const char *Text = Ascii.constData();
+    const char *End = Text + Ascii.size();
+    const char *Old = ParsedText.constData();
+    const char *GapBegin = Text;
+    const char *GapEnd = End;
+    qint64 OldSize = ParsedText.size();
+    qint64 Prefix = 0;
+    qint64 Suffix = 0;
+    qint64 Shift = Ascii.size() - OldSize;
+    qint64 PendingLen = 0;
+    unsigned int RecOffset = 0;
+    int Threads = ParseThreads;
+    int Head = 0;
+    int Tail = ParsedChunks.size();
+    int Count;
+    int i, j;
+
+    if(Threads <= 0)
+    {
+        Threads = QThread::idealThreadCount();
+    }
+    Threads = qMax(Threads, 1);
+
+    // Decoded records never exceed half of the ascii size, so chunk i
+    // decodes in place at half its ascii offset without touching its
+    // neighbours.
+    HexRecordOffsets.clear();
+    HexRecords.resize(Ascii.size() / 2);
+
+    if(Watcher && !ParsedChunks.isEmpty())
+    {
+        // Chunks of the previous parse, whole lines, found unchanged at the
+        // start of the file or at its end.
+        Prefix = CommonPrefix(Text, Old, qMin((qint64)Ascii.size(), OldSize));
+        Suffix = CommonSuffix(End, Old + OldSize, qMin((qint64)Ascii.size(), OldSize) - Prefix);
+
+        while((Head < ParsedChunks.size()) && ((ParsedChunks[Head].End - Old) <= Prefix) &&
+              ((ParsedChunks[Head].End[-1] == '\n') || (Prefix == Ascii.size())))
+        {
+            Head++;
+        }
+        while((Tail > Head) && ((ParsedChunks[Tail - 1].Begin - Old) > (OldSize - Suffix)))
+        {
+            Tail--;
+        }
+    }
+
+    // Reused chunks, moved to the new text, and the lines between them.
+    for(i = 0; i < Head; i++)
+    {
+        Chunks.append(ParsedChunks[i]);
+        Chunks.last().Begin = Text + (ParsedChunks[i].Begin - Old);
+        Chunks.last().End = Text + (ParsedChunks[i].End - Old);
+    }
+    if(Head > 0)
+    {
+        GapBegin = Chunks.last().End;
+    }
+    if(Tail < ParsedChunks.size())
+    {
+        GapEnd = Text + (ParsedChunks[Tail].Begin - Old) + Shift;
+    }
+
+    i = Chunks.size();
+    if(Watcher)
+    {
+        // Fine enough to decode little more than the lines a build changes.
+        Count = qMax(1, (int)((GapEnd - GapBegin) / REPARSE_CHUNK_LEN));
+    }
+    else
+    {
+        // Not worth a thread for less than a chunk.
+        Count = qBound(1, (int)((GapEnd - GapBegin) / PARSE_CHUNK_MIN), Threads);
+    }
+    SplitHexChunks(Text, GapBegin, GapEnd, Count, &Chunks);
+    for(; i < Chunks.size(); i++)
+    {
+        Pending.append(i);
+    }
+
+    for(j = Tail; j < ParsedChunks.size(); j++)
+    {
+        Chunks.append(ParsedChunks[j]);
+        Chunks.last().Begin = Text + (ParsedChunks[j].Begin - Old) + Shift;
+        Chunks.last().End = Text + (ParsedChunks[j].End - Old) + Shift;
+        Chunks.last().OutOffset = (Chunks.last().Begin - Text) / 2;
+        Chunks.last().OutSize = (Chunks.last().End - Text) / 2 - Chunks.last().OutOffset;
+    }
+    if(!Chunks.isEmpty() && (Chunks.last().End < End))
+    {
+        // Past the end of file record of the previous parse.
+        i = Chunks.size();
+        SplitHexChunks(Text, Chunks.last().End, End, 1, &Chunks);
+        for(; i < Chunks.size(); i++)
+        {
+            Pending.append(i);
+        }
+    }
+
+    for(i = 0; i < Pending.size(); i++)
+    {
+        PendingLen += Chunks[Pending[i]].End - Chunks[Pending[i]].Begin;
+    }
+    Count = qBound(1, (int)(PendingLen / PARSE_CHUNK_MIN), qMin(Threads, Pending.size()));
+
+    if(Count <= 1)
+    {
+        for(i = 0; i < Pending.size(); i++)
+        {
+            ParseHexChunk(&Chunks[Pending[i]], (unsigned char*)HexRecords.data());
+        }
+    }
+    else
+    {
+        unsigned char *Out = (unsigned char*)HexRecords.data();
+        T_PARSE_CHUNK *All = Chunks.data();
+        const QVector<int> &Todo = Pending;
+
+        // Thread n decodes chunks n, n + Count, n + 2 * Count...
+        for(i = 0; i < Count; i++)
+        {
+            Lanes.append(i);
+        }
+        QtConcurrent::blockingMap(Lanes, [Out, All, &Todo, Count](int &Lane) {
+            for(int k = Lane; k < Todo.size(); k += Count)
+            {
+                ParseHexChunk(&All[Todo[k]], Out);
+            }
+        });
+    }
+
+    for(i = 0, j = 0, Count = 0; i < Chunks.size(); i++)
+    {
+        j += Chunks[i].Offsets.size();
+        Count += Chunks[i].Runs.size();
+    }
+    HexRecordOffsets.reserve(j + 1);
+    Runs->reserve(Runs->size() + Count);
+
+    // Prefix pass. Records ahead of the first address record of a chunk
+    // inherit the extended address the previous chunks leave behind.
+    HexRecordSt.ExtSegAddress = 0;
+    HexRecordSt.ExtLinAddress = 0;
+    for(i = 0; i < Chunks.size(); i++)
+    {
+        Chunk = &Chunks[i];
+        if(Chunk->Error)
+        {
+            // Not a valid hex record.
+            return false;
+        }
+
+        if(Chunk->Parsed >= 0)
+        {
+            memcpy(HexRecords.data() + RecOffset, ParsedRecords.constData() + Chunk->Parsed, Chunk->OutLen);
+        }
+        else
+        {
+            // Close the gap left by the previous chunks. Never overlaps a
+            // chunk still to be moved.
+            memmove(HexRecords.data() + RecOffset, HexRecords.constData() + Chunk->OutOffset, Chunk->OutLen);
+        }
+
+        for(j = 0; j < Chunk->Offsets.size(); j++)
+        {
+            HexRecordOffsets.append(RecOffset + Chunk->Offsets[j]);
+        }
+
+        for(j = 0; j < Chunk->Runs.size(); j++)
+        {
+            Run = Chunk->Runs[j];
+            Run.Offset += RecOffset;
+            if(j < Chunk->Unresolved)
+            {
+                Run.Address += HexRecordSt.ExtLinAddress + HexRecordSt.ExtSegAddress;
+            }
+            Runs->append(Run);
+        }
+
+        if(Chunk->AddressChanged)
+        {
+            HexRecordSt.ExtSegAddress = Chunk->ExtSegAddress;
+            HexRecordSt.ExtLinAddress = Chunk->ExtLinAddress;
+        }
+
+        Chunk->Parsed = RecOffset;
+        RecOffset += Chunk->OutLen;
+
+        if(Chunk->EndOfFile)
+        {
+            // Anything past the end of file record is ignored.
+            i++;
+            break;
+        }
+    }
+
+    HexRecords.truncate(RecOffset);
+
+    // Sentinel, so that record n spans [HexRecordOffsets[n], HexRecordOffsets[n+1]).
+    HexRecordOffsets.append(RecOffset);
+
+    if(Watcher)
+    {
+        // Own copy, Ascii maps the file. Kept in the same buffer, builds
+        // hardly change the size.
+        ParsedText.resize(Ascii.size());
+        memcpy(ParsedText.data(), Text, Ascii.size());
+        ParsedRecords = HexRecords;
+        Chunks.resize(i);
+        for(j = 0; j < Chunks.size(); j++)
+        {
+            Chunks[j].Begin = ParsedText.constData() + (Chunks[j].Begin - Text);
+            Chunks[j].End = ParsedText.constData() + (Chunks[j].End - Text);
+        }
+        ParsedChunks = Chunks;
+    }
+    else
+    {
+        ReleaseParsedText();
+    }
+
+    return true;
+}
+
+/****************************************************************************
+ * Decodes hex file text the way LoadHexFile() does, without loading it as
+ * the image. Lets the parser be measured and checked on its own.
+ *
+ * \param  Ascii: Contents of the hex file.
+ * \param  Threads: Parser threads, as ParseThreads.
+ * \param  Records, Offsets, Runs: Receive the decoded records, the offset
+ *         of each one (plus the end of the last) and the data records.
+ * \return true if all the records are valid.
+ *****************************************************************************/
+bool GHexManager::ParseHexText(const QByteArray &Ascii, int Threads, QByteArray *Records,
+                               QVector<unsigned int> *Offsets, QVector<T_HEX_SEGMENT> *Runs)
+{
+    GHexManager Parser;
+
+    Parser.ParseThreads = Threads;
+    if(!Parser.ParseHexFile(Ascii, Runs))
+    {
+        return false;
+    }
+
+    *Records = Parser.HexRecords;
+    *Offsets = Parser.HexRecordOffsets;
+
+    return true;
+}
+
+/****************************************************************************
+ * Fills in a T_HEX_RECORD from a decoded record and tracks the extended
+ * segment and linear addresses across records.
+ *
+ * \param  HexRecordSt: Record state, carried from one record to the next.
+ * \param  Rec: Decoded record.
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::DecodeRecordAddress(T_HEX_RECORD *HexRecordSt, const unsigned char *Rec)
+{
+    HexRecordSt->RecDataLen = Rec[0];
+    HexRecordSt->RecType = Rec[3];
+    HexRecordSt->Data = (unsigned char*)&Rec[4];
+
+    switch(HexRecordSt->RecType)
+    {
+    case DATA_RECORD:  //Record Type 00, data record.
+        HexRecordSt->Address = (((Rec[1] << 8) & 0x0000FF00) | (Rec[2] & 0x000000FF)) & (0x0000FFFF);
+        HexRecordSt->Address = HexRecordSt->Address + HexRecordSt->ExtLinAddress + HexRecordSt->ExtSegAddress;
+        break;
+
+    case EXT_SEG_ADRS_RECORD:  // Record Type 02, defines 4 to 19 of the data address.
+        HexRecordSt->ExtSegAddress = ((HexRecordSt->Data[0] << 16) & 0x00FF0000) | ((HexRecordSt->Data[1] << 8) & 0x0000FF00);
+        HexRecordSt->ExtLinAddress = 0;
+        break;
+
+    case EXT_LIN_ADRS_RECORD:
+        HexRecordSt->ExtLinAddress = ((HexRecordSt->Data[0] << 24) & 0xFF000000) | ((HexRecordSt->Data[1] << 16) & 0x00FF0000);
+        HexRecordSt->ExtSegAddress = 0;
+        break;
+
+    case END_OF_FILE_RECORD:  //Record Type 01
+    default:
+        HexRecordSt->ExtSegAddress = 0;
+        HexRecordSt->ExtLinAddress = 0;
+        break;
+    }
+}
+
+/****************************************************************************
+ * Coalesces the data records into address-sorted, non overlapping segments.
+ * Overlapping bytes take the value of the last record in file order.
+ *
+ * \param  Runs: Data records in file order.
+ * \param  Source: Buffer the offsets of the runs point into.
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::BuildSegments(const QVector<T_HEX_SEGMENT> &Runs, const char *Source)
+{
+    QVector<T_HEX_SEGMENT> Sorted = Runs;
+    T_HEX_SEGMENT Segment;
+    unsigned int TotalLen = 0;
+    quint64 End;
+
+    HexSegments.clear();
+    ImageData.clear();
+
+    std::sort(Sorted.begin(), Sorted.end(),
+              [](const T_HEX_SEGMENT &a, const T_HEX_SEGMENT &b) { return a.Address < b.Address; });
+
+    // Union of the record address ranges.
+    for(int i = 0; i < Sorted.size(); i++)
+    {
+        if(!HexSegments.isEmpty())
+        {
+            T_HEX_SEGMENT &Last = HexSegments.last();
+            End = (quint64)Last.Address + Last.Length;
+            if(Sorted[i].Address <= End)
+            {
+                if(((quint64)Sorted[i].Address + Sorted[i].Length) > End)
+                {
+                    Last.Length = Sorted[i].Address + Sorted[i].Length - Last.Address;
+                }
+                continue;
+            }
+        }
+        Segment.Address = Sorted[i].Address;
+        Segment.Length = Sorted[i].Length;
+        HexSegments.append(Segment);
+    }
+
+    for(int i = 0; i < HexSegments.size(); i++)
+    {
+        HexSegments[i].Offset = TotalLen;
+        TotalLen += HexSegments[i].Length;
+    }
+
+    // Copy the data in file order so that later records win.
+    ImageData.resize(TotalLen);
+    for(int i = 0; i < Runs.size(); i++)
+    {
+        QVector<T_HEX_SEGMENT>::const_iterator it =
+                std::upper_bound(HexSegments.constBegin(), HexSegments.constEnd(), Runs[i].Address,
+                                 [](unsigned int a, const T_HEX_SEGMENT &b) { return a < b.Address; });
+        --it;
+        memcpy(ImageData.data() + it->Offset + (Runs[i].Address - it->Address),
+               Source + Runs[i].Offset, Runs[i].Length);
+    }
+}
+
+/****************************************************************************
+ * Generates Intel HEX records (extended linear address, data and end of
+ * file) from the segments, for images loaded from other formats.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::BuildHexRecords()
+{
+    unsigned char Rec[HEX_RECORD_DATA_LEN + 5];
+    unsigned int UpperAddress = 0xFFFFFFFF;
+    unsigned int Address;
+    unsigned int Remaining;
+    unsigned int Offset;
+    unsigned int Len;
+
+    HexRecords.clear();
+    HexRecordOffsets.clear();
+
+    for(int i = 0; i < HexSegments.size(); i++)
+    {
+        Address = HexSegments[i].Address;
+        Remaining = HexSegments[i].Length;
+        Offset = HexSegments[i].Offset;
+
+        while(Remaining)
+        {
+            if((Address >> 16) != UpperAddress)
+            {
+                UpperAddress = Address >> 16;
+                Rec[0] = 2;
+                Rec[1] = 0;
+                Rec[2] = 0;
+                Rec[3] = EXT_LIN_ADRS_RECORD;
+                Rec[4] = UpperAddress >> 8;
+                Rec[5] = UpperAddress;
+                AppendHexRecord(Rec);
+            }
+
+            // Records do not cross a 64 KB boundary.
+            Len = 0x10000 - (Address & 0xFFFF);
+            if(Len > HEX_RECORD_DATA_LEN)
+            {
+                Len = HEX_RECORD_DATA_LEN;
+            }
+            if(Len > Remaining)
+            {
+                Len = Remaining;
+            }
+
+            Rec[0] = Len;
+            Rec[1] = Address >> 8;
+            Rec[2] = Address;
+            Rec[3] = DATA_RECORD;
+            memcpy(&Rec[4], ImageData.constData() + Offset, Len);
+            AppendHexRecord(Rec);
+
+            Address += Len;
+            Offset += Len;
+            Remaining -= Len;
+        }
+    }
+
+    Rec[0] = 0;
+    Rec[1] = 0;
+    Rec[2] = 0;
+    Rec[3] = END_OF_FILE_RECORD;
+    AppendHexRecord(Rec);
+
+    // Sentinel.
+    HexRecordOffsets.append(HexRecords.size());
+}
+
+/****************************************************************************
+ * Appends a record to HexRecords, filling in its checksum.
+ *
+ * \param  Rec: Record. Rec[0] is the data length, the checksum goes after
+ *              the data.
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::AppendHexRecord(unsigned char *Rec)
+{
+    unsigned int Len = Rec[0] + 4;
+    unsigned char Sum = 0;
+
+    for(unsigned int i = 0; i < Len; i++)
+    {
+        Sum += Rec[i];
+    }
+    Rec[Len] = -Sum;
+
+    HexRecordOffsets.append(HexRecords.size());
+    HexRecords.append((const char*)Rec, Len + 1);
+}
+
+/****************************************************************************
+ * Writes the image segments into the virtual flash. Only the pages touched
+ * by the image get allocated.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::BuildVirtualFlash()
+{
+    QVector<T_MEMORY_RANGE> Writable = Profile.WritableRanges();
+    quint64 ProgAddress;
+    unsigned int Len;
+
+    VirtualFlash.Clear();
+
+    for(int i = 0; i < HexSegments.size(); i++)
+    {
+        const T_HEX_SEGMENT &Segment = HexSegments[i];
+        quint64 Begin = Profile.Translate(Segment.Address);
+
+        // Only what the device can take. Make sure we are not writing the
+        // boot sector, or anything outside the flash.
+        ProgAddress = Begin;
+        while((Len = GDeviceProfile::NextWritable(Writable, &ProgAddress, Begin + Segment.Length)) != 0)
+        {
+            VirtualFlash.Write(ProgAddress,
+                               (const unsigned char*)ImageData.constData() + Segment.Offset + (ProgAddress - Begin),
+                               Len);
+            ProgAddress += Len;
+        }
+    }
+}
+
+/****************************************************************************
+ * Drops the records the device would ignore, so that they never reach the
+ * wire: data outside the writable flash of the device profile, empty data
+ * records and start address records. Data records that are only partly
+ * writable are cut down. Extended address records are kept only where the
+ * address actually changes for the data sent.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::PruneHexRecords()
+{
+    QVector<T_MEMORY_RANGE> Writable = Profile.WritableRanges();
+    QByteArray Records = HexRecords;
+    QVector<unsigned int> Offsets = HexRecordOffsets;
+    T_HEX_RECORD HexRecordSt;
+    unsigned char Rec[260];
+    const unsigned char *Src;
+    unsigned int SentSegAddress = 0;
+    unsigned int SentLinAddress = 0;
+    bool AddressSent = false;
+    unsigned int SegAddress;
+    unsigned int LinAddress;
+    unsigned int Begin;
+    unsigned int Address;
+    quint64 ProgAddress;
+    unsigned int Len;
+
+    if(Offsets.isEmpty())
+    {
+        return;
+    }
+
+    HexRecords = QByteArray();
+    HexRecords.reserve(Records.size());
+    HexRecordOffsets.clear();
+
+    HexRecordSt.ExtSegAddress = 0;
+    HexRecordSt.ExtLinAddress = 0;
+
+    for(int i = 0; (i + 1) < Offsets.size(); i++)
+    {
+        Src = (const unsigned char*)Records.constData() + Offsets[i];
+        DecodeRecordAddress(&HexRecordSt, Src);
+
+        if(HexRecordSt.RecType == END_OF_FILE_RECORD)
+        {
+            memcpy(Rec, Src, Offsets[i + 1] - Offsets[i]);
+            AppendHexRecord(Rec);
+            break;
+        }
+
+        if((HexRecordSt.RecType != DATA_RECORD) || (HexRecordSt.RecDataLen == 0))
+        {
+            // Address records are sent along with the data they apply to.
+            continue;
+        }
+
+        Begin = Profile.Translate(HexRecordSt.Address);
+        ProgAddress = Begin;
+        while((Len = GDeviceProfile::NextWritable(Writable, &ProgAddress, (quint64)Begin + HexRecordSt.RecDataLen)) != 0)
+        {
+            // Where the record, or the writable part of it, starts. A cut
+            // record can start past a 64 KB boundary: the extended address
+            // is then worked out from the full address, as BuildHexRecords()
+            // does, instead of the one the record came with.
+            Address = HexRecordSt.Address + (ProgAddress - Begin);
+            if(HexRecordSt.ExtSegAddress && ((Address - HexRecordSt.ExtSegAddress) <= 0xFFFF))
+            {
+                SegAddress = HexRecordSt.ExtSegAddress;
+                LinAddress = 0;
+            }
+            else
+            {
+                SegAddress = 0;
+                LinAddress = Address & 0xFFFF0000;
+            }
+
+            // The device address state is not known before the first record.
+            if(!AddressSent || (SegAddress != SentSegAddress) || (LinAddress != SentLinAddress))
+            {
+                // One of the two is always zero.
+                Rec[0] = 2;
+                Rec[1] = 0;
+                Rec[2] = 0;
+                if(SegAddress)
+                {
+                    Rec[3] = EXT_SEG_ADRS_RECORD;
+                    Rec[4] = SegAddress >> 16;
+                    Rec[5] = SegAddress >> 8;
+                }
+                else
+                {
+                    Rec[3] = EXT_LIN_ADRS_RECORD;
+                    Rec[4] = LinAddress >> 24;
+                    Rec[5] = LinAddress >> 16;
+                }
+                AppendHexRecord(Rec);
+                SentSegAddress = SegAddress;
+                SentLinAddress = LinAddress;
+                AddressSent = true;
+            }
+
+            Address -= SegAddress + LinAddress;
+            Rec[0] = Len;
+            Rec[1] = Address >> 8;
+            Rec[2] = Address;
+            Rec[3] = DATA_RECORD;
+            memcpy(&Rec[4], &Src[4] + (ProgAddress - Begin), Len);
+            AppendHexRecord(Rec);
+
+            ProgAddress += Len;
+        }
+    }
+
+    // Sentinel.
+    HexRecordOffsets.append(HexRecords.size());
+}
+
+/****************************************************************************
+ * Gets next hex record from the loaded image
+ *
+ * \param  HexRec: Pointer to HexRec.
+ * \param  BuffLen: Buffer Length
+ * \param
+ * \return Length of the hex record in bytes.
+ *****************************************************************************/
+int GHexManager::GetNextHexRecord(char *HexRec, unsigned int BuffLen)
+{
+    const char *Rec;
+    unsigned int Len;
+
+    Rec = PeekHexRecord(&Len);
+    if((Rec == NULL) || (Len > BuffLen))
+    {
+        return 0;
+    }
+
+    memcpy(HexRec, Rec, Len);
+    ConsumeHexRecord();
+
+    return Len;
+}
+
+/****************************************************************************
+ * Next hex record of the loaded image, left in place. It stays the next
+ * record until ConsumeHexRecord() is called.
+ *
+ * \param  Len: Receives the length of the hex record in bytes.
+ * \param
+ * \param
+ * \return Pointer to the record, valid until the next call. NULL when there
+ *         are no more records.
+ *****************************************************************************/
+const char *GHexManager::PeekHexRecord(unsigned int *Len)
+{
+    int RecLen;
+
+    if(HexStream)
+    {
+        if(StreamRecordLen == 0)
+        {
+            StreamRecord.resize(STREAM_LINE_LEN / 2);
+            RecLen = HexStream->NextRecord(StreamRecord.data(), StreamRecord.size());
+            if(RecLen <= 0)
+            {
+                if(RecLen == 0)
+                {
+                    FinishProgramCrc();
+                }
+                return NULL;
+            }
+            StreamRecordLen = RecLen;
+        }
+        *Len = StreamRecordLen;
+        return StreamRecord.constData();
+    }
+
+    if((HexCurrLineNo + 1) >= (unsigned int)HexRecordOffsets.size())
+    {
+        // No more records.
+        FinishProgramCrc();
+        return NULL;
+    }
+
+    *Len = HexRecordOffsets[HexCurrLineNo + 1] - HexRecordOffsets[HexCurrLineNo];
+    return HexRecords.constData() + HexRecordOffsets[HexCurrLineNo];
+}
+
+/****************************************************************************
+ * Moves past the record returned by PeekHexRecord(), once it is sent.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::ConsumeHexRecord()
+{
+    if(HexStream)
+    {
+        if(StreamRecordLen == 0)
+        {
+            return;
+        }
+        FoldProgramCrc((const unsigned char*)StreamRecord.constData());
+        StreamRecordLen = 0;
+    }
+    else
+    {
+        if((HexCurrLineNo + 1) >= (unsigned int)HexRecordOffsets.size())
+        {
+            return;
+        }
+        FoldProgramCrc((const unsigned char*)HexRecords.constData() + HexRecordOffsets[HexCurrLineNo]);
+    }
+
+    HexCurrLineNo++;
+}
+
+/****************************************************************************
+ * Folds erased bytes into a crc.
+ *****************************************************************************/
+static unsigned short UpdateCrcBlank(unsigned short crc, quint64 Len)
+{
+    static const QByteArray Blank(FLASH_PAGE_SIZE, (char)0xFF);
+    static const unsigned short BlankCrc = Utils::UpdateCrc(0, Blank.constData(), FLASH_PAGE_SIZE);
+
+    for(; Len >= FLASH_PAGE_SIZE; Len -= FLASH_PAGE_SIZE)
+    {
+        crc = Utils::CombineCrc(crc, BlankCrc, FLASH_PAGE_SIZE);
+    }
+
+    return Utils::UpdateCrc(crc, Blank.constData(), Len);
+}
+
+/****************************************************************************
+ * Starts folding the records sent into the verify CRC, over the range
+ * VerifyFlash() uses.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::StartProgramCrc()
+{
+    unsigned int MinAddress;
+    unsigned int MaxAddress;
+
+    ProgramCrc.Generation = ImageGeneration;
+    ProgramCrc.crc = 0;
+    ProgramCrc.Record.ExtSegAddress = 0;
+    ProgramCrc.Record.ExtLinAddress = 0;
+    ProgramCrc.Writable = Profile.WritableRanges();
+    ProgramCrc.InOrder = true;
+    ProgramCrc.Done = false;
+
+    if(HexStream)
+    {
+        // Known from the stream scan.
+        ProgramCrc.StartAddress = VerifyInfo.StartAddress;
+        ProgramCrc.ProgLen = VerifyInfo.ProgLen;
+    }
+    else if(VirtualFlash.IsEmpty())
+    {
+        ProgramCrc.StartAddress = 0;
+        ProgramCrc.ProgLen = 0;
+    }
+    else
+    {
+        MinAddress = VirtualFlash.MinAddress;
+        MaxAddress = VirtualFlash.MaxAddress;
+
+        MinAddress -= MinAddress % 4;
+        MaxAddress += MaxAddress % 4;
+
+        ProgramCrc.StartAddress = MinAddress;
+        ProgramCrc.ProgLen = MaxAddress - MinAddress;
+    }
+
+    ProgramCrc.NextAddress = ProgramCrc.StartAddress;
+}
+
+/****************************************************************************
+ * Folds the bytes of a record being sent into the verify CRC. Gaps read as
+ * erased flash. Data that goes back in address order stops the folding,
+ * VerifyFlash() then uses the image.
+ *
+ * \param  Rec: Decoded record.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::FoldProgramCrc(const unsigned char *Rec)
+{
+    T_HEX_RECORD &HexRecordSt = ProgramCrc.Record;
+    quint64 Begin;
+    quint64 Address;
+    quint64 End = (quint64)ProgramCrc.StartAddress + ProgramCrc.ProgLen;
+    unsigned int Len;
+
+    DecodeRecordAddress(&HexRecordSt, Rec);
+
+    if(HexRecordSt.RecType == END_OF_FILE_RECORD)
+    {
+        FinishProgramCrc();
+        return;
+    }
+
+    if((HexRecordSt.RecType != DATA_RECORD) || !ProgramCrc.InOrder || ProgramCrc.Done)
+    {
+        return;
+    }
+
+    // Only the bytes the device writes, as in the image.
+    Begin = Profile.Translate(HexRecordSt.Address);
+    Address = Begin;
+    while((Len = GDeviceProfile::NextWritable(ProgramCrc.Writable, &Address, Begin + HexRecordSt.RecDataLen)) != 0)
+    {
+        if((Address < ProgramCrc.NextAddress) || ((Address + Len) > End))
+        {
+            ProgramCrc.InOrder = false;
+            return;
+        }
+
+        ProgramCrc.crc = UpdateCrcBlank(ProgramCrc.crc, Address - ProgramCrc.NextAddress);
+        ProgramCrc.crc = Utils::UpdateCrc(ProgramCrc.crc, (const char*)HexRecordSt.Data + (Address - Begin), Len);
+        Address += Len;
+        ProgramCrc.NextAddress = Address;
+    }
+}
+
+/****************************************************************************
+ * Every record has been sent. Completes the verify CRC up to the end of the
+ * range.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexManager::FinishProgramCrc()
+{
+    if(ProgramCrc.Done)
+    {
+        return;
+    }
+
+    if(ProgramCrc.InOrder)
+    {
+        ProgramCrc.crc = UpdateCrcBlank(ProgramCrc.crc,
+                                        (quint64)ProgramCrc.StartAddress + ProgramCrc.ProgLen - ProgramCrc.NextAddress);
+        ProgramCrc.NextAddress = (quint64)ProgramCrc.StartAddress + ProgramCrc.ProgLen;
+    }
+    ProgramCrc.Done = true;
+}
+
+/****************************************************************************
+ * Verifies flash
+ *
+ * \param  StartAddress: Pointer to program start address
+ * \param  ProgLen: Pointer to Program length in bytes
+ * \param  crc : Pointer to CRC
+ * \return
+ *****************************************************************************/
+void GHexManager::VerifyFlash(unsigned int *StartAdress, unsigned int *ProgLen, unsigned short *crc)
+{
+    unsigned int MaxAddress;
+    unsigned int MinAddress;
+
+    if((VerifyInfo.Generation != ImageGeneration) && (ImageGeneration != 0) &&
+       (ProgramCrc.Generation == ImageGeneration) && ProgramCrc.Done && ProgramCrc.InOrder)
+    {
+        // Folded while the records were sent, nothing left to calculate.
+        VerifyInfo.StartAddress = ProgramCrc.StartAddress;
+        VerifyInfo.ProgLen = ProgramCrc.ProgLen;
+        VerifyInfo.crc = ProgramCrc.crc;
+        VerifyInfo.Generation = ImageGeneration;
+    }
+
+    if((VerifyInfo.Generation != ImageGeneration) && AnalysisWatcher.isRunning())
+    {
+        // Asked before the worker is done. Wait for it rather than doing the
+        // work twice.
+        AnalysisWatcher.waitForFinished();
+        ApplyAnalysis(AnalysisWatcher.result());
+    }
+
+    if((VerifyInfo.Generation != ImageGeneration) || (ImageGeneration == 0))
+    {
+        // Image changed since the last call. Recalculate.
+        if(VirtualFlash.IsEmpty())
+        {
+            // Nothing to verify.
+            VerifyInfo.StartAddress = 0;
+            VerifyInfo.ProgLen = 0;
+            VerifyInfo.crc = 0;
+        }
+        else
+        {
+            MinAddress = VirtualFlash.MinAddress;
+            MaxAddress = VirtualFlash.MaxAddress;
+
+            MinAddress -= MinAddress % 4;
+            MaxAddress += MaxAddress % 4;
+
+            VerifyInfo.ProgLen = MaxAddress - MinAddress;
+            VerifyInfo.StartAddress = MinAddress;
+            VerifyInfo.crc = VirtualFlash.CalculateCrc(MinAddress, VerifyInfo.ProgLen);
+        }
+        VerifyInfo.Generation = ImageGeneration;
+    }
+
+    *StartAdress = VerifyInfo.StartAddress;
+    *ProgLen = VerifyInfo.ProgLen;
+    *crc = VerifyInfo.crc;
+}
+
+/****************************************************************************
+ * Splits the verify range in pieces of whole pages, so that a failure can be
+ * located.
+ *
+ * \param  Count: Maximum number of pieces.
+ * \param
+ * \param
+ * \return Ranges covering the VerifyFlash() range, empty if there is none.
+ *****************************************************************************/
+QVector<T_MEMORY_RANGE> GHexManager::VerifyRanges(int Count)
+{
+    QVector<T_MEMORY_RANGE> Ranges;
+    T_MEMORY_RANGE Range;
+    unsigned int StartAddress;
+    unsigned int ProgLen;
+    unsigned int Piece;
+    unsigned short crc;
+
+    VerifyFlash(&StartAddress, &ProgLen, &crc);
+
+    if((ProgLen == 0) || (Count <= 0))
+    {
+        return Ranges;
+    }
+
+    // Whole pages, rounded up.
+    Piece = (ProgLen + Count - 1) / Count;
+    Piece = (Piece + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+
+    Range.End = StartAddress;
+    while(Range.End != StartAddress + ProgLen)
+    {
+        Range.Begin = Range.End;
+        Range.End = (StartAddress + ProgLen - Range.Begin > Piece) ? (Range.Begin + Piece) : (StartAddress + ProgLen);
+        Ranges.append(Range);
+    }
+
+    return Ranges;
+}
+
+/****************************************************************************
+ * Calculates the digest the device should report for a range.
+ *
+ * \param  Algorithm: Digest.
+ * \param  Range: Device addresses.
+ * \param
+ * \return Digest, empty if it cannot be calculated (streamed images).
+ *****************************************************************************/
+QByteArray GHexManager::CalculateDigest(T_DIGEST_ALGORITHM Algorithm, const T_MEMORY_RANGE &Range) const
+{
+    if(HexStream || (Range.End < Range.Begin))
+    {
+        return QByteArray();
+    }
 
-    *ProgLen = HexRecordSt.MaxAddress - HexRecordSt.MinAddress;
-    *StartAdress = HexRecordSt.MinAddress;
-    VirtualFlashAdrs = PA_TO_VFA(HexRecordSt.MinAddress);
-    *crc = Utils::CalculateCrc((char*)&VirtualFlash[VirtualFlashAdrs], *ProgLen);
+    return VirtualFlash.CalculateDigest(Algorithm, Range.Begin, Range.End - Range.Begin);
 }
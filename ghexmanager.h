@@ -4,6 +4,23 @@
 #include <QObject>
 
 #include <QFile>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+
+#include "gdeviceprofile.h"
+#include "gflashimage.h"
+#include "gframecodec.h"
+
+class GHexStream;
+class QFileSystemWatcher;
+
+#define DATA_RECORD 		0
+#define END_OF_FILE_RECORD 	1
+#define EXT_SEG_ADRS_RECORD 2
+#define EXT_LIN_ADRS_RECORD 4
 
 typedef struct
 {
@@ -18,6 +35,90 @@ typedef struct
     unsigned int ExtLinAddress;
 }T_HEX_RECORD;
 
+typedef struct
+{
+    unsigned int Address;       // Absolute address of the first byte.
+    unsigned int Length;        // Number of bytes in the segment.
+    unsigned int Offset;        // Offset of the first byte in ImageData.
+}T_HEX_SEGMENT;
+
+typedef struct
+{
+    unsigned int Address;       // First byte covered by both files.
+    unsigned int Length;
+    int File;                   // Index of the files in the merge.
+    int OtherFile;
+    bool Conflict;              // The files disagree on some of the bytes.
+}T_HEX_OVERLAP;
+
+typedef struct
+{
+    unsigned int Generation;    // Image generation the values belong to.
+    unsigned int StartAddress;
+    unsigned int ProgLen;
+    unsigned short crc;
+}T_VERIFY_INFO;
+
+// Format of the program data in the frames.
+typedef enum
+{
+    PAYLOAD_HEX_RECORDS,        // Hex records, as in the file (PROGRAM_FLASH).
+    PAYLOAD_RUNS                // Address, length and data runs (PROGRAM_RUNS).
+}T_PAYLOAD;
+
+// How the program frames go on the wire.
+typedef struct
+{
+    T_FRAMING Framing;
+    int PacketLen;                      // Longest packet, SOH to EOT.
+    T_PAYLOAD Payload;                  // Program data format.
+    bool Sequenced;                     // Sent as PROGRAM_SEQ frames.
+}T_LINK_FORMAT;
+
+typedef struct
+{
+    unsigned int Generation;            // Image generation the values belong to.
+    unsigned int StartAddress;          // Verify range and CRC, as VerifyFlash().
+    unsigned int ProgLen;
+    unsigned short crc;
+    QVector<unsigned int> Pages;        // Flash pages written by the image.
+    QVector<unsigned short> PageCrcs;   // CRC of each page.
+    unsigned int WireBytes;             // Program frame bytes on the wire, framing included.
+    T_LINK_FORMAT Link;                 // Link WireBytes is counted for.
+}T_IMAGE_ANALYSIS;
+
+typedef struct
+{
+    unsigned int Generation;            // Image generation being programmed.
+    unsigned int StartAddress;          // Verify range, as VerifyFlash().
+    unsigned int ProgLen;
+    quint64 NextAddress;                // Bytes below are folded into crc.
+    unsigned short crc;
+    T_HEX_RECORD Record;                // Address state of the records sent.
+    QVector<T_MEMORY_RANGE> Writable;
+    bool InOrder;                       // Data came in address order, crc is usable.
+    bool Done;                          // Every record has been sent.
+}T_PROGRAM_CRC;
+
+// Piece of a hex file decoded on its own by ParseHexChunk().
+typedef struct
+{
+    const char *Begin;              // First line of the chunk
+    const char *End;                // One past the last line
+    unsigned int OutOffset;         // Where the records are decoded to
+    unsigned int OutSize;           // Room available at OutOffset
+    unsigned int OutLen;            // Bytes of records decoded
+    QVector<unsigned int> Offsets;  // Record offsets, relative to OutOffset
+    QVector<T_HEX_SEGMENT> Runs;    // Data records, offsets relative to OutOffset
+    int Parsed;                     // Records in ParsedRecords, -1 if decoded anew
+    int Unresolved;                 // Leading runs still missing the extended address
+    bool AddressChanged;            // The chunk holds a record that sets the address
+    unsigned int ExtSegAddress;     // Extended addresses at the end of the chunk
+    unsigned int ExtLinAddress;
+    bool EndOfFile;
+    bool Error;
+}T_PARSE_CHUNK;
+
 class GHexManager : public QObject
 {
     Q_OBJECT
@@ -29,18 +130,124 @@ public:
 
     unsigned int HexTotalLines;
     unsigned int HexCurrLineNo;
+    // Incremented every time the image changes. Zero means no image.
+    unsigned int ImageGeneration;
+    // Stream hex files record by record instead of holding them in memory.
+    // Files above STREAM_THRESHOLD are always streamed.
+    bool StreamMode;
+    // Threads used to parse large hex files. Zero uses one per core.
+    int ParseThreads;
+    // Analyze loaded images on a worker thread. Otherwise the analysis is
+    // part of the load.
+    bool BackgroundAnalysis;
     bool ResetHexFilePointer(void);
     bool LoadHexFile(void);
+    bool LoadHexFile(const QString &Path, unsigned int BaseAddress = 0);
+    bool LoadHexFiles(const QStringList &Paths, const QVector<unsigned int> &BaseAddresses = QVector<unsigned int>());
     int GetNextHexRecord(char *HexRec, unsigned int BuffLen);
+    const char *PeekHexRecord(unsigned int *Len);
+    void ConsumeHexRecord(void);
     void VerifyFlash(unsigned int* StartAdress, unsigned int* ProgLen, unsigned short* crc);
+    QVector<T_MEMORY_RANGE> VerifyRanges(int Count);
+    QByteArray CalculateDigest(T_DIGEST_ALGORITHM Algorithm, const T_MEMORY_RANGE &Range) const;
+    static void DecodeRecordAddress(T_HEX_RECORD *HexRecordSt, const unsigned char *Rec);
+    static bool ParseHexText(const QByteArray &Ascii, int Threads, QByteArray *Records,
+                             QVector<unsigned int> *Offsets, QVector<T_HEX_SEGMENT> *Runs);
+    void SetWatchMode(bool Enable);
+    void SetLinkFormat(const T_LINK_FORMAT &Format);
+    bool SetDeviceProfile(const GDeviceProfile &DeviceProfile);
+    const GDeviceProfile &GetDeviceProfile(void) const;
+
+    // Image model, built once by LoadHexFile().
+    QVector<T_HEX_SEGMENT> HexSegments;
+    QByteArray ImageData;
+    // Image as seen by the device flash (KVA0 addresses, boot sector excluded).
+    GFlashImage VirtualFlash;
+    // Overlaps found by the last LoadHexFiles().
+    QVector<T_HEX_OVERLAP> HexOverlaps;
 
 signals:
+    // A watched file was reloaded. ChangedPages lists the address of the
+    // device pages (GDeviceProfile::PageSize) that differ from the previous
+    // image.
+    void HexFileReloaded(bool Ok, const QVector<unsigned int> &ChangedPages, unsigned int ChangedBytes);
+    // The analysis of the loaded image is available. Not emitted for
+    // streamed images, their verify data comes with the load.
+    void ImageAnalysisReady(unsigned int Pages, unsigned int WireBytes);
 
 public slots:
 
+private slots:
+    void OnHexFileChanged(const QString &Path);
+    void ReloadWatchedFiles(void);
+    void OnAnalysisFinished(void);
+
 private:
-    QString HexFilePath;
-    QFile *HexFilePtr;
+    // Files the image was loaded from, and their load addresses.
+    QStringList HexFilePaths;
+    QVector<unsigned int> HexBaseAddresses;
+
+    // Decoded hex records, back to back, in file order.
+    QByteArray HexRecords;
+    // Offset of each record in HexRecords, plus one past the last record.
+    QVector<unsigned int> HexRecordOffsets;
+
+    // Last hex file parsed in watch mode, its chunks and their records, as
+    // decoded (not pruned). The chunks the next build leaves untouched are
+    // not decoded again.
+    QByteArray ParsedText;
+    QByteArray ParsedRecords;
+    QVector<T_PARSE_CHUNK> ParsedChunks;
+
+    // Memoized result of VerifyFlash().
+    T_VERIFY_INFO VerifyInfo;
+    // Verify CRC folded from the records as they are sent.
+    T_PROGRAM_CRC ProgramCrc;
+    // Image analysis, and the worker calculating it.
+    T_IMAGE_ANALYSIS Analysis;
+    // Link of the device connected last, DLE and TX_PACKET_LEN before any.
+    T_LINK_FORMAT LinkFormat;
+    QFutureWatcher<T_IMAGE_ANALYSIS> AnalysisWatcher;
+    // Image cache to write once the analysis is done.
+    QString PendingCachePath;
+    QFileInfo PendingCacheInfo;
+    QByteArray PendingCacheHash;
+    unsigned int GenerationCounter;
+
+    // Mapped image cache backing HexRecords and ImageData, if any.
+    QFile *CacheFile;
+    // Load address of raw binary images.
+    unsigned int ImageBaseAddress;
+    // Open stream, when the image is streamed.
+    GHexStream *HexStream;
+    // Record read from the stream by PeekHexRecord(), not consumed yet.
+    QByteArray StreamRecord;
+    int StreamRecordLen;
+    // Memory map of the target.
+    GDeviceProfile Profile;
+    // Watch mode.
+    QFileSystemWatcher *Watcher;
+    QTimer WatchTimer;
+
+    void ReleaseImage(void);
+    void ReleaseParsedText(void);
+    void CommitImage(const QStringList &Paths, const QVector<unsigned int> &BaseAddresses);
+    bool LoadHexStream(const QString &Path);
+    bool LoadImageCache(const QString &Path, const QFileInfo &Info, const QByteArray &Hash);
+    void SaveImageCache(const QString &Path, const QFileInfo &Info, const QByteArray &Hash);
+    bool ParseImage(const QString &Path, const unsigned char *Data, qint64 Size);
+    bool ParseHexFile(const QByteArray &Ascii, QVector<T_HEX_SEGMENT> *Runs);
+    void BuildSegments(const QVector<T_HEX_SEGMENT> &Runs, const char *Source);
+    void BuildHexRecords(void);
+    void AppendHexRecord(unsigned char *Rec);
+    void BuildVirtualFlash(void);
+    void PruneHexRecords(void);
+    bool ReloadImage(void);
+    void StartAnalysis(void);
+    void ApplyAnalysis(const T_IMAGE_ANALYSIS &Result);
+    void StartProgramCrc(void);
+    void FoldProgramCrc(const unsigned char *Rec);
+    void FinishProgramCrc(void);
 
 };
 
@@ -0,0 +1,359 @@
+#include "ghexstream.h"
+
+#include "utils.h"
+
+#include <string.h>
+
+GHexStream::GHexStream()
+{
+    EndOfFile = false;
+    ResetWindow();
+}
+
+GHexStream::~GHexStream()
+{
+    Close();
+}
+
+/****************************************************************************
+ * Opens a hex file for streaming.
+ *
+ * \param  Path: Hex file path.
+ * \param  DeviceProfile: Memory map of the target device.
+ * \param
+ * \return true if the file could be opened.
+ *****************************************************************************/
+bool GHexStream::Open(const QString &Path, const GDeviceProfile &DeviceProfile)
+{
+    Close();
+    Profile = DeviceProfile;
+    Writable = Profile.WritableRanges();
+    File.setFileName(Path);
+
+    if(!File.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+
+    return Rewind();
+}
+
+/****************************************************************************
+ * Closes the file.
+ *
+ * \param
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexStream::Close()
+{
+    if(File.isOpen())
+    {
+        File.close();
+    }
+}
+
+/****************************************************************************
+ * Goes back to the first record.
+ *
+ * \param
+ * \param
+ * \param
+ * \return true on success.
+ *****************************************************************************/
+bool GHexStream::Rewind()
+{
+    HexRecordSt.ExtSegAddress = 0;
+    HexRecordSt.ExtLinAddress = 0;
+    HexRecordSt.RecType = DATA_RECORD;
+    EndOfFile = false;
+
+    return File.isOpen() && File.seek(0);
+}
+
+/****************************************************************************
+ * Reads and decodes the next hex record.
+ *
+ * \param  HexRec: Pointer to HexRec.
+ * \param  BuffLen: Buffer Length
+ * \param
+ * \return Length of the hex record in bytes, 0 at the end of the file, -1 if
+ *         the record is not valid.
+ *****************************************************************************/
+int GHexStream::NextRecord(char *HexRec, unsigned int BuffLen)
+{
+    char Line[STREAM_LINE_LEN];
+    qint64 LineLen;
+    quint64 Address;
+    int RecLen;
+
+    while(!EndOfFile)
+    {
+        LineLen = File.readLine(Line, sizeof(Line));
+        if(LineLen <= 0)
+        {
+            EndOfFile = true;
+            break;
+        }
+
+        if(Line[LineLen - 1] != '\n')
+        {
+            if(!File.atEnd())
+            {
+                // Longer than any valid record.
+                return -1;
+            }
+        }
+
+        while((LineLen > 0) && ((Line[LineLen - 1] == '\n') || (Line[LineLen - 1] == '\r') || (Line[LineLen - 1] == ' ')))
+        {
+            LineLen--;
+        }
+
+        if(LineLen == 0)
+        {
+            // Blank line.
+            continue;
+        }
+
+        RecLen = Utils::DecodeHexRecord(Line, LineLen, (unsigned char*)HexRec, BuffLen);
+        if(RecLen < 0)
+        {
+            return -1;
+        }
+
+        GHexManager::DecodeRecordAddress(&HexRecordSt, (const unsigned char*)HexRec);
+
+        switch(HexRecordSt.RecType)
+        {
+        case DATA_RECORD:
+            Address = Profile.Translate(HexRecordSt.Address);
+            if(GDeviceProfile::NextWritable(Writable, &Address, Address + HexRecordSt.RecDataLen) == 0)
+            {
+                // Nothing the device can write.
+                continue;
+            }
+            break;
+
+        case END_OF_FILE_RECORD:
+            EndOfFile = true;
+            break;
+
+        case EXT_SEG_ADRS_RECORD:
+        case EXT_LIN_ADRS_RECORD:
+            break;
+
+        default:
+            // Start address records are of no use to the device.
+            continue;
+        }
+
+        return RecLen;
+    }
+
+    return 0;
+}
+
+/****************************************************************************
+ * Reads the whole file once: validates every record, counts them and
+ * calculates the verify CRC through a fixed window of pages. Data must come
+ * in ascending address order, though it may go back up to
+ * STREAM_WINDOW_PAGES - 1 pages below the highest page written.
+ *
+ * \param  Records: Receives the number of records.
+ * \param  StartAddress: Receives the program start address
+ * \param  ProgLen: Receives the program length in bytes
+ * \param  crc: Receives the CRC. Same as GHexManager::VerifyFlash().
+ * \return false if a record is not valid or the data is out of order.
+ *****************************************************************************/
+bool GHexStream::Scan(unsigned int *Records, unsigned int *StartAddress, unsigned int *ProgLen, unsigned short *crc)
+{
+    char HexRec[STREAM_LINE_LEN / 2];
+    quint64 Begin;
+    quint64 ProgAddress;
+    unsigned int Len;
+    unsigned int EndAddress;
+    int RecLen;
+
+    *Records = 0;
+    ResetWindow();
+
+    if(!Rewind())
+    {
+        return false;
+    }
+
+    while((RecLen = NextRecord(HexRec, sizeof(HexRec))) > 0)
+    {
+        (*Records)++;
+
+        if((HexRecordSt.RecType != DATA_RECORD) || (HexRecordSt.RecDataLen == 0))
+        {
+            continue;
+        }
+
+        // Only the bytes the device writes.
+        Begin = Profile.Translate(HexRecordSt.Address);
+        ProgAddress = Begin;
+        while((Len = GDeviceProfile::NextWritable(Writable, &ProgAddress, Begin + HexRecordSt.RecDataLen)) != 0)
+        {
+            WriteWindow(ProgAddress, HexRecordSt.Data + (ProgAddress - Begin), Len);
+            ProgAddress += Len;
+        }
+    }
+
+    if((RecLen < 0) || !Ordered)
+    {
+        Rewind();
+        return false;
+    }
+
+    if(!WindowStarted)
+    {
+        // Nothing to verify.
+        *StartAddress = 0;
+        *ProgLen = 0;
+        *crc = 0;
+    }
+    else
+    {
+        MinAddress -= MinAddress % 4;
+        EndAddress = MaxAddress + (MaxAddress % 4);
+
+        // Fold in what is left in the window, up to the end of the range.
+        while(CrcAddress < EndAddress)
+        {
+            FlushPage(EndAddress);
+        }
+
+        *StartAddress = MinAddress;
+        *ProgLen = EndAddress - MinAddress;
+        *crc = RunningCrc;
+    }
+
+    return Rewind();
+}
+
+/****************************************************************************
+ * Empties the CRC window.
+ *****************************************************************************/
+void GHexStream::ResetWindow()
+{
+    Window.fill((char)0xFF, STREAM_WINDOW_PAGES * FLASH_PAGE_SIZE);
+    WindowBase = 0;
+    WindowStarted = false;
+    Ordered = true;
+    MinAddress = 0xFFFFFFFF;
+    MaxAddress = 0;
+    CrcAddress = 0;
+    CrcStarted = false;
+    RunningCrc = 0;
+}
+
+/****************************************************************************
+ * Writes data into the window, sliding it forward as needed. The window
+ * ends at the highest page written, so that the pages below it can still be
+ * written.
+ *
+ * \param  Address: Flash address of the first byte.
+ * \param  Data: Pointer to the data.
+ * \param  Len: Number of bytes.
+ * \return
+ *****************************************************************************/
+void GHexStream::WriteWindow(unsigned int Address, const unsigned char *Data, unsigned int Len)
+{
+    unsigned int Page;
+    unsigned int Offset;
+    unsigned int Chunk;
+
+    while(Len)
+    {
+        Page = Address >> FLASH_PAGE_SHIFT;
+        Offset = Address & (FLASH_PAGE_SIZE - 1);
+        Chunk = FLASH_PAGE_SIZE - Offset;
+        if(Chunk > Len)
+        {
+            Chunk = Len;
+        }
+
+        if(!WindowStarted)
+        {
+            WindowBase = (Page >= (STREAM_WINDOW_PAGES - 1)) ? (Page - (STREAM_WINDOW_PAGES - 1)) : 0;
+            WindowStarted = true;
+        }
+
+        if(Page < WindowBase)
+        {
+            // This page has been folded into the CRC already.
+            Ordered = false;
+            return;
+        }
+
+        while(Page >= (WindowBase + STREAM_WINDOW_PAGES))
+        {
+            FlushPage(0);
+        }
+
+        memcpy(Window.data() + (Page % STREAM_WINDOW_PAGES) * FLASH_PAGE_SIZE + Offset, Data, Chunk);
+
+        if(MinAddress > Address)
+        {
+            MinAddress = Address;
+        }
+        if(MaxAddress < (Address + Chunk))
+        {
+            MaxAddress = Address + Chunk;
+        }
+
+        Address += Chunk;
+        Data += Chunk;
+        Len -= Chunk;
+    }
+}
+
+/****************************************************************************
+ * Folds the lowest page of the window into the CRC and releases it.
+ *
+ * \param  EndAddress: Stop the CRC at this address. 0 folds the whole page.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GHexStream::FlushPage(unsigned int EndAddress)
+{
+    char *Slot = Window.data() + (WindowBase % STREAM_WINDOW_PAGES) * FLASH_PAGE_SIZE;
+    unsigned int PageAddress = WindowBase << FLASH_PAGE_SHIFT;
+    unsigned int PageEnd = PageAddress + FLASH_PAGE_SIZE;
+    unsigned int Start;
+
+    if(!CrcStarted)
+    {
+        if(MinAddress >= PageEnd)
+        {
+            // No data up to here.
+            memset(Slot, 0xFF, FLASH_PAGE_SIZE);
+            WindowBase++;
+            return;
+        }
+        // Nothing below this page can be written any more, so the start of
+        // the range is known.
+        CrcAddress = MinAddress - (MinAddress % 4);
+        CrcStarted = true;
+    }
+
+    if((EndAddress == 0) || (EndAddress > PageEnd) || (EndAddress < PageAddress))
+    {
+        EndAddress = PageEnd;
+    }
+
+    Start = (CrcAddress > PageAddress) ? CrcAddress : PageAddress;
+    if(EndAddress > Start)
+    {
+        RunningCrc = Utils::UpdateCrc(RunningCrc, Slot + (Start - PageAddress), EndAddress - Start);
+        CrcAddress = EndAddress;
+    }
+
+    memset(Slot, 0xFF, FLASH_PAGE_SIZE);
+    WindowBase++;
+}
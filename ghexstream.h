@@ -0,0 +1,56 @@
+#ifndef GHEXSTREAM_H
+#define GHEXSTREAM_H
+
+#include <QByteArray>
+#include <QFile>
+
+#include "ghexmanager.h"
+
+// Pages of the sliding window used to compute the verify CRC.
+#define STREAM_WINDOW_PAGES 64
+// Longest hex record line: ':' + 2 * (5 + 255) digits + line ending.
+#define STREAM_LINE_LEN     528
+
+// Reads a hex file one record at a time, with memory use independent of the
+// file size. Used for images too large to hold in memory. Only the records
+// the device can use are returned; data records are not cut down.
+class GHexStream
+{
+public:
+    //  Constructor
+    GHexStream();
+    //  Destructor
+    ~GHexStream();
+
+    bool Open(const QString &Path, const GDeviceProfile &DeviceProfile);
+    void Close(void);
+    bool Rewind(void);
+    int NextRecord(char *HexRec, unsigned int BuffLen);
+    bool Scan(unsigned int *Records, unsigned int *StartAddress, unsigned int *ProgLen, unsigned short *crc);
+
+private:
+    QFile File;
+    T_HEX_RECORD HexRecordSt;
+    bool EndOfFile;
+
+    // Memory map of the target. Records it would ignore are skipped.
+    GDeviceProfile Profile;
+    QVector<T_MEMORY_RANGE> Writable;
+
+    // Verify CRC state.
+    QByteArray Window;              // STREAM_WINDOW_PAGES pages, indexed by page % STREAM_WINDOW_PAGES
+    unsigned int WindowBase;        // Lowest page held by the window
+    bool WindowStarted;
+    bool Ordered;                   // false once data went below the window
+    unsigned int MinAddress;
+    unsigned int MaxAddress;
+    unsigned int CrcAddress;        // Next address to fold into the CRC
+    bool CrcStarted;
+    unsigned short RunningCrc;
+
+    void ResetWindow(void);
+    void WriteWindow(unsigned int Address, const unsigned char *Data, unsigned int Len);
+    void FlushPage(unsigned int EndAddress);
+};
+
+#endif // GHEXSTREAM_H
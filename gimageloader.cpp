@@ -0,0 +1,320 @@
+#include "gimageloader.h"
+
+#include "utils.h"
+
+#include <QFileInfo>
+
+#include <string.h>
+
+#define EI_CLASS        4
+#define EI_DATA         5
+#define ELFCLASS32      1
+#define ELFCLASS64      2
+#define ELFDATA2MSB     2
+#define EM_MIPS         8
+#define PT_LOAD         1
+
+// MIPS kernel segments (KSEG0/KSEG1) to physical address.
+#define KSEG_BEGIN      0x80000000ULL
+#define KSEG_END        0xC0000000ULL
+#define KVA_TO_PA(x)    ((x) & 0x1FFFFFFF)
+
+// Largest S-record: 255 bytes after the count.
+#define SREC_MAX_LEN    256
+
+static quint64 ReadElf(const unsigned char *p, int Len, bool BigEndian)
+{
+    quint64 Value = 0;
+
+    for(int i = 0; i < Len; i++)
+    {
+        Value |= (quint64)p[BigEndian ? (Len - 1 - i) : i] << (8 * i);
+    }
+
+    return Value;
+}
+
+/****************************************************************************
+ * Detects the format of an image from its contents and extension.
+ *
+ * \param  Path: File path.
+ * \param  Data: File contents.
+ * \param  Size: File size.
+ * \return Image format.
+ *****************************************************************************/
+T_IMAGE_FORMAT GImageLoader::DetectFormat(const QString &Path, const unsigned char *Data, qint64 Size)
+{
+    qint64 i = 0;
+
+    if((Size >= 4) && (memcmp(Data, "\177ELF", 4) == 0))
+    {
+        return ELF_FORMAT;
+    }
+
+    if(QFileInfo(Path).suffix().toLower() == "bin")
+    {
+        return BIN_FORMAT;
+    }
+
+    // Text formats are told apart by their first record.
+    while((i < Size) && ((Data[i] == ' ') || (Data[i] == '\r') || (Data[i] == '\n')))
+    {
+        i++;
+    }
+
+    if((i < Size) && (Data[i] == 'S'))
+    {
+        return SREC_FORMAT;
+    }
+
+    return HEX_FORMAT;
+}
+
+/****************************************************************************
+ * Loads the PT_LOAD segments of an ELF file (32 or 64 bit, either endian).
+ * MIPS kernel segment addresses are translated to physical addresses, as
+ * the hex records of the tool chain are.
+ *
+ * \param  Data: File contents.
+ * \param  Size: File size.
+ * \param  Runs: Receives the segments. Offsets point into Data.
+ * \return false if the file is not a valid ELF file.
+ *****************************************************************************/
+bool GImageLoader::LoadElf(const unsigned char *Data, qint64 Size, QVector<T_HEX_SEGMENT> *Runs)
+{
+    bool Is64;
+    bool BigEndian;
+    unsigned int Machine;
+    quint64 PhOff;
+    unsigned int PhEntSize;
+    unsigned int PhNum;
+    const unsigned char *Ph;
+    quint64 Offset;
+    quint64 Address;
+    quint64 FileSize;
+    T_HEX_SEGMENT Run;
+
+    if((Size < 52) || (memcmp(Data, "\177ELF", 4) != 0))
+    {
+        return false;
+    }
+
+    Is64 = (Data[EI_CLASS] == ELFCLASS64);
+    BigEndian = (Data[EI_DATA] == ELFDATA2MSB);
+
+    if(!Is64 && (Data[EI_CLASS] != ELFCLASS32))
+    {
+        return false;
+    }
+
+    if(Is64 && (Size < 64))
+    {
+        return false;
+    }
+
+    Machine = ReadElf(Data + 18, 2, BigEndian);
+    if(Is64)
+    {
+        PhOff = ReadElf(Data + 32, 8, BigEndian);
+        PhEntSize = ReadElf(Data + 54, 2, BigEndian);
+        PhNum = ReadElf(Data + 56, 2, BigEndian);
+    }
+    else
+    {
+        PhOff = ReadElf(Data + 28, 4, BigEndian);
+        PhEntSize = ReadElf(Data + 42, 2, BigEndian);
+        PhNum = ReadElf(Data + 44, 2, BigEndian);
+    }
+
+    if((PhEntSize < (Is64 ? 56U : 32U)) || ((PhOff + (quint64)PhEntSize * PhNum) > (quint64)Size))
+    {
+        return false;
+    }
+
+    for(unsigned int i = 0; i < PhNum; i++)
+    {
+        Ph = Data + PhOff + (quint64)i * PhEntSize;
+
+        if(ReadElf(Ph, 4, BigEndian) != PT_LOAD)
+        {
+            continue;
+        }
+
+        if(Is64)
+        {
+            Offset = ReadElf(Ph + 8, 8, BigEndian);
+            Address = ReadElf(Ph + 24, 8, BigEndian);   // p_paddr
+            FileSize = ReadElf(Ph + 32, 8, BigEndian);
+        }
+        else
+        {
+            Offset = ReadElf(Ph + 4, 4, BigEndian);
+            Address = ReadElf(Ph + 12, 4, BigEndian);   // p_paddr
+            FileSize = ReadElf(Ph + 16, 4, BigEndian);
+        }
+
+        if(FileSize == 0)
+        {
+            // .bss and friends, nothing to program.
+            continue;
+        }
+
+        if(((Offset + FileSize) > (quint64)Size) || ((Address + FileSize) > 0x100000000ULL))
+        {
+            return false;
+        }
+
+        if((Machine == EM_MIPS) && (Address >= KSEG_BEGIN) && (Address < KSEG_END))
+        {
+            Address = KVA_TO_PA(Address);
+        }
+
+        Run.Address = Address;
+        Run.Length = FileSize;
+        Run.Offset = Offset;
+        Runs->append(Run);
+    }
+
+    return true;
+}
+
+/****************************************************************************
+ * Loads a raw binary image.
+ *
+ * \param  Data: File contents.
+ * \param  Size: File size.
+ * \param  BaseAddress: Address of the first byte.
+ * \param  Runs: Receives the image. Offsets point into Data.
+ * \return false if the image does not fit in the address space.
+ *****************************************************************************/
+bool GImageLoader::LoadBin(const unsigned char *Data, qint64 Size, unsigned int BaseAddress, QVector<T_HEX_SEGMENT> *Runs)
+{
+    T_HEX_SEGMENT Run;
+
+    (void) Data;
+
+    if((Size <= 0) || (((quint64)BaseAddress + Size) > 0x100000000ULL))
+    {
+        return false;
+    }
+
+    Run.Address = BaseAddress;
+    Run.Length = Size;
+    Run.Offset = 0;
+    Runs->append(Run);
+
+    return true;
+}
+
+/****************************************************************************
+ * Loads a Motorola S-record file. Every record checksum is validated.
+ *
+ * \param  Data: File contents.
+ * \param  Size: File size.
+ * \param  Decoded: Receives the decoded data bytes.
+ * \param  Runs: Receives the data records. Offsets point into Decoded.
+ * \return false if a record is not valid.
+ *****************************************************************************/
+bool GImageLoader::LoadSrec(const unsigned char *Data, qint64 Size, QByteArray *Decoded, QVector<T_HEX_SEGMENT> *Runs)
+{
+    const char *Line = (const char*)Data;
+    const char *End = Line + Size;
+    const char *Eol;
+    unsigned int LineLen;
+    unsigned char Rec[SREC_MAX_LEN];
+    unsigned char Sum;
+    unsigned int AddrLen;
+    unsigned int Len;
+    unsigned int Address;
+    unsigned int DataOffset = 0;
+    T_HEX_SEGMENT Run;
+
+    // Data never exceeds half of the ascii size.
+    Decoded->resize(Size / 2);
+
+    while(Line < End)
+    {
+        Eol = static_cast<const char*>(memchr(Line, '\n', End - Line));
+        if(Eol == NULL)
+        {
+            Eol = End;
+        }
+
+        LineLen = Eol - Line;
+        while((LineLen > 0) && ((Line[LineLen - 1] == '\r') || (Line[LineLen - 1] == ' ')))
+        {
+            LineLen--;
+        }
+
+        if(LineLen == 0)
+        {
+            // Blank line.
+            Line = Eol + 1;
+            continue;
+        }
+
+        // Sn, count, address, data, checksum.
+        if((LineLen < 4) || (Line[0] != 'S') || (LineLen & 1) || (((LineLen - 2) / 2) > sizeof(Rec)))
+        {
+            return false;
+        }
+
+        Len = (LineLen - 2) / 2;
+        if(!Utils::HexToBin(Line + 2, Len, Rec, &Sum) || (Rec[0] != (Len - 1)) || (Sum != 0xFF))
+        {
+            // Bad digit, count or checksum.
+            return false;
+        }
+
+        switch(Line[1])
+        {
+        case '1':
+        case '2':
+        case '3':
+            AddrLen = Line[1] - '0' + 1;
+            if(Len < (AddrLen + 2))
+            {
+                return false;
+            }
+
+            Address = 0;
+            for(unsigned int i = 0; i < AddrLen; i++)
+            {
+                Address = (Address << 8) | Rec[1 + i];
+            }
+
+            Len = Len - AddrLen - 2;
+            if(Len)
+            {
+                memcpy(Decoded->data() + DataOffset, &Rec[1 + AddrLen], Len);
+                Run.Address = Address;
+                Run.Length = Len;
+                Run.Offset = DataOffset;
+                Runs->append(Run);
+                DataOffset += Len;
+            }
+            break;
+
+        case '7':
+        case '8':
+        case '9':
+            // Termination record.
+            Decoded->truncate(DataOffset);
+            return true;
+
+        case '0':   // Header
+        case '5':   // Record count
+        case '6':
+            break;
+
+        default:
+            return false;
+        }
+
+        Line = Eol + 1;
+    }
+
+    Decoded->truncate(DataOffset);
+
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef GIMAGELOADER_H
+#define GIMAGELOADER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include "ghexmanager.h"
+
+typedef enum
+{
+    HEX_FORMAT,     // Intel HEX
+    ELF_FORMAT,     // ELF executable, PT_LOAD segments
+    BIN_FORMAT,     // Raw binary at a base address
+    SREC_FORMAT     // Motorola S-records
+}T_IMAGE_FORMAT;
+
+// Loaders for the non Intel HEX image formats. Every loader produces data
+// runs (address, length and offset of the bytes) in file order, ready for
+// GHexManager to coalesce into segments.
+class GImageLoader
+{
+public:
+    static T_IMAGE_FORMAT DetectFormat(const QString &Path, const unsigned char *Data, qint64 Size);
+    static bool LoadElf(const unsigned char *Data, qint64 Size, QVector<T_HEX_SEGMENT> *Runs);
+    static bool LoadBin(const unsigned char *Data, qint64 Size, unsigned int BaseAddress, QVector<T_HEX_SEGMENT> *Runs);
+    static bool LoadSrec(const unsigned char *Data, qint64 Size, QByteArray *Decoded, QVector<T_HEX_SEGMENT> *Runs);
+};
+
+#endif // GIMAGELOADER_H
@@ -0,0 +1,368 @@
+#include "grecordpacker.h"
+
+#include <string.h>
+
+GRecordPacker::GRecordPacker(unsigned int RowSize, T_PAYLOAD Payload)
+{
+    Reset(RowSize, Payload);
+}
+
+/****************************************************************************
+ * Drops the data held and starts over, for a new programming pass.
+ *
+ * \param  RowSize: Flash row of the device, zero if unknown.
+ * \param  Payload: Format of the frames.
+ * \param
+ * \return
+ *****************************************************************************/
+void GRecordPacker::Reset(unsigned int RowSize, T_PAYLOAD Payload)
+{
+    this->RowSize = RowSize;
+    this->Payload = Payload;
+    RecordLen = ((RowSize != 0) && (RowSize < PACKER_RECORD_LEN)) ? RowSize : PACKER_RECORD_LEN;
+    HexRecordSt.ExtSegAddress = 0;
+    HexRecordSt.ExtLinAddress = 0;
+    Data.clear();
+    Runs.clear();
+}
+
+T_PAYLOAD GRecordPacker::GetPayload() const
+{
+    return Payload;
+}
+
+/****************************************************************************
+ * Whether more records should be added before the next Pack(), to fill the
+ * frame.
+ *****************************************************************************/
+bool GRecordPacker::NeedsRecords() const
+{
+    return Data.size() < PACKER_LOOKAHEAD;
+}
+
+/****************************************************************************
+ * Whether there is no data left to send.
+ *****************************************************************************/
+bool GRecordPacker::IsEmpty() const
+{
+    return Runs.isEmpty();
+}
+
+/****************************************************************************
+ * Adds the next record of the image. Only the data is kept, the addresses
+ * are sent again by Pack().
+ *
+ * \param  Rec: Decoded record.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GRecordPacker::AddRecord(const unsigned char *Rec)
+{
+    T_HEX_SEGMENT Run;
+
+    GHexManager::DecodeRecordAddress(&HexRecordSt, Rec);
+    if((HexRecordSt.RecType != DATA_RECORD) || (HexRecordSt.RecDataLen == 0))
+    {
+        return;
+    }
+
+    if(!Runs.isEmpty() && ((Runs.last().Address + Runs.last().Length) == HexRecordSt.Address))
+    {
+        // Goes on where the previous data ended.
+        Runs.last().Length += HexRecordSt.RecDataLen;
+    }
+    else
+    {
+        Run.Address = HexRecordSt.Address;
+        Run.Length = HexRecordSt.RecDataLen;
+        Run.Offset = Data.size();
+        Runs.append(Run);
+    }
+    Data.append((const char*)HexRecordSt.Data, HexRecordSt.RecDataLen);
+}
+
+/****************************************************************************
+ * Appends the data held to a frame. Stops when the frame is full; if data
+ * is left then, the frame ends on the last row boundary (or start of a run)
+ * it crossed. The rest goes in the next frames.
+ *
+ * \param  Encoder: Frame, command already appended.
+ * \param
+ * \param
+ * \return false if no data was appended.
+ *****************************************************************************/
+bool GRecordPacker::Pack(GFrameEncoder *Encoder)
+{
+    return (Payload == PAYLOAD_RUNS) ? PackRuns(Encoder) : PackRecords(Encoder);
+}
+
+/****************************************************************************
+ * Pack() as hex records, aligned to PACKER_RECORD_LEN.
+ *****************************************************************************/
+bool GRecordPacker::PackRecords(GFrameEncoder *Encoder)
+{
+    T_FRAME_MARK RecordMark;
+    T_FRAME_MARK RowMark;
+    int MarkRun = -1;
+    unsigned int MarkOffset = 0;
+    int Run = 0;
+    unsigned int Offset = 0;
+    unsigned int UpperAddress = 0;
+    bool UpperSent = false;
+    bool FrameData = false;
+    unsigned int Address;
+    unsigned int Len;
+    char Ext[2];
+
+    while(Run < Runs.size())
+    {
+        Address = Runs[Run].Address + Offset;
+
+        // A row or a run starts here, the frame may end before it.
+        if(FrameData && ((Offset == 0) || ((RowSize != 0) && ((Address % RowSize) == 0))))
+        {
+            RowMark = Encoder->Mark();
+            MarkRun = Run;
+            MarkOffset = Offset;
+        }
+
+        // Up to the next record boundary, without crossing 64 KB.
+        Len = RecordLen - (Address % RecordLen);
+        Len = qMin(Len, 0x10000 - (Address & 0xFFFF));
+        Len = qMin(Len, Runs[Run].Length - Offset);
+
+        RecordMark = Encoder->Mark();
+        if(!UpperSent || ((Address >> 16) != UpperAddress))
+        {
+            Ext[0] = static_cast<char>(Address >> 24);
+            Ext[1] = static_cast<char>(Address >> 16);
+            if(!AppendRecord(Encoder, EXT_LIN_ADRS_RECORD, 0, Ext, 2))
+            {
+                break;
+            }
+        }
+
+        // Only a frame too short for a whole record gets a shorter one.
+        while(!AppendRecord(Encoder, DATA_RECORD, Address, Data.constData() + Runs[Run].Offset + Offset, Len))
+        {
+            Len = (FrameData || (Len == 1)) ? 0 : (Len / 2);
+            if(Len == 0)
+            {
+                break;
+            }
+        }
+        if(Len == 0)
+        {
+            Encoder->Rewind(RecordMark);
+            break;
+        }
+
+        UpperAddress = Address >> 16;
+        UpperSent = true;
+        FrameData = true;
+        Offset += Len;
+        if(Offset == Runs[Run].Length)
+        {
+            Run++;
+            Offset = 0;
+        }
+    }
+
+    if(!FrameData)
+    {
+        return false;
+    }
+
+    if((Run < Runs.size()) && (MarkRun >= 0))
+    {
+        // Full, and data left: the next frame starts the row.
+        Encoder->Rewind(RowMark);
+        Run = MarkRun;
+        Offset = MarkOffset;
+    }
+
+    Drop(Run, Offset);
+
+    return true;
+}
+
+/****************************************************************************
+ * Pack() as runs. A run takes all the contiguous data that fits, the last
+ * one of a full frame is cut on a row boundary.
+ *****************************************************************************/
+bool GRecordPacker::PackRuns(GFrameEncoder *Encoder)
+{
+    T_FRAME_MARK RunMark;
+    int Run = 0;
+    unsigned int Offset = 0;
+    bool FrameData = false;
+    unsigned int Address;
+    unsigned int Len;
+    unsigned int Fits;
+    unsigned int Over;
+    unsigned int Mid;
+    unsigned int Row;
+
+    while(Run < Runs.size())
+    {
+        Address = Runs[Run].Address + Offset;
+        Len = qMin(Runs[Run].Length - Offset, 0xFFFFu);
+
+        RunMark = Encoder->Mark();
+        if(!AppendRun(Encoder, Address, Data.constData() + Runs[Run].Offset + Offset, Len))
+        {
+            // Full. The longest piece that fits...
+            Fits = 0;
+            Over = Len;
+            while((Over - Fits) > 1)
+            {
+                Mid = (Fits + Over) / 2;
+                Encoder->Rewind(RunMark);
+                if(AppendRun(Encoder, Address, Data.constData() + Runs[Run].Offset + Offset, Mid))
+                {
+                    Fits = Mid;
+                }
+                else
+                {
+                    Over = Mid;
+                }
+            }
+            Encoder->Rewind(RunMark);
+
+            // ...up to its last row boundary. Without one, the frame ends
+            // before the run, unless it would be empty.
+            Row = (RowSize != 0) ? ((((quint64)Address + Fits) / RowSize) * RowSize) : 0;
+            if(Row > Address)
+            {
+                Fits = Row - Address;
+            }
+            else if(FrameData)
+            {
+                Fits = 0;
+            }
+
+            if(Fits != 0)
+            {
+                AppendRun(Encoder, Address, Data.constData() + Runs[Run].Offset + Offset, Fits);
+                FrameData = true;
+                Offset += Fits;
+            }
+            break;
+        }
+
+        FrameData = true;
+        Offset += Len;
+        if(Offset == Runs[Run].Length)
+        {
+            Run++;
+            Offset = 0;
+        }
+    }
+
+    if(!FrameData)
+    {
+        return false;
+    }
+
+    Drop(Run, Offset);
+
+    return true;
+}
+
+/****************************************************************************
+ * Appends a record to a frame, with its checksum.
+ *
+ * \param  Encoder: Frame.
+ * \param  Type: Record type.
+ * \param  Address: Address, only the lower 16 bits go in the record.
+ * \param  RecData: Record data.
+ * \param  Len: Data length, 255 at most.
+ * \return false if the record does not fit.
+ *****************************************************************************/
+bool GRecordPacker::AppendRecord(GFrameEncoder *Encoder, unsigned char Type, unsigned int Address,
+                                 const char *RecData, unsigned int Len)
+{
+    unsigned char Rec[255 + 5];
+    unsigned char Sum = 0;
+
+    Rec[0] = Len;
+    Rec[1] = Address >> 8;
+    Rec[2] = Address;
+    Rec[3] = Type;
+    memcpy(&Rec[4], RecData, Len);
+
+    for(unsigned int i = 0; i < Len + 4; i++)
+    {
+        Sum += Rec[i];
+    }
+    Rec[Len + 4] = -Sum;
+
+    return Encoder->Append((const char*)Rec, Len + 5);
+}
+
+/****************************************************************************
+ * Appends a run to a frame: address, length and data.
+ *
+ * \param  Encoder: Frame.
+ * \param  Address: Address of the first byte.
+ * \param  RunData: Data.
+ * \param  Len: Data length, 65535 at most.
+ * \return false if the run does not fit.
+ *****************************************************************************/
+bool GRecordPacker::AppendRun(GFrameEncoder *Encoder, unsigned int Address, const char *RunData, unsigned int Len)
+{
+    char Header[PACKER_RUN_HEADER];
+    T_FRAME_MARK Mark = Encoder->Mark();
+
+    Header[0] = static_cast<char>(Address);
+    Header[1] = static_cast<char>(Address >> 8);
+    Header[2] = static_cast<char>(Address >> 16);
+    Header[3] = static_cast<char>(Address >> 24);
+    Header[4] = static_cast<char>(Len);
+    Header[5] = static_cast<char>(Len >> 8);
+
+    if(!Encoder->Append(Header, PACKER_RUN_HEADER))
+    {
+        return false;
+    }
+    if(!Encoder->Append(RunData, Len))
+    {
+        Encoder->Rewind(Mark);
+        return false;
+    }
+
+    return true;
+}
+
+/****************************************************************************
+ * Drops the data sent, up to a position in the runs.
+ *
+ * \param  Run: Run of the first byte not sent.
+ * \param  Offset: Offset of that byte in the run.
+ * \param
+ * \return
+ *****************************************************************************/
+void GRecordPacker::Drop(int Run, unsigned int Offset)
+{
+    unsigned int Sent;
+
+    if(Run >= Runs.size())
+    {
+        Data.clear();
+        Runs.clear();
+        return;
+    }
+
+    Runs.remove(0, Run);
+    Runs[0].Address += Offset;
+    Runs[0].Length -= Offset;
+    Runs[0].Offset += Offset;
+
+    Sent = Runs[0].Offset;
+    Data.remove(0, Sent);
+    for(int i = 0; i < Runs.size(); i++)
+    {
+        Runs[i].Offset -= Sent;
+    }
+}
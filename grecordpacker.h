@@ -0,0 +1,60 @@
+#ifndef GRECORDPACKER_H
+#define GRECORDPACKER_H
+
+#include <QByteArray>
+#include <QVector>
+
+#include "gframecodec.h"
+#include "ghexmanager.h"
+
+// Longest data record sent to the device. Records start and end on a
+// multiple of it (or of the row size, if smaller).
+#define PACKER_RECORD_LEN   128
+
+// Data held ahead of the frames, more than any frame can take.
+#define PACKER_LOOKAHEAD    4096
+
+// Run header of the PAYLOAD_RUNS format: address (32 bits) and length
+// (16 bits), little endian.
+#define PACKER_RUN_HEADER   6
+
+// Packs the data of hex records into program frames. Address-contiguous
+// data is coalesced and sent again, as many bytes as fit in the frame after
+// escaping: as aligned hex records, each frame starting with its own
+// extended linear address record, or as runs carrying their full address.
+// Either way the device needs no address state from the previous frames.
+// When a frame is full it ends on the last flash row boundary it crossed,
+// so that the next frame starts a row.
+class GRecordPacker
+{
+public:
+    //  Constructor. RowSize is the flash row of the device, zero if unknown.
+    explicit GRecordPacker(unsigned int RowSize = 0, T_PAYLOAD Payload = PAYLOAD_HEX_RECORDS);
+
+    void Reset(unsigned int RowSize, T_PAYLOAD Payload = PAYLOAD_HEX_RECORDS);
+    T_PAYLOAD GetPayload(void) const;
+    bool NeedsRecords(void) const;
+    void AddRecord(const unsigned char *Rec);
+    bool IsEmpty(void) const;
+    bool Pack(GFrameEncoder *Encoder);
+
+private:
+    unsigned int RowSize;
+    unsigned int RecordLen;
+    T_PAYLOAD Payload;
+    // Address state of the records added.
+    T_HEX_RECORD HexRecordSt;
+
+    // Data not sent yet, and its address-contiguous runs (Offset into Data).
+    QByteArray Data;
+    QVector<T_HEX_SEGMENT> Runs;
+
+    bool PackRecords(GFrameEncoder *Encoder);
+    bool PackRuns(GFrameEncoder *Encoder);
+    bool AppendRecord(GFrameEncoder *Encoder, unsigned char Type, unsigned int Address,
+                      const char *RecData, unsigned int Len);
+    bool AppendRun(GFrameEncoder *Encoder, unsigned int Address, const char *RunData, unsigned int Len);
+    void Drop(int Run, unsigned int Offset);
+};
+
+#endif // GRECORDPACKER_H
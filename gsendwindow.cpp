@@ -0,0 +1,310 @@
+#include "gsendwindow.h"
+
+GSendWindow::GSendWindow()
+{
+    Sequence = 0;
+    BaudRate = 0;
+    Reset(1, 1, 0);
+}
+
+/****************************************************************************
+ * Drops every frame, for a new pass. The sequence goes on, so that late
+ * answers to the last pass release nothing.
+ *
+ * \param  Size: Frames in flight, WINDOW_MAX at most.
+ * \param  Sends: Times a frame is sent before giving up.
+ * \param  RetryDelay: Ticks to wait for the acknowledge of a frame.
+ * \return
+ *****************************************************************************/
+void GSendWindow::Reset(int Size, unsigned short Sends, unsigned short RetryDelay)
+{
+    this->Size = qBound(1, Size, WINDOW_MAX);
+    this->Sends = Sends;
+    this->RetryDelay = RetryDelay;
+    Frames.clear();
+    Started = false;
+    SendCounter = 0;
+    Retransmissions = 0;
+    RecordsReleased = 0;
+    LineFreeAt = 0;
+}
+
+/****************************************************************************
+ * Speed of the line the frames are written to. The port queues what is
+ * written, so a frame is not out before the ones written before it.
+ *
+ * \param  Baud: Bits per second, zero if unknown (no wire time counted).
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GSendWindow::SetBaudRate(unsigned int Baud)
+{
+    BaudRate = Baud;
+}
+
+int GSendWindow::GetSize() const
+{
+    return Size;
+}
+
+/****************************************************************************
+ * Whether no frame can be pushed. The first frame of a pass goes alone, the
+ * device takes its sequence from it.
+ *****************************************************************************/
+bool GSendWindow::IsFull() const
+{
+    return Frames.size() >= (Started ? Size : 1);
+}
+
+/****************************************************************************
+ * Whether the next frame pushed is the first of the pass.
+ *****************************************************************************/
+bool GSendWindow::IsFirst() const
+{
+    return !Started && Frames.isEmpty();
+}
+
+bool GSendWindow::IsEmpty() const
+{
+    return Frames.isEmpty();
+}
+
+/****************************************************************************
+ * Sequence number of the next frame pushed.
+ *****************************************************************************/
+unsigned char GSendWindow::NextSequence() const
+{
+    return Sequence;
+}
+
+/****************************************************************************
+ * Adds a frame, built with NextSequence(). It is sent by NextToSend().
+ *
+ * \param  Packet: Packet, as written to the port.
+ * \param  Len: Packet length.
+ * \param  Records: Hex records read up to this frame, for the progress.
+ * \return
+ *****************************************************************************/
+void GSendWindow::Push(const char *Packet, int Len, unsigned int Records)
+{
+    T_WINDOW_FRAME Frame;
+
+    Frame.Packet = QByteArray(Packet, Len);
+    Frame.Sequence = Sequence++;
+    Frame.Received = false;
+    Frame.RetryAt = 0;
+    Frame.SendOrder = 0;
+    Frame.SendsLeft = Sends;
+    Frame.Records = Records;
+    Frames.append(Frame);
+}
+
+/****************************************************************************
+ * Next packet to write to the port: a frame not sent yet, or one whose
+ * retry is due and the device does not hold. Call it until it returns NULL.
+ *
+ * \param  Tick: Current tick.
+ * \param
+ * \param
+ * \return Packet, NULL if nothing is due.
+ *****************************************************************************/
+const QByteArray *GSendWindow::NextToSend(quint64 Tick)
+{
+    for(int i = 0; i < Frames.size(); i++)
+    {
+        T_WINDOW_FRAME &Frame = Frames[i];
+
+        if(Frame.Received || (Frame.SendsLeft == 0) || (Frame.RetryAt > Tick))
+        {
+            continue;
+        }
+
+        if(Frame.SendOrder != 0)
+        {
+            Retransmissions++;
+        }
+        // A start and a stop bit each byte.
+        if(BaudRate)
+        {
+            LineFreeAt = qMax(Tick * 1000, LineFreeAt) + (quint64)Frame.Packet.size() * 10 * 1000000 / BaudRate;
+        }
+        else
+        {
+            LineFreeAt = Tick * 1000;
+        }
+        Frame.SendsLeft--;
+        Frame.RetryAt = (LineFreeAt + 999) / 1000 + RetryDelay + 1;
+        Frame.SendOrder = ++SendCounter;
+
+        return &Frame.Packet;
+    }
+
+    return NULL;
+}
+
+/****************************************************************************
+ * Whether a frame was sent as many times as allowed, and its last retry
+ * delay ran out before it was programmed. Frames the device holds wait for
+ * the ones before them, which expire on their own.
+ *****************************************************************************/
+bool GSendWindow::Expired(quint64 Tick) const
+{
+    for(int i = 0; i < Frames.size(); i++)
+    {
+        if(!Frames[i].Received && (Frames[i].SendsLeft == 0) && (Frames[i].RetryAt <= Tick))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/****************************************************************************
+ * Takes an acknowledge of the device.
+ *
+ * \param  Next: Next sequence the device expects; the frames before it are
+ *               programmed.
+ * \param  Received: Bit i set if the device holds frame Next + i.
+ * \param
+ * \return Number of frames released.
+ *****************************************************************************/
+int GSendWindow::Acknowledge(unsigned char Next, unsigned int Received)
+{
+    int Released = 0;
+    unsigned char Offset;
+    quint64 LastReceived = 0;
+
+    // Programmed. Sequences before Next, by less than half the range.
+    while(!Frames.isEmpty() && (static_cast<unsigned char>(Next - Frames[0].Sequence - 1) < 128))
+    {
+        LastReceived = qMax(LastReceived, Frames[0].SendOrder);
+        RecordsReleased = Frames[0].Records;
+        Frames.remove(0);
+        Released++;
+        Started = true;
+    }
+
+    for(int i = 0; i < Frames.size(); i++)
+    {
+        Offset = static_cast<unsigned char>(Frames[i].Sequence - Next);
+        if((Offset < WINDOW_MAX) && (Received & (1u << Offset)))
+        {
+            Frames[i].Received = true;
+        }
+        if(Frames[i].Received)
+        {
+            LastReceived = qMax(LastReceived, Frames[i].SendOrder);
+        }
+    }
+
+    // Sent before a frame that got through: lost, send again now.
+    for(int i = 0; i < Frames.size(); i++)
+    {
+        if(!Frames[i].Received && (Frames[i].SendOrder != 0) && (Frames[i].SendOrder < LastReceived))
+        {
+            Frames[i].RetryAt = 0;
+        }
+    }
+
+    return Released;
+}
+
+/****************************************************************************
+ * Sends a frame again at once, on a NACK of the device.
+ *
+ * \param  Sequence: Frame.
+ * \param  Tick: Current tick.
+ * \param
+ * \return true if the frame was waiting for its retry delay, false if it is
+ *         not in the window, not sent yet, due already or out of retries.
+ *****************************************************************************/
+bool GSendWindow::Resend(unsigned char Sequence, quint64 Tick)
+{
+    for(int i = 0; i < Frames.size(); i++)
+    {
+        T_WINDOW_FRAME &Frame = Frames[i];
+
+        if(Frame.Sequence != Sequence)
+        {
+            continue;
+        }
+        if((Frame.SendOrder == 0) || (Frame.SendsLeft == 0) || (Frame.RetryAt <= Tick))
+        {
+            return false;
+        }
+        Frame.RetryAt = 0;
+        return true;
+    }
+
+    return false;
+}
+
+/****************************************************************************
+ * The device holds a frame, waiting for one before it (NACK_SEQUENCE).
+ *
+ * \param  Sequence: Frame held.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GSendWindow::Hold(unsigned char Sequence)
+{
+    for(int i = 0; i < Frames.size(); i++)
+    {
+        if(Frames[i].Sequence == Sequence)
+        {
+            Frames[i].Received = true;
+        }
+    }
+}
+
+/****************************************************************************
+ * The device holds no frame from this one on: it refused it with NACK_BUSY.
+ * They are sent again as their retry delay runs out.
+ *
+ * \param  Sequence: First frame not held.
+ * \param
+ * \param
+ * \return
+ *****************************************************************************/
+void GSendWindow::DropHeld(unsigned char Sequence)
+{
+    for(int i = 0; i < Frames.size(); i++)
+    {
+        // At or after Sequence, by less than half the range.
+        if(static_cast<unsigned char>(Frames[i].Sequence - Sequence) < 128)
+        {
+            Frames[i].Received = false;
+        }
+    }
+}
+
+/****************************************************************************
+ * Whether the last send of a frame went before the last send of another.
+ *
+ * \param  First, Second: Frames.
+ * \param
+ * \param
+ * \return false if either one is not in the window.
+ *****************************************************************************/
+bool GSendWindow::SentBefore(unsigned char First, unsigned char Second) const
+{
+    quint64 FirstOrder = 0;
+    quint64 SecondOrder = 0;
+
+    for(int i = 0; i < Frames.size(); i++)
+    {
+        if(Frames[i].Sequence == First)
+        {
+            FirstOrder = Frames[i].SendOrder;
+        }
+        if(Frames[i].Sequence == Second)
+        {
+            SecondOrder = Frames[i].SendOrder;
+        }
+    }
+
+    return (FirstOrder != 0) && (FirstOrder < SecondOrder);
+}
@@ -0,0 +1,73 @@
+#ifndef GSENDWINDOW_H
+#define GSENDWINDOW_H
+
+#include <QByteArray>
+#include <QVector>
+
+// Frames in flight, at most. The selective acknowledge has one bit per frame.
+#define WINDOW_MAX 16
+
+typedef struct
+{
+    QByteArray Packet;          // Packet, as written to the port.
+    unsigned char Sequence;
+    bool Received;              // Held by the device, not programmed yet.
+    quint64 RetryAt;            // Tick of the next send, zero if not sent yet.
+    quint64 SendOrder;          // Order of the last send, to find lost frames.
+    unsigned int Records;       // Hex records read up to this frame.
+    unsigned short SendsLeft;
+}T_WINDOW_FRAME;
+
+// Send window of the pipelined programming. Frames carry an 8-bit sequence
+// number and up to the window size of them are in flight. The device
+// acknowledges with the next sequence it expects (everything before is
+// programmed) and a bitmap of the frames it holds from there on. Frames are
+// released by the first and sent again on their own when their retry delay
+// runs out, or at once when a frame sent after them is acknowledged and they
+// are not (a serial link does not reorder, they were lost) or when the device
+// asks for them with a NACK. Frames the device holds are not sent again, nor
+// given up on, until it drops them (NACK_BUSY) or a new pass starts. On a
+// line of known speed the retry delay of a frame starts once the frames
+// written before it and the frame itself are on the wire.
+class GSendWindow
+{
+public:
+    //  Constructor
+    GSendWindow();
+
+    // Frames sent again, since Reset().
+    unsigned int Retransmissions;
+    // Hex records of the frames released, since Reset().
+    unsigned int RecordsReleased;
+
+    void Reset(int Size, unsigned short Sends, unsigned short RetryDelay);
+    void SetBaudRate(unsigned int Baud);
+    int GetSize(void) const;
+    bool IsFull(void) const;
+    bool IsFirst(void) const;
+    bool IsEmpty(void) const;
+    unsigned char NextSequence(void) const;
+    void Push(const char *Packet, int Len, unsigned int Records);
+    const QByteArray *NextToSend(quint64 Tick);
+    bool Expired(quint64 Tick) const;
+    int Acknowledge(unsigned char Next, unsigned int Received);
+    bool Resend(unsigned char Sequence, quint64 Tick);
+    void Hold(unsigned char Sequence);
+    void DropHeld(unsigned char Sequence);
+    bool SentBefore(unsigned char First, unsigned char Second) const;
+
+private:
+    QVector<T_WINDOW_FRAME> Frames;
+    int Size;
+    unsigned short Sends;
+    unsigned short RetryDelay;
+    // Line speed, zero if unknown, and the time the bytes written so far
+    // are all on the wire, in us (ticks are ms).
+    unsigned int BaudRate;
+    quint64 LineFreeAt;
+    unsigned char Sequence;
+    bool Started;
+    quint64 SendCounter;
+};
+
+#endif // GSENDWINDOW_H
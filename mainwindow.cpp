@@ -16,6 +16,9 @@ static const char blankString[] = QT_TRANSLATE_NOOP("SettingsDialog", "N/A");
 #define SaveButtonStatus() ButtonStatus(SAVE)
 #define RestoreButtonStatus() ButtonStatus(RESTORE)
 
+// Baud rate the COM port is opened with.
+#define COM_BAUD_RATE QSerialPort::Baud115200
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow)
@@ -27,6 +30,8 @@ MainWindow::MainWindow(QWidget *parent) :
 
     connect(&mBootLoader,SIGNAL(PostMessage(unsigned char,char*)),this,SLOT(OnReceiveResponse(unsigned char,char*)));
     connect(&mBootLoader,SIGNAL(PostErrorMessage(unsigned char,char*)),this,SLOT(OnTransmitFailure(unsigned char,char*)));
+    connect(&mBootLoader,SIGNAL(HexFileReloaded(bool,QVector<unsigned int>,unsigned int)),this,SLOT(OnHexFileReloaded(bool,QVector<unsigned int>,unsigned int)));
+    connect(&mBootLoader,SIGNAL(ImageAnalysisReady(unsigned int,unsigned int)),this,SLOT(OnImageAnalysisReady(unsigned int,unsigned int)));
 
     //  Progress Bar
     ui->progressBar->setValue(0);
@@ -40,6 +45,11 @@ MainWindow::MainWindow(QWidget *parent) :
     searchDevice.setInterval(500);
     searchDevice.start();
 
+    //  Target device
+    for (int i = 0; i < GDeviceProfile::ProfileCount(); i++){
+        ui->cmbDevice->addItem(GDeviceProfile(i).Name);
+    }
+
     EraseProgVer = false;
     PortSelected = COM;
     connectState = 0;
@@ -105,6 +115,9 @@ unsigned int MainWindow::OnReceiveResponse(unsigned char cmd, char *RxDataPtrAdr
     char *RxData;
     QString string;
     unsigned short crc;
+    QVector<T_MEMORY_RANGE> FailedRanges;
+    int Failed;
+    T_TX_STATS TxStats;
 
     RxData = RxDataPtrAdrs;
     MajorVer = RxData[0];
@@ -155,6 +168,11 @@ unsigned int MainWindow::OnReceiveResponse(unsigned char cmd, char *RxDataPtrAdr
 
     case PROGRAM_FLASH:
         PrintKonsole("Programación completada");
+        TxStats = mBootLoader.GetTxStats();
+        if(TxStats.Nacks)
+        {
+            PrintKonsole(QString("NACK recibidos: %1, esperas evitadas: %2").arg(TxStats.Nacks).arg(TxStats.TimeoutsAvoided));
+        }
         // Restore button status to allow further operations.
         RestoreButtonStatus();
         ui->ctrlButtonVerify->setEnabled(true);
@@ -163,7 +181,7 @@ unsigned int MainWindow::OnReceiveResponse(unsigned char cmd, char *RxDataPtrAdr
         if(EraseProgVer)// Operation Erase->Program->Verify
         {
             // Programming completed. Next operation is verification.
-            mBootLoader.SendCommand(READ_CRC, 3, 5000);// 5 second delay
+            StartVerify();
         }
         break;
 
@@ -185,6 +203,32 @@ unsigned int MainWindow::OnReceiveResponse(unsigned char cmd, char *RxDataPtrAdr
         ui->ctrlButtonVerify->setEnabled(true);
         ui->ctrlButtonRunApplication->setEnabled(true);
         break;
+
+    case READ_DIGEST:
+        Failed = mBootLoader.CheckDigests(RxData, &FailedRanges);
+
+        if(Failed == 0)
+        {
+            PrintKonsole("Verificación exitosa...");
+        }
+        else if(Failed < 0)
+        {
+            PrintKonsole("Verificación por rangos no soportada");
+        }
+        else
+        {
+            PrintKonsole(QString("Verificación fallida en %1 rangos...").arg(Failed));
+            foreach (const T_MEMORY_RANGE &Range, FailedRanges){
+                PrintKonsole(QString("  0x%1 - 0x%2").arg(Range.Begin, 8, 16, QChar('0')).arg(Range.End, 8, 16, QChar('0')));
+            }
+        }
+        // Reset erase->program-verify operation.
+        EraseProgVer = false;
+        // Restore button status to allow further operations.
+        RestoreButtonStatus();
+        ui->ctrlButtonVerify->setEnabled(true);
+        ui->ctrlButtonRunApplication->setEnabled(true);
+        break;
     }
 
     if(!ConnectionEstablished)
@@ -212,6 +256,7 @@ unsigned int MainWindow::OnTransmitFailure(unsigned char cmd, char *RxDataPtrAdr
     case ERASE_FLASH:
     case PROGRAM_FLASH:
     case READ_CRC:
+    case READ_DIGEST:
         // Print a message to user/
         PrintKonsole("Sin respuesta del dispositivo. Operacion fallida");
         connectState = 2;
@@ -256,11 +301,10 @@ void MainWindow::OnSearchDeviceTimer()
         break;
     case 1: //  Intenta conectar
         ui->lblEstado->setText("Buscando dispositivo");
-        comPortName = searchPort(0x0403,0x6015);
+        comPortName = (PortSelected == SIM) ? QString("Simulador") : searchPort(0x0403,0x6015);
 
         if (!comPortName.isEmpty()){
             // Establish new connection.
-            comPortName = searchPort(0x0403,0x6015);
 
             if(mBootLoader.GetPortOpenStatus(PortSelected))
             {
@@ -268,7 +312,7 @@ void MainWindow::OnSearchDeviceTimer()
                 mBootLoader.ClosePort(PortSelected);
             }
             // Open Communication port freshly.
-            mBootLoader.OpenPort(PortSelected,comPortName,QSerialPort::Baud115200,0,0,0,0);
+            mBootLoader.OpenPort(PortSelected,comPortName,COM_BAUD_RATE,0,0,0,0);
 
             connectState = 0;
 
@@ -370,6 +414,69 @@ void MainWindow::on_ctrlButtonLoadHex_clicked()
     }
 }
 
+void MainWindow::on_chkWatchHex_toggled(bool checked)
+{
+    mBootLoader.SetHexWatchMode(checked);
+}
+
+void MainWindow::on_cmbDevice_currentIndexChanged(int index)
+{
+    if (!mBootLoader.SetDeviceProfile(index)){
+        PrintKonsole("Archivo Hex carga fallida");
+        ui->ctrlButtonProgram->setEnabled(false);
+        ui->ctrlButtonEraseProgVerify->setEnabled(false);
+    }
+}
+
+/****************************************************************************
+ * Invoked when the analysis of the loaded image is done.
+ *
+ *
+ *****************************************************************************/
+void MainWindow::OnImageAnalysisReady(unsigned int Pages, unsigned int WireBytes)
+{
+    qint32 Baud = mBootLoader.GetBaudRate();
+
+    // The port may not be open yet.
+    if (Baud <= 0)
+        Baud = COM_BAUD_RATE;
+
+    // 10 bits per byte on the serial line.
+    PrintKonsole(QString("Imagen: %1 páginas, %2 bytes a transmitir (%3 s a %4 baudios)")
+                 .arg(Pages).arg(WireBytes).arg(WireBytes * 10.0 / Baud, 0, 'f', 1).arg(Baud));
+}
+
+/****************************************************************************
+ * Invoked when the watched hex file was rebuilt and reloaded.
+ *
+ *
+ *****************************************************************************/
+void MainWindow::OnHexFileReloaded(bool Ok, const QVector<unsigned int> &ChangedPages, unsigned int ChangedBytes)
+{
+    QString string;
+
+    if (!Ok){
+        PrintKonsole("Archivo Hex modificado, carga fallida");
+        return;
+    }
+
+    if (ChangedPages.isEmpty()){
+        PrintKonsole("Archivo Hex recargado, sin cambios");
+        return;
+    }
+
+    // Page level figure: programming still sends the whole image.
+    string = QString("Archivo Hex recargado: %1 páginas modificadas (%2 bytes de flash), %3 bytes distintos")
+            .arg(ChangedPages.size())
+            .arg(ChangedPages.size() * mBootLoader.GetDeviceProfile().PageSize)
+            .arg(ChangedBytes);
+    PrintKonsole(string);
+
+    foreach (unsigned int Page, ChangedPages){
+        PrintKonsole(QString("  0x%1").arg(Page, 8, 16, QChar('0')));
+    }
+}
+
 /****************************************************************************
  * This function is invoked when button Read Version is clicked
  *
@@ -410,7 +517,36 @@ void MainWindow::on_ctrlButtonVerify_clicked()
     SaveButtonStatus();
     // Disable all buttons to avoid further operations
     EnableAllButtons(false);
-    mBootLoader.SendCommand(READ_CRC, 3, 5000);
+    StartVerify();
+}
+
+/****************************************************************************
+ * Starts the verification selected: CRC16 of the whole image, or a digest
+    of each range.
+ *
+ *
+ *****************************************************************************/
+void MainWindow::StartVerify()
+{
+    T_DIGEST_ALGORITHM Algorithm;
+
+    switch (ui->cmbVerify->currentIndex()) {
+    case 1:
+        Algorithm = DIGEST_CRC32;
+        break;
+    case 2:
+        Algorithm = DIGEST_SHA256;
+        break;
+    default:
+        mBootLoader.SendCommand(READ_CRC, 3, 5000);
+        return;
+    }
+
+    if (!mBootLoader.ReadDigest(Algorithm, mBootLoader.GetDigestRanges(Algorithm), 3, 5000)){
+        PrintKonsole("Verificación por rangos no disponible");
+        EraseProgVer = false;
+        RestoreButtonStatus();
+    }
 }
 
 /****************************************************************************
@@ -463,6 +599,26 @@ void MainWindow::on_actionBuscar_triggered()
     searchDevice.start();
 }
 
+/****************************************************************************
+ * Switches between the serial port and the bootloader simulator.
+ *
+ *
+ *****************************************************************************/
+void MainWindow::on_actionSimulador_toggled(bool checked)
+{
+    if (mBootLoader.GetPortOpenStatus(PortSelected)){
+        mBootLoader.ClosePort(PortSelected);
+    }
+
+    ConnectionEstablished = false;
+    EnableAllButtons(false);
+    PortSelected = checked ? SIM : COM;
+
+    // Connect again.
+    connectState = 1;
+    searchDevice.start();
+}
+
 void MainWindow::on_actionAbout_triggered()
 {
     QString text = QString("Autor: Galo Guzmán G.\n");
@@ -24,6 +24,8 @@ public:
 public slots:
     unsigned int OnReceiveResponse(unsigned char cmd, char *RxDataPtrAdrs);
     unsigned int OnTransmitFailure(unsigned char cmd, char *RxDataPtrAdrs);
+    void OnHexFileReloaded(bool Ok, const QVector<unsigned int> &ChangedPages, unsigned int ChangedBytes);
+    void OnImageAnalysisReady(unsigned int Pages, unsigned int WireBytes);
 
 private slots:
     void OnTimer();
@@ -34,6 +36,10 @@ private slots:
 
     void on_ctrlButtonLoadHex_clicked();
 
+    void on_chkWatchHex_toggled(bool checked);
+
+    void on_cmbDevice_currentIndexChanged(int index);
+
     void on_ctrlButtonBootloaderVer_clicked();
 
     void on_ctrlButtonProgram_clicked();
@@ -48,6 +54,8 @@ private slots:
 
     void on_actionBuscar_triggered();
 
+    void on_actionSimulador_toggled(bool checked);
+
     void on_actionAbout_triggered();
 
 protected:
@@ -56,6 +64,7 @@ protected:
     bool ConnectionEstablished = false;
     void PrintKonsole(QString string);
     void ClearKonsole(void);
+    void StartVerify(void);
 
     T_PORTTYPE PortSelected;
 
@@ -4,12 +4,13 @@
 #
 #-------------------------------------------------
 
-QT       += core gui serialport
+QT       += core gui serialport concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 TARGET = bootloader
 TEMPLATE = app
+CONFIG += c++14
 
 # The following define makes your compiler emit warnings if you use
 # any feature of Qt which has been marked as deprecated (the exact warnings
@@ -27,13 +28,29 @@ SOURCES += \
         main.cpp \
         mainwindow.cpp \
     ghexmanager.cpp \
+    ghexstream.cpp \
     gbootloader.cpp \
+    gbootsimulator.cpp \
+    gdeviceprofile.cpp \
+    gflashimage.cpp \
+    gframecodec.cpp \
+    gimageloader.cpp \
+    grecordpacker.cpp \
+    gsendwindow.cpp \
     utils.cpp
 
 HEADERS += \
         mainwindow.h \
     ghexmanager.h \
+    ghexstream.h \
     gbootloader.h \
+    gbootsimulator.h \
+    gdeviceprofile.h \
+    gflashimage.h \
+    gframecodec.h \
+    gimageloader.h \
+    grecordpacker.h \
+    gsendwindow.h \
     utils.h
 
 FORMS += \
@@ -0,0 +1,20 @@
+# Randomized differential test of the carry-less multiply CRC16 engine
+# against the nibble table.
+
+QT      += core
+QT      -= gui
+CONFIG  += console c++14 testcase
+CONFIG  -= app_bundle
+TEMPLATE = app
+
+TARGET = tst_crcclmul
+
+SRC_DIR = $$PWD/../..
+INCLUDEPATH += $$SRC_DIR
+
+SOURCES += \
+    main.cpp \
+    $$SRC_DIR/utils.cpp
+
+HEADERS += \
+    $$SRC_DIR/utils.h
@@ -0,0 +1,96 @@
+#include <QByteArray>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "utils.h"
+
+// Random cases run.
+#define CASES       20000
+// Longest buffer, and the odd long one.
+#define MAX_LEN     4096
+#define MAX_LONG    (256 * 1024)
+
+static unsigned int Seed;
+
+static unsigned int Random(void)
+{
+    // xorshift32
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 17;
+    Seed ^= Seed << 5;
+    return Seed;
+}
+
+/****************************************************************************
+ * tst_crcclmul [seed]
+ *
+ * Runs random buffers, lengths, alignments and initial CRCs through
+ * CRC_ENGINE_CLMUL and CRC_ENGINE_NIBBLE, whole and split in two updates,
+ * and fails on the first mismatch. The seed is printed to repeat a run.
+ *****************************************************************************/
+int main(int argc, char *argv[])
+{
+    QByteArray Buffer;
+    const char *Data;
+    unsigned int Len;
+    unsigned int Split;
+    unsigned short Initial;
+    unsigned short Expected;
+    unsigned short Whole;
+    unsigned short Parts;
+
+    Seed = (argc > 1) ? strtoul(argv[1], NULL, 0) : (unsigned int)time(NULL);
+    if(Seed == 0)
+    {
+        Seed = 1;
+    }
+    printf("seed %u%s\n", Seed, Utils::CrcEngineSupported(Utils::CRC_ENGINE_CLMUL) ? "" :
+           ", no carry-less multiply on this CPU: slicing-by-8 tested instead");
+
+    Buffer.resize(MAX_LONG + 64);
+    for(int i = 0; i < Buffer.size(); i++)
+    {
+        Buffer[i] = Random();
+    }
+
+    for(int i = 0; i < CASES; i++)
+    {
+        // Mostly short, where the folding hands over to the tail.
+        switch(Random() % 4)
+        {
+        case 0:
+            Len = Random() % 64;
+            break;
+        case 1:
+            Len = Random() % 256;
+            break;
+        case 2:
+            Len = Random() % MAX_LEN;
+            break;
+        default:
+            Len = (Random() % 16) ? (Random() % MAX_LEN) : (Random() % MAX_LONG);
+            break;
+        }
+        Data = Buffer.constData() + (Random() % 64);
+        Initial = Random();
+        Split = Len ? (Random() % (Len + 1)) : 0;
+
+        Expected = Utils::UpdateCrc(Utils::CRC_ENGINE_NIBBLE, Initial, Data, Len);
+        Whole = Utils::UpdateCrc(Utils::CRC_ENGINE_CLMUL, Initial, Data, Len);
+        Parts = Utils::UpdateCrc(Utils::CRC_ENGINE_CLMUL, Initial, Data, Split);
+        Parts = Utils::UpdateCrc(Utils::CRC_ENGINE_CLMUL, Parts, Data + Split, Len - Split);
+
+        if((Whole != Expected) || (Parts != Expected))
+        {
+            printf("FAIL case %d: len %u, alignment %u, crc %04X, split %u: %04X %04X, expected %04X\n",
+                   i, Len, (unsigned int)((size_t)Data & 63), Initial, Split, Whole, Parts, Expected);
+            return 1;
+        }
+    }
+
+    printf("PASS %d cases\n", CASES);
+
+    return 0;
+}
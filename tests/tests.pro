@@ -0,0 +1,7 @@
+# Tests of the bootloader code. Console programs, built from the application
+# sources; "make check" runs them.
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    crcclmul
@@ -1,5 +1,24 @@
 #include "utils.h"
 
+#include <QElapsedTimer>
+#include <QVector>
+
+#include <atomic>
+
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define UTILS_HAVE_SSE2
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#include <wmmintrin.h>
+#define UTILS_HAVE_AVX2
+#define UTILS_HAVE_PCLMUL
+#endif
+
 /**
  * Static table used for the table_driven implementation.
  *****************************************************************************/
@@ -9,23 +28,170 @@ static const unsigned short crc_table[16] =
     0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
 };
 
+/**
+ * Byte wide and slicing tables, generated at compile time. Table[0] is the
+ * byte table, Table[k] gives the crc of a byte followed by k zero bytes.
+ *****************************************************************************/
+typedef struct
+{
+    unsigned short Table[8][256];
+}T_CRC_SLICE_TABLES;
+
+static constexpr T_CRC_SLICE_TABLES MakeCrcSliceTables()
+{
+    T_CRC_SLICE_TABLES Tables = {};
+
+    for(unsigned int i = 0; i < 256; i++)
+    {
+        unsigned int crc = i << 8;
+
+        for(int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+        Tables.Table[0][i] = crc & 0xFFFF;
+    }
+    for(int k = 1; k < 8; k++)
+    {
+        for(unsigned int i = 0; i < 256; i++)
+        {
+            unsigned int crc = Tables.Table[k - 1][i];
+
+            Tables.Table[k][i] = ((crc << 8) ^ Tables.Table[0][crc >> 8]) & 0xFFFF;
+        }
+    }
+
+    return Tables;
+}
+
+static constexpr T_CRC_SLICE_TABLES crc_slice = MakeCrcSliceTables();
+
+static_assert(crc_slice.Table[0][1] == 0x1021 && crc_slice.Table[0][0x0F] == 0xF1EF,
+              "Byte table does not match the nibble table");
+
+/**
+ * Polynomial product modulo P, P being x^16 + x^12 + x^5 + 1.
+ *****************************************************************************/
+static constexpr unsigned int CrcMulMod(unsigned int a, unsigned int b)
+{
+    unsigned int r = 0;
+
+    for(int bit = 15; bit >= 0; bit--)
+    {
+        r <<= 1;
+        if(r & 0x10000)
+        {
+            r ^= 0x11021;
+        }
+        if((b >> bit) & 1)
+        {
+            r ^= a;
+        }
+    }
+
+    return r;
+}
+
+/**
+ * x^(8 * 2^k) mod P, the effect of 2^k zero bytes on a crc.
+ *****************************************************************************/
+typedef struct
+{
+    unsigned int Shift[32];
+}T_CRC_SHIFT_TABLE;
+
+static constexpr T_CRC_SHIFT_TABLE MakeCrcShiftTable()
+{
+    T_CRC_SHIFT_TABLE Table = {};
+
+    Table.Shift[0] = 0x0100;
+    for(int k = 1; k < 32; k++)
+    {
+        Table.Shift[k] = CrcMulMod(Table.Shift[k - 1], Table.Shift[k - 1]);
+    }
+
+    return Table;
+}
+
+static constexpr T_CRC_SHIFT_TABLE crc_shift = MakeCrcShiftTable();
+
+/**
+ * Slicing-by-8 tables of the CRC-32 used by zlib and Ethernet (reflected
+ * polynomial 0xEDB88320), generated at compile time.
+ *****************************************************************************/
+typedef struct
+{
+    unsigned int Table[8][256];
+}T_CRC32_TABLES;
+
+static constexpr T_CRC32_TABLES MakeCrc32Tables()
+{
+    T_CRC32_TABLES Tables = {};
+
+    for(unsigned int i = 0; i < 256; i++)
+    {
+        unsigned int crc = i;
+
+        for(int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+        }
+        Tables.Table[0][i] = crc;
+    }
+    for(int k = 1; k < 8; k++)
+    {
+        for(unsigned int i = 0; i < 256; i++)
+        {
+            unsigned int crc = Tables.Table[k - 1][i];
+
+            Tables.Table[k][i] = (crc >> 8) ^ Tables.Table[0][crc & 0xFF];
+        }
+    }
+
+    return Tables;
+}
+
+static constexpr T_CRC32_TABLES crc32_slice = MakeCrc32Tables();
+
+// Selected engine, CRC_ENGINE_AUTO until set.
+static std::atomic<int> crc_engine(Utils::CRC_ENGINE_AUTO);
+
 Utils::Utils()
 {
 
 }
 
 /****************************************************************************
- * Update the crc value with new data.
+ * Calculates the crc of a buffer.
+ *
+ * \param data     Pointer to a buffer of \a data_len bytes.
+ * \param len		Number of bytes in the \a data buffer.
+ * \return         The crc value.
+ *****************************************************************************/
+unsigned short Utils::CalculateCrc(char *data, unsigned int len)
+{
+    return UpdateCrc(0, data, len);
+}
+
+/****************************************************************************
+ * Update the crc value with new data, using the selected engine.
  *
  * \param crc      The current crc value.
  * \param data     Pointer to a buffer of \a data_len bytes.
  * \param len		Number of bytes in the \a data buffer.
  * \return         The updated crc value.
  *****************************************************************************/
-unsigned short Utils::CalculateCrc(char *data, unsigned int len)
+unsigned short Utils::UpdateCrc(unsigned short crc, const char *data, unsigned int len)
+{
+    return UpdateCrc(GetCrcEngine(), crc, data, len);
+}
+
+/****************************************************************************
+ * Nibble engine, two lookups in a 16 entry table per byte.
+ *****************************************************************************/
+static unsigned short UpdateCrcNibble(unsigned short crc, const char *data, unsigned int len)
 {
     unsigned int i;
-    unsigned short crc = 0;
 
     while(len--)
     {
@@ -38,3 +204,874 @@ unsigned short Utils::CalculateCrc(char *data, unsigned int len)
 
     return (crc & 0xFFFF);
 }
+
+/****************************************************************************
+ * Byte wide engine, one lookup per byte.
+ *****************************************************************************/
+static unsigned short UpdateCrcByte(unsigned short crc, const char *data, unsigned int len)
+{
+    const unsigned char *p = (const unsigned char*)data;
+
+    while(len--)
+    {
+        crc = (crc << 8) ^ crc_slice.Table[0][(crc >> 8) ^ *p++];
+    }
+
+    return (crc & 0xFFFF);
+}
+
+/****************************************************************************
+ * Slicing-by-4 engine, four independent lookups per 4 bytes.
+ *****************************************************************************/
+static unsigned short UpdateCrcSlice4(unsigned short crc, const char *data, unsigned int len)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    unsigned int x;
+
+    while(len >= 4)
+    {
+        x = crc ^ ((p[0] << 8) | p[1]);
+        crc = crc_slice.Table[3][x >> 8] ^ crc_slice.Table[2][x & 0xFF] ^
+              crc_slice.Table[1][p[2]] ^ crc_slice.Table[0][p[3]];
+        p += 4;
+        len -= 4;
+    }
+
+    return UpdateCrcByte(crc, (const char*)p, len);
+}
+
+/****************************************************************************
+ * Slicing-by-8 engine, eight independent lookups per 8 bytes.
+ *****************************************************************************/
+static unsigned short UpdateCrcSlice8(unsigned short crc, const char *data, unsigned int len)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    unsigned int x;
+
+    while(len >= 8)
+    {
+        x = crc ^ ((p[0] << 8) | p[1]);
+        crc = crc_slice.Table[7][x >> 8] ^ crc_slice.Table[6][x & 0xFF] ^
+              crc_slice.Table[5][p[2]] ^ crc_slice.Table[4][p[3]] ^
+              crc_slice.Table[3][p[4]] ^ crc_slice.Table[2][p[5]] ^
+              crc_slice.Table[1][p[6]] ^ crc_slice.Table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+
+    return UpdateCrcByte(crc, (const char*)p, len);
+}
+
+#ifdef UTILS_HAVE_PCLMUL
+/****************************************************************************
+ * x^n mod P, P being the CRC16-CCITT polynomial x^16 + x^12 + x^5 + 1.
+ *****************************************************************************/
+static constexpr unsigned long long CrcXPowMod(unsigned int n)
+{
+    unsigned int r = 1;
+
+    while(n--)
+    {
+        r <<= 1;
+        if(r & 0x10000)
+        {
+            r ^= 0x11021;
+        }
+    }
+
+    return r;
+}
+
+/****************************************************************************
+ * Multiplies a 128 bit remainder by x^d, d given by the constants
+ * { x^d mod P, x^(d+64) mod P }. The result is below 80 bits.
+ *****************************************************************************/
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i CrcFold(__m128i a, __m128i k)
+{
+    return _mm_xor_si128(_mm_clmulepi64_si128(a, k, 0x00), _mm_clmulepi64_si128(a, k, 0x11));
+}
+
+/****************************************************************************
+ * Carry-less multiply engine. The data is read as one big polynomial, most
+ * significant bit first, and folded 64 bytes at a time into four 128 bit
+ * remainders congruent modulo P. The last remainder is reduced to 16 bits
+ * by the table engine, which gives the crc since the initial value is zero.
+ *****************************************************************************/
+__attribute__((target("pclmul,ssse3")))
+static unsigned short UpdateCrcClmul(unsigned short crc, const char *data, unsigned int len)
+{
+    const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k128 = _mm_set_epi64x(CrcXPowMod(128 + 64), CrcXPowMod(128));
+    const __m128i k256 = _mm_set_epi64x(CrcXPowMod(256 + 64), CrcXPowMod(256));
+    const __m128i k384 = _mm_set_epi64x(CrcXPowMod(384 + 64), CrcXPowMod(384));
+    const __m128i k512 = _mm_set_epi64x(CrcXPowMod(512 + 64), CrcXPowMod(512));
+    __m128i a0, a1, a2, a3;
+    unsigned char rem[16];
+
+    if(len < 64)
+    {
+        return UpdateCrcSlice8(crc, data, len);
+    }
+
+    // The current crc is the same as xoring it into the first two bytes.
+    a0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), swap);
+    a0 = _mm_xor_si128(a0, _mm_slli_si128(_mm_cvtsi32_si128(crc), 14));
+    a1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), swap);
+    a2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), swap);
+    a3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), swap);
+    data += 64;
+    len -= 64;
+
+    while(len >= 64)
+    {
+        a0 = _mm_xor_si128(CrcFold(a0, k512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), swap));
+        a1 = _mm_xor_si128(CrcFold(a1, k512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), swap));
+        a2 = _mm_xor_si128(CrcFold(a2, k512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), swap));
+        a3 = _mm_xor_si128(CrcFold(a3, k512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), swap));
+        data += 64;
+        len -= 64;
+    }
+
+    a0 = _mm_xor_si128(_mm_xor_si128(CrcFold(a0, k384), CrcFold(a1, k256)),
+                       _mm_xor_si128(CrcFold(a2, k128), a3));
+
+    while(len >= 16)
+    {
+        a0 = _mm_xor_si128(CrcFold(a0, k128), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), swap));
+        data += 16;
+        len -= 16;
+    }
+
+    _mm_storeu_si128((__m128i*)rem, _mm_shuffle_epi8(a0, swap));
+    crc = UpdateCrcSlice8(0, (const char*)rem, sizeof(rem));
+
+    return UpdateCrcSlice8(crc, data, len);
+}
+
+static bool CpuHasClmul()
+{
+    static const bool clmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+    return clmul;
+}
+#endif
+
+/****************************************************************************
+ * Update the crc value with new data, using a given engine.
+ *
+ * \param engine   Engine to use. CRC_ENGINE_AUTO uses the fastest one.
+ * \param crc      The current crc value.
+ * \param data     Pointer to a buffer of \a data_len bytes.
+ * \param len		Number of bytes in the \a data buffer.
+ * \return         The updated crc value, the same for every engine.
+ *****************************************************************************/
+unsigned short Utils::UpdateCrc(T_CRC_ENGINE engine, unsigned short crc, const char *data, unsigned int len)
+{
+    switch((engine == CRC_ENGINE_AUTO) ? FastestCrcEngine() : engine)
+    {
+    case CRC_ENGINE_NIBBLE:
+        return UpdateCrcNibble(crc, data, len);
+    case CRC_ENGINE_BYTE:
+        return UpdateCrcByte(crc, data, len);
+    case CRC_ENGINE_SLICE4:
+        return UpdateCrcSlice4(crc, data, len);
+#ifdef UTILS_HAVE_PCLMUL
+    case CRC_ENGINE_CLMUL:
+        if(CpuHasClmul())
+        {
+            return UpdateCrcClmul(crc, data, len);
+        }
+        return UpdateCrcSlice8(crc, data, len);
+#endif
+    default:
+        return UpdateCrcSlice8(crc, data, len);
+    }
+}
+
+/****************************************************************************
+ * Selects the engine used by CalculateCrc() and UpdateCrc().
+ *
+ * \param engine   Engine to use. CRC_ENGINE_AUTO uses the fastest one.
+ * \param
+ * \return
+ *****************************************************************************/
+void Utils::SetCrcEngine(T_CRC_ENGINE engine)
+{
+    if((engine < CRC_ENGINE_AUTO) || (engine >= CRC_ENGINE_COUNT))
+    {
+        engine = CRC_ENGINE_AUTO;
+    }
+    crc_engine.store(engine, std::memory_order_relaxed);
+}
+
+/****************************************************************************
+ * Gets the engine used by CalculateCrc() and UpdateCrc().
+ *
+ * \param
+ * \param
+ * \return The selected engine, never CRC_ENGINE_AUTO.
+ *****************************************************************************/
+Utils::T_CRC_ENGINE Utils::GetCrcEngine()
+{
+    T_CRC_ENGINE engine = (T_CRC_ENGINE)crc_engine.load(std::memory_order_relaxed);
+
+    return (engine == CRC_ENGINE_AUTO) ? FastestCrcEngine() : engine;
+}
+
+/****************************************************************************
+ * Tells if an engine runs natively on this machine. Engines that do not fall
+ * back to slicing-by-8.
+ *
+ * \param engine   Engine to check.
+ * \param
+ * \return true if supported.
+ *****************************************************************************/
+bool Utils::CrcEngineSupported(T_CRC_ENGINE engine)
+{
+    if(engine == CRC_ENGINE_CLMUL)
+    {
+#ifdef UTILS_HAVE_PCLMUL
+        return CpuHasClmul();
+#else
+        return false;
+#endif
+    }
+
+    return (engine > CRC_ENGINE_AUTO) && (engine < CRC_ENGINE_COUNT);
+}
+
+/****************************************************************************
+ * Combines the crc of two consecutive buffers, without the data.
+ *
+ * \param crc1     crc of the first buffer, with any initial value.
+ * \param crc2     crc of the second buffer, with a zero initial value.
+ * \param len2     Number of bytes in the second buffer.
+ * \return         The crc of both buffers, same as UpdateCrc(crc1, ...) over
+ *                 the second one.
+ *****************************************************************************/
+unsigned short Utils::CombineCrc(unsigned short crc1, unsigned short crc2, unsigned int len2)
+{
+    unsigned int crc = crc1;
+
+    // Appending len2 zero bytes multiplies the crc by x^(8 * len2).
+    for(int k = 0; len2; k++, len2 >>= 1)
+    {
+        if(len2 & 1)
+        {
+            crc = CrcMulMod(crc, crc_shift.Shift[k]);
+        }
+    }
+
+    return (crc ^ crc2) & 0xFFFF;
+}
+
+/****************************************************************************
+ * Update a CRC-32 (zlib, Ethernet) with new data.
+ *
+ * \param crc      The current crc value, 0 to start.
+ * \param data     Pointer to a buffer of \a data_len bytes.
+ * \param len		Number of bytes in the \a data buffer.
+ * \return         The updated crc value.
+ *****************************************************************************/
+unsigned int Utils::UpdateCrc32(unsigned int crc, const char *data, unsigned int len)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    unsigned int x;
+
+    crc = ~crc;
+
+    while(len >= 8)
+    {
+        x = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24));
+        crc = crc32_slice.Table[7][x & 0xFF] ^ crc32_slice.Table[6][(x >> 8) & 0xFF] ^
+              crc32_slice.Table[5][(x >> 16) & 0xFF] ^ crc32_slice.Table[4][x >> 24] ^
+              crc32_slice.Table[3][p[4]] ^ crc32_slice.Table[2][p[5]] ^
+              crc32_slice.Table[1][p[6]] ^ crc32_slice.Table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+
+    while(len--)
+    {
+        crc = (crc >> 8) ^ crc32_slice.Table[0][(crc ^ *p++) & 0xFF];
+    }
+
+    return ~crc;
+}
+
+/****************************************************************************
+ * Finds the fastest engine on this machine. Each engine is timed on the same
+ * buffer once, the first time this is called.
+ *
+ * \param
+ * \param
+ * \return The fastest engine.
+ *****************************************************************************/
+Utils::T_CRC_ENGINE Utils::FastestCrcEngine()
+{
+    static const T_CRC_ENGINE Fastest = []()
+    {
+        QVector<char> Buffer(16384);
+        QElapsedTimer Timer;
+        qint64 Best = -1;
+        T_CRC_ENGINE Engine = CRC_ENGINE_SLICE8;
+        unsigned short crc = 0;
+
+        for(int i = 0; i < Buffer.size(); i++)
+        {
+            Buffer[i] = (char)(i * 131 + (i >> 7));
+        }
+        for(int e = CRC_ENGINE_NIBBLE; e < CRC_ENGINE_COUNT; e++)
+        {
+            qint64 Elapsed = -1;
+
+            if(!CrcEngineSupported((T_CRC_ENGINE)e))
+            {
+                continue;
+            }
+
+            // Best of a few runs, the first one warms the caches.
+            for(int run = 0; run < 4; run++)
+            {
+                Timer.start();
+                crc ^= UpdateCrc((T_CRC_ENGINE)e, crc, Buffer.constData(), Buffer.size());
+                qint64 Run = Timer.nsecsElapsed();
+                if((Elapsed < 0) || (Run < Elapsed))
+                {
+                    Elapsed = Run;
+                }
+            }
+            if((Best < 0) || (Elapsed < Best))
+            {
+                Best = Elapsed;
+                Engine = (T_CRC_ENGINE)e;
+            }
+        }
+
+        return Engine;
+    }();
+
+    return Fastest;
+}
+
+/**
+ * Control bytes of the bootloader frames: SOH, EOT and DLE. Any of them in
+ * the frame data goes on the wire preceded by a DLE.
+ *****************************************************************************/
+static inline bool IsFrameByte(unsigned char byte)
+{
+    return (byte == 0x01) || (byte == 0x04) || (byte == 0x10);
+}
+
+static inline unsigned int LowestBit(unsigned int mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    unsigned int bit = 0;
+
+    while(!(mask & 1))
+    {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+static inline unsigned int BitCount(unsigned int mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcount(mask);
+#else
+    unsigned int count = 0;
+
+    for(; mask; mask &= mask - 1)
+    {
+        count++;
+    }
+    return count;
+#endif
+}
+
+#ifdef UTILS_HAVE_SSE2
+/****************************************************************************
+ * Marks the control bytes among 16 bytes.
+ *
+ * \param data     16 bytes.
+ * \return         Bit i set if data[i] is a control byte.
+ *****************************************************************************/
+static inline unsigned int FrameByteMaskSse2(const char *data)
+{
+    __m128i v = _mm_loadu_si128((const __m128i*)data);
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(0x01)),
+                                          _mm_cmpeq_epi8(v, _mm_set1_epi8(0x04))),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8(0x10)));
+
+    return (unsigned int)_mm_movemask_epi8(m);
+}
+#endif
+
+#ifdef UTILS_HAVE_AVX2
+/****************************************************************************
+ * AVX2 variant of the SSE2 routine above, 32 bytes at a time.
+ *****************************************************************************/
+__attribute__((target("avx2")))
+static inline unsigned int FrameByteMaskAvx2(const char *data)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i*)data);
+    __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x01)),
+                                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x04))),
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x10)));
+
+    return (unsigned int)_mm256_movemask_epi8(m);
+}
+
+static bool CpuHasAvx2();
+#endif
+
+/****************************************************************************
+ * Escapes a block of \a n bytes, \a mask marking its control bytes. The runs
+ * between a few control bytes are copied at once, crowded blocks go byte by
+ * byte without branches.
+ *****************************************************************************/
+static inline char *EscapeBlock(const char *data, unsigned int n, unsigned int mask, char *out)
+{
+    unsigned int pos = 0;
+    unsigned int bit;
+
+    if(BitCount(mask) > 2)
+    {
+        for(unsigned int i = 0; i < n; i++)
+        {
+            *out = 0x10;
+            out += (mask >> i) & 1;
+            *out++ = data[i];
+        }
+        return out;
+    }
+
+    while(mask)
+    {
+        bit = LowestBit(mask);
+        memcpy(out, data + pos, bit - pos);
+        out += bit - pos;
+        *out++ = 0x10;
+        *out++ = data[bit];
+        pos = bit + 1;
+        mask &= mask - 1;
+    }
+    memcpy(out, data + pos, n - pos);
+
+    return out + (n - pos);
+}
+
+#ifdef UTILS_HAVE_AVX2
+__attribute__((target("avx2")))
+static unsigned int EscapeFrameAvx2(const char *data, unsigned int len, char *out)
+{
+    char *start = out;
+    unsigned int mask;
+
+    while(len >= 32)
+    {
+        mask = FrameByteMaskAvx2(data);
+        if(mask == 0)
+        {
+            _mm256_storeu_si256((__m256i*)out, _mm256_loadu_si256((const __m256i*)data));
+            out += 32;
+        }
+        else if(mask == 0xFFFFFFFF)
+        {
+            // Only control bytes: interleave them with DLEs.
+            __m256i v = _mm256_loadu_si256((const __m256i*)data);
+            __m256i lo = _mm256_unpacklo_epi8(_mm256_set1_epi8(0x10), v);
+            __m256i hi = _mm256_unpackhi_epi8(_mm256_set1_epi8(0x10), v);
+            _mm256_storeu_si256((__m256i*)out, _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i*)(out + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+            out += 64;
+        }
+        else
+        {
+            out = EscapeBlock(data, 32, mask, out);
+        }
+        data += 32;
+        len -= 32;
+    }
+
+    return (out - start) + Utils::EscapeFrame(data, len, out);
+}
+#endif
+
+#ifdef UTILS_HAVE_AVX2
+/****************************************************************************
+ * Scans the whole 32 byte blocks of a buffer.
+ *
+ * \return         Index of the first control byte, or the length of the
+ *                 blocks if there is none.
+ *****************************************************************************/
+__attribute__((target("avx2")))
+static unsigned int FindFrameByteAvx2(const char *data, unsigned int len)
+{
+    unsigned int i;
+
+    for(i = 0; (i + 32) <= len; i += 32)
+    {
+        unsigned int mask = FrameByteMaskAvx2(data + i);
+        if(mask)
+        {
+            return i + LowestBit(mask);
+        }
+    }
+
+    return i;
+}
+#endif
+
+/****************************************************************************
+ * Index of the first control byte (SOH, EOT or DLE) of a buffer.
+ *
+ * \param data     Pointer to a buffer of \a len bytes.
+ * \param len      Number of bytes in the \a data buffer.
+ * \return         Index of the first control byte, \a len if there is none.
+ *****************************************************************************/
+unsigned int Utils::FindFrameByte(const char *data, unsigned int len)
+{
+    unsigned int i = 0;
+
+#ifdef UTILS_HAVE_AVX2
+    if((len >= 32) && CpuHasAvx2())
+    {
+        i = FindFrameByteAvx2(data, len);
+        if(i < (len & ~31u))
+        {
+            return i;
+        }
+    }
+#endif
+
+#ifdef UTILS_HAVE_SSE2
+    for(; (i + 16) <= len; i += 16)
+    {
+        unsigned int mask = FrameByteMaskSse2(data + i);
+        if(mask)
+        {
+            return i + LowestBit(mask);
+        }
+    }
+#endif
+
+    for(; i < len; i++)
+    {
+        if(IsFrameByte(data[i]))
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/****************************************************************************
+ * Length of a buffer once escaped, SOH and EOT not included.
+ *
+ * \param data     Pointer to a buffer of \a len bytes.
+ * \param len      Number of bytes in the \a data buffer.
+ * \return         \a len plus one DLE per control byte.
+ *****************************************************************************/
+unsigned int Utils::EscapedLength(const char *data, unsigned int len)
+{
+    unsigned int count = len;
+    unsigned int i = 0;
+
+#ifdef UTILS_HAVE_SSE2
+    for(; (i + 16) <= len; i += 16)
+    {
+        count += BitCount(FrameByteMaskSse2(data + i));
+    }
+#endif
+
+    for(; i < len; i++)
+    {
+        if(IsFrameByte(data[i]))
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+/****************************************************************************
+ * Escapes a buffer: a DLE is inserted before every control byte. Blocks
+ * without control bytes are copied 16 or 32 bytes at a time.
+ *
+ * \param data     Pointer to a buffer of \a len bytes.
+ * \param len      Number of bytes in the \a data buffer.
+ * \param out      Output buffer of at least EscapedLength() bytes.
+ * \return         Number of bytes written to \a out.
+ *****************************************************************************/
+unsigned int Utils::EscapeFrame(const char *data, unsigned int len, char *out)
+{
+    char *start = out;
+
+#ifdef UTILS_HAVE_AVX2
+    if((len >= 32) && CpuHasAvx2())
+    {
+        return EscapeFrameAvx2(data, len, out);
+    }
+#endif
+
+#ifdef UTILS_HAVE_SSE2
+    while(len >= 16)
+    {
+        unsigned int mask = FrameByteMaskSse2(data);
+        if(mask == 0)
+        {
+            _mm_storeu_si128((__m128i*)out, _mm_loadu_si128((const __m128i*)data));
+            out += 16;
+        }
+        else if(mask == 0xFFFF)
+        {
+            // Only control bytes: interleave them with DLEs.
+            __m128i v = _mm_loadu_si128((const __m128i*)data);
+            _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi8(_mm_set1_epi8(0x10), v));
+            _mm_storeu_si128((__m128i*)(out + 16), _mm_unpackhi_epi8(_mm_set1_epi8(0x10), v));
+            out += 32;
+        }
+        else
+        {
+            out = EscapeBlock(data, 16, mask, out);
+        }
+        data += 16;
+        len -= 16;
+    }
+#endif
+
+    while(len--)
+    {
+        if(IsFrameByte(*data))
+        {
+            *out++ = 0x10;
+        }
+        *out++ = *data++;
+    }
+
+    return out - start;
+}
+
+/**
+ * Ascii to nibble table. 0xFF marks a character that is not a hex digit.
+ *****************************************************************************/
+static const unsigned char hex_table[256] =
+{
+#define X 0xFF
+    X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+    X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, 0,1,2,3,4,5,6,7,8,9,X,X,X,X,X,X,
+    X,10,11,12,13,14,15,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+    X,10,11,12,13,14,15,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+    X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+    X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+    X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,
+    X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X, X,X,X,X,X,X,X,X,X,X,X,X,X,X,X,X
+#undef X
+};
+
+#ifdef UTILS_HAVE_SSE2
+/****************************************************************************
+ * Converts 16 ascii hex digits to 8 bytes.
+ *
+ * \param v        16 ascii characters.
+ * \param out      Receives the 8 bytes in the low half.
+ * \return         true if all 16 characters are hex digits.
+ *****************************************************************************/
+static inline bool HexToBinSse2(__m128i v, __m128i *out)
+{
+    // '0'..'9' -> 0..9. Everything else (including bytes >= 0x80) falls outside 0..9.
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(d, _mm_set1_epi8(-1)),
+                                    _mm_cmplt_epi8(d, _mm_set1_epi8(10)));
+    // 'a'..'f' and 'A'..'F' -> 0..5.
+    __m128i l = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8(-1)),
+                                     _mm_cmplt_epi8(l, _mm_set1_epi8(6)));
+    __m128i n = _mm_or_si128(_mm_and_si128(isDigit, d),
+                             _mm_and_si128(isLetter, _mm_add_epi8(l, _mm_set1_epi8(10))));
+
+    if(_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xFFFF)
+    {
+        return false;
+    }
+
+    // Each 16 bit lane holds (low nibble << 8) | high nibble.
+    n = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n, _mm_set1_epi16(0x00FF)), 4), _mm_srli_epi16(n, 8));
+    *out = _mm_packus_epi16(n, _mm_setzero_si128());
+    return true;
+}
+#endif
+
+#ifdef UTILS_HAVE_AVX2
+/****************************************************************************
+ * AVX2 variant of the SSE2 routine above. Converts 32 digits to 16 bytes.
+ *****************************************************************************/
+__attribute__((target("avx2")))
+static bool HexToBinAvx2(const char *ascii, unsigned int len, unsigned char *bin, unsigned int *sum)
+{
+    __m128i acc = _mm_setzero_si128();
+
+    while(len >= 16)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)ascii);
+        __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+        __m256i isDigit = _mm256_and_si256(_mm256_cmpgt_epi8(d, _mm256_set1_epi8(-1)),
+                                           _mm256_cmpgt_epi8(_mm256_set1_epi8(10), d));
+        __m256i l = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+        __m256i isLetter = _mm256_and_si256(_mm256_cmpgt_epi8(l, _mm256_set1_epi8(-1)),
+                                            _mm256_cmpgt_epi8(_mm256_set1_epi8(6), l));
+        __m256i n = _mm256_or_si256(_mm256_and_si256(isDigit, d),
+                                    _mm256_and_si256(isLetter, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+        __m128i b;
+
+        if(_mm256_movemask_epi8(_mm256_or_si256(isDigit, isLetter)) != -1)
+        {
+            return false;
+        }
+
+        n = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(n, _mm256_set1_epi16(0x00FF)), 4),
+                            _mm256_srli_epi16(n, 8));
+        b = _mm_packus_epi16(_mm256_castsi256_si128(n), _mm256_extracti128_si256(n, 1));
+        _mm_storeu_si128((__m128i*)bin, b);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(b, _mm_setzero_si128()));
+
+        ascii += 32;
+        bin += 16;
+        len -= 16;
+    }
+
+    *sum += (unsigned int)_mm_cvtsi128_si32(acc) + (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+
+    while(len--)
+    {
+        unsigned char h = hex_table[(unsigned char)ascii[0]];
+        unsigned char l = hex_table[(unsigned char)ascii[1]];
+        if((h | l) & 0xF0)
+        {
+            return false;
+        }
+        *bin = (h << 4) | l;
+        *sum += *bin++;
+        ascii += 2;
+    }
+
+    return true;
+}
+
+static bool CpuHasAvx2()
+{
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#endif
+
+/****************************************************************************
+ * Converts ascii hex digits to binary without any allocation.
+ *
+ * \param ascii    Pointer to 2 * \a len hex digits.
+ * \param len      Number of bytes to produce.
+ * \param bin      Output buffer of at least \a len bytes.
+ * \param sum      Receives the modulo 256 sum of the produced bytes.
+ * \return         false if a character is not a hex digit.
+ *****************************************************************************/
+bool Utils::HexToBin(const char *ascii, unsigned int len, unsigned char *bin, unsigned char *sum)
+{
+    unsigned int total = 0;
+
+#ifdef UTILS_HAVE_AVX2
+    if((len >= 16) && CpuHasAvx2())
+    {
+        if(!HexToBinAvx2(ascii, len, bin, &total))
+        {
+            return false;
+        }
+        *sum = total & 0xFF;
+        return true;
+    }
+#endif
+
+#ifdef UTILS_HAVE_SSE2
+    {
+        __m128i acc = _mm_setzero_si128();
+
+        while(len >= 8)
+        {
+            __m128i b;
+            if(!HexToBinSse2(_mm_loadu_si128((const __m128i*)ascii), &b))
+            {
+                return false;
+            }
+            _mm_storel_epi64((__m128i*)bin, b);
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(b, _mm_setzero_si128()));
+            ascii += 16;
+            bin += 8;
+            len -= 8;
+        }
+        total = (unsigned int)_mm_cvtsi128_si32(acc) + (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+    }
+#endif
+
+    while(len--)
+    {
+        unsigned char h = hex_table[(unsigned char)ascii[0]];
+        unsigned char l = hex_table[(unsigned char)ascii[1]];
+        if((h | l) & 0xF0)
+        {
+            return false;
+        }
+        *bin = (h << 4) | l;
+        total += *bin++;
+        ascii += 2;
+    }
+
+    *sum = total & 0xFF;
+    return true;
+}
+
+/****************************************************************************
+ * Decodes one Intel HEX record and validates its length and checksum.
+ *
+ * \param ascii    Record text starting with ':', without line ending.
+ * \param asciiLen Number of characters in \a ascii.
+ * \param rec      Output buffer for the decoded record.
+ * \param recLen   Size of \a rec in bytes.
+ * \return         Decoded record length, or -1 if the record is not valid.
+ *****************************************************************************/
+int Utils::DecodeHexRecord(const char *ascii, unsigned int asciiLen, unsigned char *rec, unsigned int recLen)
+{
+    unsigned int len;
+    unsigned char sum;
+
+    if((asciiLen < 11) || (ascii[0] != ':') || !(asciiLen & 1))
+    {
+        // Too short, no start code or odd number of digits.
+        return -1;
+    }
+
+    len = (asciiLen - 1) / 2;
+    if(len > recLen)
+    {
+        return -1;
+    }
+
+    if(!HexToBin(ascii + 1, len, rec, &sum))
+    {
+        return -1;
+    }
+
+    if((len != (unsigned int)(rec[0] + 5)) || (sum != 0))
+    {
+        // Length field or checksum mismatch.
+        return -1;
+    }
+
+    return len;
+}
@@ -7,7 +7,35 @@ class Utils
 public:
     Utils();
 
+    // CRC16-CCITT implementations. All of them give the same result.
+    typedef enum
+    {
+        CRC_ENGINE_AUTO = -1,   // Fastest on this machine, measured on first use.
+        CRC_ENGINE_NIBBLE,      // 16 entry table, two lookups per byte.
+        CRC_ENGINE_BYTE,        // 256 entry table.
+        CRC_ENGINE_SLICE4,      // Slicing-by-4.
+        CRC_ENGINE_SLICE8,      // Slicing-by-8.
+        CRC_ENGINE_CLMUL,       // Carry-less multiply folding, slicing-by-8 if the CPU lacks it.
+        CRC_ENGINE_COUNT
+    }T_CRC_ENGINE;
+
     static unsigned short CalculateCrc(char *data, unsigned int len);
+    static unsigned short UpdateCrc(unsigned short crc, const char *data, unsigned int len);
+    static unsigned short UpdateCrc(T_CRC_ENGINE engine, unsigned short crc, const char *data, unsigned int len);
+    static void SetCrcEngine(T_CRC_ENGINE engine);
+    static T_CRC_ENGINE GetCrcEngine(void);
+    static T_CRC_ENGINE FastestCrcEngine(void);
+    static bool CrcEngineSupported(T_CRC_ENGINE engine);
+    static unsigned short CombineCrc(unsigned short crc1, unsigned short crc2, unsigned int len2);
+    static unsigned int UpdateCrc32(unsigned int crc, const char *data, unsigned int len);
+
+    // DLE escaping of the bootloader frames.
+    static unsigned int FindFrameByte(const char *data, unsigned int len);
+    static unsigned int EscapedLength(const char *data, unsigned int len);
+    static unsigned int EscapeFrame(const char *data, unsigned int len, char *out);
+
+    static bool HexToBin(const char *ascii, unsigned int len, unsigned char *bin, unsigned char *sum);
+    static int DecodeHexRecord(const char *ascii, unsigned int asciiLen, unsigned char *rec, unsigned int recLen);
 
 };
 